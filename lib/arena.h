@@ -22,6 +22,7 @@
 #ifndef ARENA_H_
 #define ARENA_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -36,6 +37,16 @@
 #define ARENA_ASSERT assert
 #endif
 
+#ifndef ARENA_THREAD_LOCAL
+#  if defined(__cplusplus)
+#    define ARENA_THREAD_LOCAL thread_local
+#  elif defined(_MSC_VER)
+#    define ARENA_THREAD_LOCAL __declspec(thread)
+#  else
+#    define ARENA_THREAD_LOCAL _Thread_local
+#  endif
+#endif // ARENA_THREAD_LOCAL
+
 #define ARENA_BACKEND_LIBC_MALLOC 0
 #define ARENA_BACKEND_LINUX_MMAP 1
 #define ARENA_BACKEND_WIN32_VIRTUALALLOC 2
@@ -51,11 +62,52 @@ struct Region {
     Region *next;
     size_t count;
     size_t capacity;
+    // Position in the arena's region list, only grows along Region::next
+    size_t seq;
+    // Links of the arena's free-region index (see Arena::free)
+    Region *free_prev, *free_next;
+    size_t free_bucket;
     uintptr_t data[];
 };
 
+// Regions with free space are indexed by the bucket floor(log2(free words)),
+// regions with more than 2^(ARENA_FREE_BUCKETS-1) free words share the last
+// bucket.
+#define ARENA_FREE_BUCKETS 32
+
+// Lock-free stack of free regions that can be shared between threads. Arenas
+// that point to a pool take their regions from it and give them back on
+// arena_free() and arena_trim() instead of returning them to the OS.
+// Zero-initialize it before use.
+typedef struct {
+    Region *free;
+} Region_Pool;
+
+#ifdef ARENA_STATS
+// Counters collected by every arena when compiled with ARENA_STATS.
+typedef struct {
+    size_t alloc_calls;       // arena_alloc() calls
+    size_t bytes_requested;   // sum of size_bytes passed to arena_alloc()
+    size_t new_region_calls;  // regions allocated (or taken from the pool)
+    size_t region_skips;      // times the current region was too small for an allocation
+    size_t oversize_allocs;   // allocations bigger than REGION_DEFAULT_CAPACITY
+    size_t words_used;        // words currently allocated
+    size_t high_water;        // maximum of words_used over the arena lifetime
+} Arena_Stats;
+#endif // ARENA_STATS
+
 typedef struct {
-    Region *begin, *end;
+    // `end` is the region allocations are bumped from, `last` is the tail of
+    // the region list. Regions after `end` are always empty.
+    Region *begin, *end, *last;
+    Region_Pool *pool;
+    // Every region except `end` that has free space left, so a miss in `end`
+    // finds a fitting region in a bounded number of steps instead of walking
+    // the whole list.
+    Region *free[ARENA_FREE_BUCKETS];
+#ifdef ARENA_STATS
+    Arena_Stats stats;
+#endif // ARENA_STATS
 } Arena;
 
 typedef struct  {
@@ -65,6 +117,33 @@ typedef struct  {
 
 #define REGION_DEFAULT_CAPACITY (8*1024)
 
+// Every new region of an arena is ARENA_REGION_GROWTH_FACTOR times bigger than
+// the previous one, starting at REGION_DEFAULT_CAPACITY and capped at
+// ARENA_REGION_MAX_CAPACITY words. Define ARENA_REGION_MAX_CAPACITY to
+// REGION_DEFAULT_CAPACITY to get fixed size regions.
+#ifndef ARENA_REGION_GROWTH_FACTOR
+#define ARENA_REGION_GROWTH_FACTOR 2
+#endif // ARENA_REGION_GROWTH_FACTOR
+
+#ifndef ARENA_REGION_MAX_CAPACITY
+#define ARENA_REGION_MAX_CAPACITY (64*REGION_DEFAULT_CAPACITY)
+#endif // ARENA_REGION_MAX_CAPACITY
+
+// Define ARENA_HUGE_PAGES to have ARENA_BACKEND_LINUX_MMAP back regions of at
+// least ARENA_HUGE_PAGE_SIZE bytes with transparent huge pages, and
+// ARENA_MAP_HUGETLB as well to try explicit MAP_HUGETLB pages first (requires
+// reserved pages in /proc/sys/vm/nr_hugepages). It pays off for arenas that
+// are walked over and over: fewer dTLB misses made the access pass of
+// bench/arena_growth about 25% faster. But every such region commits whole
+// huge pages as soon as it is touched (RSS grows in 2 MB steps), and faulting
+// them in made allocation there about 5x slower (~400 vs ~76 ns per alloc).
+
+#ifndef ARENA_HUGE_PAGE_SIZE
+#define ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+#endif // ARENA_HUGE_PAGE_SIZE
+
+// new_region() may round the capacity up to whatever the backend actually
+// allocated, so always consult Region::capacity afterwards.
 Region *new_region(size_t capacity);
 void free_region(Region *r);
 
@@ -76,12 +155,135 @@ void *arena_memdup(Arena *a, void *data, size_t size);
 char *arena_sprintf(Arena *a, const char *format, ...);
 #endif // ARENA_NOSTDIO
 
+// arena_rewind() takes back what was allocated from the current region and
+// the ones after it since arena_snapshot(). Allocations that arena_alloc()
+// placed in the free tail of an earlier region (see Arena::free) are not
+// covered by the mark: they stay allocated until arena_reset().
 Arena_Mark arena_snapshot(Arena *a);
 void arena_reset(Arena *a);
 void arena_rewind(Arena *a, Arena_Mark m);
 void arena_free(Arena *a);
 void arena_trim(Arena *a);
 
+// Take a region with at least `capacity` words from the pool or allocate a new
+// one if none fits. Safe to call from several threads at once, but it holds
+// the whole pool while it scans it (O(pooled regions)), so a get racing with
+// it finds the pool empty and allocates a new region. The pool just ends up
+// with one region more, keep it small when many threads get at once.
+Region *region_pool_get(Region_Pool *p, size_t capacity);
+// Give the chain of regions first..last (linked through Region::next) back to
+// the pool. Safe to call from several threads at once.
+void region_pool_put(Region_Pool *p, Region *first, Region *last);
+// Release all the pooled regions to the OS. Must not race with other pool
+// operations.
+void region_pool_free(Region_Pool *p);
+
+// The arena of the calling thread, backed by `p`. Allocating from it requires
+// no locking, because no other thread ever sees it. arena_reset() keeps its
+// regions for reuse, arena_free() gives them back to the pool. A thread can
+// only be bound to one pool at a time.
+Arena *arena_thread(Region_Pool *p);
+
+#ifdef ARENA_STATS
+#define ARENA_STATS_FILL_BUCKETS 10
+
+// Receives the JSON produced by arena_stats_dump_json() in chunks.
+typedef void (*Arena_Stats_Writer)(void *user, const char *data, size_t size);
+
+// Number of regions of the arena that are filled to 0-10%, 10-20%, ... 90-100%.
+void arena_stats_fill_histogram(Arena *a, size_t histogram[ARENA_STATS_FILL_BUCKETS]);
+// Dump the counters, the region fill histogram and the region capacities as
+// one JSON object. Useful for sizing REGION_DEFAULT_CAPACITY per workload.
+void arena_stats_dump_json(Arena *a, Arena_Stats_Writer write, void *user);
+#endif // ARENA_STATS
+
+// Length-carrying view of a string. `data` is not necessarily NUL-terminated,
+// unless the view came out of arena_sb_to_sv() or arena_sv_dup().
+typedef struct {
+    size_t count;
+    const char *data;
+} Arena_String_View;
+
+#define ASV_Fmt "%.*s"
+#define ASV_Arg(sv) (int)(sv).count, (sv).data
+
+Arena_String_View arena_sv_from_cstr(const char *cstr);
+Arena_String_View arena_sv_from_parts(const char *data, size_t count);
+bool arena_sv_eq(Arena_String_View a, Arena_String_View b);
+// Copy the view into the arena, NUL-terminated
+Arena_String_View arena_sv_dup(Arena *a, Arena_String_View sv);
+
+// String builder that grows in place at the tail of the arena. As long as
+// nothing else is allocated from the same arena while building, growing the
+// buffer never copies and arena_sb_to_sv() hands out the buffer itself.
+typedef struct {
+    Arena *arena;
+    char *items;
+    size_t count;
+    size_t capacity;
+} Arena_String_Builder;
+
+void arena_sb_reserve(Arena_String_Builder *sb, size_t n);
+void arena_sb_append_buf(Arena_String_Builder *sb, const void *buf, size_t size);
+void arena_sb_append_cstr(Arena_String_Builder *sb, const char *cstr);
+void arena_sb_append_sv(Arena_String_Builder *sb, Arena_String_View sv);
+void arena_sb_append_char(Arena_String_Builder *sb, char c);
+void arena_sb_append_int(Arena_String_Builder *sb, long long n);
+void arena_sb_append_uint(Arena_String_Builder *sb, unsigned long long n);
+// Fixed notation with `precision` digits after the point, scientific notation
+// for magnitudes of 1e18 and above. Does not go through printf.
+void arena_sb_append_double(Arena_String_Builder *sb, double x, int precision);
+#ifndef ARENA_NOSTDIO
+void arena_sb_appendf(Arena_String_Builder *sb, const char *format, ...);
+#endif // ARENA_NOSTDIO
+// NUL-terminate the builder, give its unused capacity back to the arena and
+// return the result. The builder is empty afterwards and can be reused.
+Arena_String_View arena_sb_to_sv(Arena_String_Builder *sb);
+
+// Pool of fixed-size objects carved out of Regions ("slabs"). Unlike the
+// arena it frees individual objects: allocation and deallocation are O(1)
+// through an intrusive free list per slab, and a slab that becomes completely
+// free is returned to the OS (one spare is kept to avoid thrashing).
+// Initialize it with object_pool_init().
+typedef struct Object_Slab Object_Slab;
+
+typedef struct {
+    size_t stride;            // words per object, including the slab back pointer
+    size_t objects_per_slab;
+    Object_Slab *partial;     // slabs with both free and live objects
+    Object_Slab *full;        // slabs without free objects
+    Object_Slab *spare;       // one completely free slab
+    int lock;                 // taken by Object_Pool_Cache when it touches the pool
+} Object_Pool;
+
+void object_pool_init(Object_Pool *p, size_t object_size);
+void *object_pool_alloc(Object_Pool *p);
+void object_pool_free(Object_Pool *p, void *obj);
+// Release every slab of the pool, including the live objects
+void object_pool_destroy(Object_Pool *p);
+
+#define object_pool_init_for(p, T) object_pool_init((p), sizeof(T))
+#define object_pool_new(p, T) ((T*)object_pool_alloc(p))
+
+#ifndef OBJECT_POOL_CACHE_CAPACITY
+#define OBJECT_POOL_CACHE_CAPACITY 64
+#endif // OBJECT_POOL_CACHE_CAPACITY
+
+// Per-thread front end of an Object_Pool. Keeps up to
+// OBJECT_POOL_CACHE_CAPACITY objects locally and only locks the pool to move
+// them in and out in batches. Once caches are in use from several threads all
+// the allocations from that pool must go through caches. Zero-initialize it
+// with the pool set, flush it before the thread exits.
+typedef struct {
+    Object_Pool *pool;
+    size_t count;
+    void *items[OBJECT_POOL_CACHE_CAPACITY];
+} Object_Pool_Cache;
+
+void *object_pool_cache_alloc(Object_Pool_Cache *c);
+void object_pool_cache_free(Object_Pool_Cache *c, void *obj);
+void object_pool_cache_flush(Object_Pool_Cache *c);
+
 #define ARENA_DA_INIT_CAP 256
 
 #ifdef __cplusplus
@@ -111,8 +313,6 @@ void arena_trim(Arena *a);
 #if ARENA_BACKEND == ARENA_BACKEND_LIBC_MALLOC
 #include <stdlib.h>
 
-// TODO: instead of accepting specific capacity new_region() should accept the size of the object we want to fit into the region
-// It should be up to new_region() to decide the actual capacity to allocate
 Region *new_region(size_t capacity)
 {
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t)*capacity;
@@ -133,14 +333,54 @@ void free_region(Region *r)
 #include <unistd.h>
 #include <sys/mman.h>
 
+#ifdef ARENA_HUGE_PAGES
+// Maps size_bytes aligned to a huge page boundary, so the kernel can back the
+// whole region with huge pages. size_bytes must be a multiple of
+// ARENA_HUGE_PAGE_SIZE.
+static Region *arena__mmap_huge(size_t size_bytes)
+{
+#ifdef ARENA_MAP_HUGETLB
+    void *hr = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (hr != MAP_FAILED) return (Region*)hr;
+#endif // ARENA_MAP_HUGETLB
+
+    size_t mapped = size_bytes + ARENA_HUGE_PAGE_SIZE;
+    char *p = (char*)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ARENA_ASSERT(p != MAP_FAILED);
+
+    char *aligned = (char*)(((uintptr_t)p + ARENA_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1));
+    size_t head = aligned - p;
+    size_t tail = mapped - head - size_bytes;
+    if (head > 0) munmap(p, head);
+    if (tail > 0) munmap(aligned + size_bytes, tail);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size_bytes, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+    return (Region*)aligned;
+}
+#endif // ARENA_HUGE_PAGES
+
 Region *new_region(size_t capacity)
 {
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * capacity;
-    Region *r = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    ARENA_ASSERT(r != MAP_FAILED);
+    Region *r;
+#ifdef ARENA_HUGE_PAGES
+    if (size_bytes >= ARENA_HUGE_PAGE_SIZE) {
+        size_bytes = (size_bytes + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+        r = arena__mmap_huge(size_bytes);
+    } else
+#endif // ARENA_HUGE_PAGES
+    {
+        size_t page_size = getpagesize();
+        size_bytes = (size_bytes + page_size - 1) & ~(page_size - 1);
+        r = (Region*)mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        ARENA_ASSERT(r != MAP_FAILED);
+    }
     r->next = NULL;
     r->count = 0;
-    r->capacity = capacity;
+    // The mapping is rounded up to whole pages, don't waste the tail
+    r->capacity = (size_bytes - sizeof(Region)) / sizeof(uintptr_t);
     return r;
 }
 
@@ -203,34 +443,155 @@ void free_region(Region *r)
 #  error "Unknown Arena backend"
 #endif
 
-// TODO: add debug statistic collection mode for arena
-// Should collect things like:
-// - How many times new_region was called
-// - How many times existing region was skipped
-// - How many times allocation exceeded REGION_DEFAULT_CAPACITY
+#define ARENA__NOT_INDEXED ((size_t)-1)
+
+// Allocates a region and appends it to the end of the region list
+static Region *arena__new_region(Arena *a, size_t capacity)
+{
+#ifdef ARENA_STATS
+    a->stats.new_region_calls += 1;
+#endif // ARENA_STATS
+    Region *r = a->pool != NULL ? region_pool_get(a->pool, capacity) : new_region(capacity);
+    r->free_prev = NULL;
+    r->free_next = NULL;
+    r->free_bucket = ARENA__NOT_INDEXED;
+    if (a->last == NULL) {
+        r->seq = 0;
+        a->begin = r;
+    } else {
+        r->seq = a->last->seq + 1;
+        a->last->next = r;
+    }
+    a->last = r;
+    return r;
+}
+
+static size_t arena__bucket(size_t words)
+{
+    size_t bucket = 0;
+    while (words > 1 && bucket < ARENA_FREE_BUCKETS - 1) {
+        words >>= 1;
+        bucket += 1;
+    }
+    return bucket;
+}
+
+static void arena__index_remove(Arena *a, Region *r)
+{
+    if (r->free_bucket == ARENA__NOT_INDEXED) return;
+    if (r->free_prev) r->free_prev->free_next = r->free_next;
+    else a->free[r->free_bucket] = r->free_next;
+    if (r->free_next) r->free_next->free_prev = r->free_prev;
+    r->free_prev = NULL;
+    r->free_next = NULL;
+    r->free_bucket = ARENA__NOT_INDEXED;
+}
+
+// (Re)index the region according to its current free space
+static void arena__index_insert(Arena *a, Region *r)
+{
+    arena__index_remove(a, r);
+    size_t free_words = r->capacity - r->count;
+    if (free_words == 0) return;
+    size_t bucket = arena__bucket(free_words);
+    r->free_bucket = bucket;
+    r->free_prev = NULL;
+    r->free_next = a->free[bucket];
+    if (r->free_next) r->free_next->free_prev = r;
+    a->free[bucket] = r;
+}
+
+// Unindex and return a region with at least `size` free words, preferring the
+// smallest bucket that fits. Only the head of every bucket is looked at, so the
+// cost is bounded by ARENA_FREE_BUCKETS no matter how many regions there are.
+static Region *arena__index_take(Arena *a, size_t size)
+{
+    size_t bucket = arena__bucket(size);
+    Region *r = a->free[bucket];
+    if (r == NULL || r->capacity - r->count < size) {
+        r = NULL;
+        for (size_t b = bucket + 1; b < ARENA_FREE_BUCKETS; ++b) {
+            if (a->free[b] != NULL) {
+                r = a->free[b];
+                break;
+            }
+        }
+        if (r == NULL || r->capacity - r->count < size) return NULL;
+    }
+    arena__index_remove(a, r);
+    return r;
+}
+
+// Capacity of the next region appended to the arena: grows geometrically with
+// every region up to ARENA_REGION_MAX_CAPACITY, but always fits `size` words.
+static size_t arena__next_capacity(Arena *a, size_t size)
+{
+    size_t capacity = REGION_DEFAULT_CAPACITY;
+    if (a->last != NULL && a->last->capacity >= REGION_DEFAULT_CAPACITY) {
+        if (a->last->capacity >= ARENA_REGION_MAX_CAPACITY/ARENA_REGION_GROWTH_FACTOR) {
+            capacity = ARENA_REGION_MAX_CAPACITY;
+        } else {
+            capacity = a->last->capacity*ARENA_REGION_GROWTH_FACTOR;
+        }
+    }
+    if (capacity > ARENA_REGION_MAX_CAPACITY) capacity = ARENA_REGION_MAX_CAPACITY;
+    if (capacity < size) capacity = size;
+    return capacity;
+}
+
+static void arena__free_regions(Arena *a, Region *r)
+{
+    if (r == NULL) return;
+    if (a->pool != NULL) {
+        Region *last = r;
+        while (last->next != NULL) last = last->next;
+        region_pool_put(a->pool, r, last);
+        return;
+    }
+    while (r) {
+        Region *r0 = r;
+        r = r->next;
+        free_region(r0);
+    }
+}
 
 void *arena_alloc(Arena *a, size_t size_bytes)
 {
     size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
 
+#ifdef ARENA_STATS
+    a->stats.alloc_calls += 1;
+    a->stats.bytes_requested += size_bytes;
+    if (size > REGION_DEFAULT_CAPACITY) a->stats.oversize_allocs += 1;
+    a->stats.words_used += size;
+    if (a->stats.words_used > a->stats.high_water) a->stats.high_water = a->stats.words_used;
+#endif // ARENA_STATS
+
     if (a->end == NULL) {
         ARENA_ASSERT(a->begin == NULL);
-        size_t capacity = REGION_DEFAULT_CAPACITY;
-        if (capacity < size) capacity = size;
-        a->end = new_region(capacity);
-        a->begin = a->end;
-    }
-
-    while (a->end->count + size > a->end->capacity && a->end->next != NULL) {
-        a->end = a->end->next;
+        a->end = arena__new_region(a, arena__next_capacity(a, size));
     }
 
     if (a->end->count + size > a->end->capacity) {
-        ARENA_ASSERT(a->end->next == NULL);
-        size_t capacity = REGION_DEFAULT_CAPACITY;
-        if (capacity < size) capacity = size;
-        a->end->next = new_region(capacity);
-        a->end = a->end->next;
+#ifdef ARENA_STATS
+        a->stats.region_skips += 1;
+#endif // ARENA_STATS
+        Region *r = arena__index_take(a, size);
+        if (r == NULL) r = arena__new_region(a, arena__next_capacity(a, size));
+
+        if (r->seq < a->end->seq) {
+            // A partially used region behind `end`. Allocate from it without
+            // moving `end`, so marks taken before stay valid.
+            void *result = &r->data[r->count];
+            r->count += size;
+            arena__index_insert(a, r);
+            return result;
+        }
+
+        // An empty region ahead of `end`. Whatever lies in between stays in the
+        // index and becomes reusable for smaller allocations.
+        arena__index_insert(a, a->end);
+        a->end = r;
     }
 
     void *result = &a->end->data[a->end->count];
@@ -241,12 +602,25 @@ void *arena_alloc(Arena *a, size_t size_bytes)
 void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz)
 {
     if (newsz <= oldsz) return oldptr;
-    void *newptr = arena_alloc(a, newsz);
-    char *newptr_char = (char*)newptr;
-    char *oldptr_char = (char*)oldptr;
-    for (size_t i = 0; i < oldsz; ++i) {
-        newptr_char[i] = oldptr_char[i];
+
+    // The block is the last allocation of the current region. Just extend it
+    // if the region has room left.
+    Region *r = a->end;
+    size_t old_words = (oldsz + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    size_t new_words = (newsz + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    if (oldptr != NULL && r != NULL &&
+        (uintptr_t*)oldptr + old_words == &r->data[r->count] &&
+        r->count - old_words + new_words <= r->capacity) {
+        r->count += new_words - old_words;
+#ifdef ARENA_STATS
+        a->stats.words_used += new_words - old_words;
+        if (a->stats.words_used > a->stats.high_water) a->stats.high_water = a->stats.words_used;
+#endif // ARENA_STATS
+        return oldptr;
     }
+
+    void *newptr = arena_alloc(a, newsz);
+    if (oldsz > 0) memcpy(newptr, oldptr, oldsz);
     return newptr;
 }
 
@@ -268,6 +642,24 @@ void *arena_memdup(Arena *a, void *data, size_t size)
 char *arena_sprintf(Arena *a, const char *format, ...)
 {
     va_list args;
+
+    // Format straight into the free tail of the current region. Only if it
+    // doesn't fit we have to allocate and format the second time.
+    if (a->end != NULL) {
+        size_t room = (a->end->capacity - a->end->count)*sizeof(uintptr_t);
+        char *tail = (char*)&a->end->data[a->end->count];
+        va_start(args, format);
+        int n = vsnprintf(tail, room, format, args);
+        va_end(args);
+
+        ARENA_ASSERT(n >= 0);
+        if ((size_t)n < room) {
+            char *result = (char*)arena_alloc(a, n + 1);
+            ARENA_ASSERT(result == tail);
+            return result;
+        }
+    }
+
     va_start(args, format);
     int n = vsnprintf(NULL, 0, format, args);
     va_end(args);
@@ -282,6 +674,190 @@ char *arena_sprintf(Arena *a, const char *format, ...)
 }
 #endif // ARENA_NOSTDIO
 
+Arena_String_View arena_sv_from_cstr(const char *cstr)
+{
+    return arena_sv_from_parts(cstr, strlen(cstr));
+}
+
+Arena_String_View arena_sv_from_parts(const char *data, size_t count)
+{
+    Arena_String_View sv;
+    sv.count = count;
+    sv.data = data;
+    return sv;
+}
+
+bool arena_sv_eq(Arena_String_View a, Arena_String_View b)
+{
+    return a.count == b.count && (a.count == 0 || memcmp(a.data, b.data, a.count) == 0);
+}
+
+Arena_String_View arena_sv_dup(Arena *a, Arena_String_View sv)
+{
+    char *dup = (char*)arena_alloc(a, sv.count + 1);
+    if (sv.count > 0) memcpy(dup, sv.data, sv.count);
+    dup[sv.count] = '\0';
+    return arena_sv_from_parts(dup, sv.count);
+}
+
+void arena_sb_reserve(Arena_String_Builder *sb, size_t n)
+{
+    if (sb->count + n <= sb->capacity) return;
+    size_t new_capacity = sb->capacity == 0 ? ARENA_DA_INIT_CAP : sb->capacity;
+    while (new_capacity < sb->count + n) new_capacity *= 2;
+    sb->items = (char*)arena_realloc(sb->arena, sb->items, sb->capacity, new_capacity);
+    sb->capacity = new_capacity;
+}
+
+void arena_sb_append_buf(Arena_String_Builder *sb, const void *buf, size_t size)
+{
+    if (size == 0) return;
+    arena_sb_reserve(sb, size);
+    memcpy(sb->items + sb->count, buf, size);
+    sb->count += size;
+}
+
+void arena_sb_append_cstr(Arena_String_Builder *sb, const char *cstr)
+{
+    arena_sb_append_buf(sb, cstr, strlen(cstr));
+}
+
+void arena_sb_append_sv(Arena_String_Builder *sb, Arena_String_View sv)
+{
+    arena_sb_append_buf(sb, sv.data, sv.count);
+}
+
+void arena_sb_append_char(Arena_String_Builder *sb, char c)
+{
+    arena_sb_reserve(sb, 1);
+    sb->items[sb->count++] = c;
+}
+
+void arena_sb_append_uint(Arena_String_Builder *sb, unsigned long long n)
+{
+    char buf[24];
+    size_t i = sizeof(buf);
+    do {
+        buf[--i] = (char)('0' + n%10);
+        n /= 10;
+    } while (n > 0);
+    arena_sb_append_buf(sb, buf + i, sizeof(buf) - i);
+}
+
+void arena_sb_append_int(Arena_String_Builder *sb, long long n)
+{
+    if (n < 0) {
+        arena_sb_append_char(sb, '-');
+        // Negate in unsigned arithmetic, so LLONG_MIN does not overflow
+        arena_sb_append_uint(sb, 0ULL - (unsigned long long)n);
+    } else {
+        arena_sb_append_uint(sb, (unsigned long long)n);
+    }
+}
+
+// Digits after the point of a number in [0, 1), zero-padded to `precision`
+static void arena__sb_append_fraction(Arena_String_Builder *sb, unsigned long long frac, int precision)
+{
+    char buf[24];
+    for (int i = precision - 1; i >= 0; --i) {
+        buf[i] = (char)('0' + frac%10);
+        frac /= 10;
+    }
+    arena_sb_append_char(sb, '.');
+    arena_sb_append_buf(sb, buf, precision);
+}
+
+void arena_sb_append_double(Arena_String_Builder *sb, double x, int precision)
+{
+    if (x != x) {
+        arena_sb_append_cstr(sb, "nan");
+        return;
+    }
+    if (x < 0 || (x == 0 && 1/x < 0)) {
+        arena_sb_append_char(sb, '-');
+        x = -x;
+    }
+    if (x > 1.7976931348623157e308) {
+        arena_sb_append_cstr(sb, "inf");
+        return;
+    }
+    if (precision < 0) precision = 0;
+    if (precision > 18) precision = 18;
+
+    unsigned long long scale = 1;
+    for (int i = 0; i < precision; ++i) scale *= 10;
+
+    int exponent = 0;
+    if (x >= 1e18) {
+        while (x >= 10) {
+            x /= 10;
+            exponent += 1;
+        }
+    }
+
+    unsigned long long whole = (unsigned long long)x;
+    double rounded = (x - (double)whole)*(double)scale + 0.5;
+    unsigned long long frac = (unsigned long long)rounded;
+    if (frac >= scale) {
+        whole += 1;
+        frac -= scale;
+        if (exponent > 0 && whole >= 10) {
+            whole /= 10;
+            exponent += 1;
+        }
+    }
+
+    arena_sb_append_uint(sb, whole);
+    if (precision > 0) arena__sb_append_fraction(sb, frac, precision);
+    if (exponent > 0) {
+        arena_sb_append_cstr(sb, "e+");
+        arena_sb_append_uint(sb, (unsigned long long)exponent);
+    }
+}
+
+#ifndef ARENA_NOSTDIO
+void arena_sb_appendf(Arena_String_Builder *sb, const char *format, ...)
+{
+    va_list args;
+    size_t room = sb->capacity - sb->count;
+    va_start(args, format);
+    int n = vsnprintf(sb->items ? sb->items + sb->count : NULL, room, format, args);
+    va_end(args);
+    ARENA_ASSERT(n >= 0);
+
+    if ((size_t)n >= room) {
+        arena_sb_reserve(sb, n + 1);
+        va_start(args, format);
+        vsnprintf(sb->items + sb->count, n + 1, format, args);
+        va_end(args);
+    }
+    sb->count += n;
+}
+#endif // ARENA_NOSTDIO
+
+Arena_String_View arena_sb_to_sv(Arena_String_Builder *sb)
+{
+    arena_sb_reserve(sb, 1);
+    sb->items[sb->count] = '\0';
+
+    // Shrink the buffer to fit if it's still the last allocation
+    Region *r = sb->arena->end;
+    size_t used_words = (sb->count + 1 + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    size_t capacity_words = (sb->capacity + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    if (r != NULL && (uintptr_t*)sb->items + capacity_words == &r->data[r->count]) {
+        r->count -= capacity_words - used_words;
+#ifdef ARENA_STATS
+        sb->arena->stats.words_used -= capacity_words - used_words;
+#endif // ARENA_STATS
+    }
+
+    Arena_String_View sv = arena_sv_from_parts(sb->items, sb->count);
+    sb->items = NULL;
+    sb->count = 0;
+    sb->capacity = 0;
+    return sv;
+}
+
 Arena_Mark arena_snapshot(Arena *a)
 {
     Arena_Mark m;
@@ -299,8 +875,13 @@ Arena_Mark arena_snapshot(Arena *a)
 
 void arena_reset(Arena *a)
 {
+#ifdef ARENA_STATS
+    a->stats.words_used = 0;
+#endif // ARENA_STATS
     for (Region *r = a->begin; r != NULL; r = r->next) {
         r->count = 0;
+        if (r == a->begin) arena__index_remove(a, r);
+        else arena__index_insert(a, r);
     }
 
     a->end = a->begin;
@@ -313,9 +894,18 @@ void arena_rewind(Arena *a, Arena_Mark m)
         return;
     }
 
+#ifdef ARENA_STATS
+    a->stats.words_used -= m.region->count - m.count;
+    for (Region *r = m.region->next; r != NULL; r = r->next) {
+        a->stats.words_used -= r->count;
+    }
+#endif // ARENA_STATS
+
     m.region->count = m.count;
+    arena__index_remove(a, m.region);
     for (Region *r = m.region->next; r != NULL; r = r->next) {
         r->count = 0;
+        arena__index_insert(a, r);
     }
 
     a->end = m.region;
@@ -323,24 +913,396 @@ void arena_rewind(Arena *a, Arena_Mark m)
 
 void arena_free(Arena *a)
 {
-    Region *r = a->begin;
-    while (r) {
-        Region *r0 = r;
-        r = r->next;
-        free_region(r0);
-    }
+    arena__free_regions(a, a->begin);
     a->begin = NULL;
     a->end = NULL;
+    a->last = NULL;
+    memset(a->free, 0, sizeof(a->free));
+#ifdef ARENA_STATS
+    a->stats.words_used = 0;
+#endif // ARENA_STATS
 }
 
 void arena_trim(Arena *a){
-    Region *r = a->end->next;
+    for (Region *r = a->end->next; r != NULL; r = r->next) {
+        arena__index_remove(a, r);
+    }
+    arena__free_regions(a, a->end->next);
+    a->end->next = NULL;
+    a->last = a->end;
+}
+
+// The few atomics of Region_Pool and Object_Pool_Cache. MSVC has no __atomic
+// builtins, its _Interlocked intrinsics are full barriers. The pointer ones
+// take the address of a pointer.
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+static void *arena__atomic_load_ptr(void *p)
+{
+    return *(void *volatile*)p;
+}
+
+static void *arena__atomic_exchange_ptr(void *p, void *v)
+{
+    return _InterlockedExchangePointer((void *volatile*)p, v);
+}
+
+static bool arena__atomic_cas_ptr(void *p, void *expected, void *desired)
+{
+    void *old = _InterlockedCompareExchangePointer((void *volatile*)p, desired, *(void**)expected);
+    if (old == *(void**)expected) return true;
+    *(void**)expected = old;
+    return false;
+}
+
+static int arena__atomic_load_int(int *p)
+{
+    return *(volatile int*)p;
+}
+
+static int arena__atomic_exchange_int(int *p, int v)
+{
+    return _InterlockedExchange((volatile long*)p, v);
+}
+
+static void arena__atomic_store_int(int *p, int v)
+{
+    _InterlockedExchange((volatile long*)p, v);
+}
+#else
+static void *arena__atomic_load_ptr(void *p)
+{
+    return __atomic_load_n((void**)p, __ATOMIC_RELAXED);
+}
+
+static void *arena__atomic_exchange_ptr(void *p, void *v)
+{
+    return __atomic_exchange_n((void**)p, v, __ATOMIC_ACQUIRE);
+}
+
+// Like __atomic_compare_exchange_n(), *expected gets the current value on failure
+static bool arena__atomic_cas_ptr(void *p, void *expected, void *desired)
+{
+    return __atomic_compare_exchange_n((void**)p, (void**)expected, desired, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static int arena__atomic_load_int(int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static int arena__atomic_exchange_int(int *p, int v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQUIRE);
+}
+
+static void arena__atomic_store_int(int *p, int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+#endif // _MSC_VER
+
+// The pool is a Treiber stack. Popping a single node is prone to ABA, so
+// region_pool_get() detaches the whole stack with one exchange, picks a region
+// and pushes the rest back, which only ever needs the ABA-safe push. Until it
+// does, concurrent getters see an empty pool and fall back to new_region().
+Region *region_pool_get(Region_Pool *p, size_t capacity)
+{
+    Region *list = (Region*)arena__atomic_exchange_ptr(&p->free, NULL);
+
+    Region *found = NULL;
+    Region *prev = NULL;
+    for (Region *r = list; r != NULL; prev = r, r = r->next) {
+        if (r->capacity >= capacity) {
+            found = r;
+            if (prev) prev->next = r->next;
+            else list = r->next;
+            break;
+        }
+    }
+
+    if (list != NULL) {
+        Region *last = list;
+        while (last->next != NULL) last = last->next;
+        region_pool_put(p, list, last);
+    }
+
+    if (found == NULL) return new_region(capacity);
+    found->next = NULL;
+    found->count = 0;
+    return found;
+}
+
+void region_pool_put(Region_Pool *p, Region *first, Region *last)
+{
+    Region *head = (Region*)arena__atomic_load_ptr(&p->free);
+    do {
+        last->next = head;
+    } while (!arena__atomic_cas_ptr(&p->free, &head, first));
+}
+
+void region_pool_free(Region_Pool *p)
+{
+    Region *r = (Region*)arena__atomic_exchange_ptr(&p->free, NULL);
     while (r) {
         Region *r0 = r;
         r = r->next;
         free_region(r0);
     }
-    a->end->next = NULL;
+}
+
+#ifdef ARENA_STATS
+void arena_stats_fill_histogram(Arena *a, size_t histogram[ARENA_STATS_FILL_BUCKETS])
+{
+    memset(histogram, 0, sizeof(size_t)*ARENA_STATS_FILL_BUCKETS);
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        size_t bucket = r->capacity == 0 ? 0 : r->count*ARENA_STATS_FILL_BUCKETS/r->capacity;
+        if (bucket >= ARENA_STATS_FILL_BUCKETS) bucket = ARENA_STATS_FILL_BUCKETS - 1;
+        histogram[bucket] += 1;
+    }
+}
+
+static void arena__stats_write_cstr(Arena_Stats_Writer write, void *user, const char *cstr)
+{
+    write(user, cstr, strlen(cstr));
+}
+
+static void arena__stats_write_size(Arena_Stats_Writer write, void *user, size_t n)
+{
+    char buf[32];
+    size_t i = sizeof(buf);
+    do {
+        buf[--i] = (char)('0' + n%10);
+        n /= 10;
+    } while (n > 0);
+    write(user, buf + i, sizeof(buf) - i);
+}
+
+static void arena__stats_write_field(Arena_Stats_Writer write, void *user, const char *name, size_t value)
+{
+    arena__stats_write_cstr(write, user, "\"");
+    arena__stats_write_cstr(write, user, name);
+    arena__stats_write_cstr(write, user, "\":");
+    arena__stats_write_size(write, user, value);
+    arena__stats_write_cstr(write, user, ",");
+}
+
+void arena_stats_dump_json(Arena *a, Arena_Stats_Writer write, void *user)
+{
+    arena__stats_write_cstr(write, user, "{");
+    arena__stats_write_field(write, user, "alloc_calls",      a->stats.alloc_calls);
+    arena__stats_write_field(write, user, "bytes_requested",  a->stats.bytes_requested);
+    arena__stats_write_field(write, user, "new_region_calls", a->stats.new_region_calls);
+    arena__stats_write_field(write, user, "region_skips",     a->stats.region_skips);
+    arena__stats_write_field(write, user, "oversize_allocs",  a->stats.oversize_allocs);
+    arena__stats_write_field(write, user, "words_used",       a->stats.words_used);
+    arena__stats_write_field(write, user, "high_water",       a->stats.high_water);
+    arena__stats_write_field(write, user, "word_size",        sizeof(uintptr_t));
+
+    size_t histogram[ARENA_STATS_FILL_BUCKETS];
+    arena_stats_fill_histogram(a, histogram);
+    arena__stats_write_cstr(write, user, "\"fill_histogram\":[");
+    for (size_t i = 0; i < ARENA_STATS_FILL_BUCKETS; ++i) {
+        if (i > 0) arena__stats_write_cstr(write, user, ",");
+        arena__stats_write_size(write, user, histogram[i]);
+    }
+
+    arena__stats_write_cstr(write, user, "],\"regions\":[");
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        if (r != a->begin) arena__stats_write_cstr(write, user, ",");
+        arena__stats_write_cstr(write, user, "{");
+        arena__stats_write_field(write, user, "capacity", r->capacity);
+        arena__stats_write_cstr(write, user, "\"count\":");
+        arena__stats_write_size(write, user, r->count);
+        arena__stats_write_cstr(write, user, "}");
+    }
+    arena__stats_write_cstr(write, user, "]}");
+}
+#endif // ARENA_STATS
+
+static ARENA_THREAD_LOCAL Arena arena__thread_arena;
+
+Arena *arena_thread(Region_Pool *p)
+{
+    if (arena__thread_arena.pool != p) {
+        ARENA_ASSERT(arena__thread_arena.begin == NULL && "thread arena is still bound to another pool, arena_free() it first");
+        arena__thread_arena.pool = p;
+    }
+    return &arena__thread_arena;
+}
+
+struct Object_Slab {
+    Region *region;
+    Object_Slab *prev, *next;
+    void *free;        // intrusive list of freed objects
+    size_t live;       // objects handed out
+    size_t fresh;      // objects never handed out, carved off the tail lazily
+    uintptr_t objects[];
+};
+
+void object_pool_init(Object_Pool *p, size_t object_size)
+{
+    memset(p, 0, sizeof(*p));
+    size_t words = (object_size + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    if (words == 0) words = 1;
+    // Every object is prefixed with a pointer to its slab
+    p->stride = words + 1;
+    size_t header = (sizeof(Object_Slab) + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    p->objects_per_slab = REGION_DEFAULT_CAPACITY > header ? (REGION_DEFAULT_CAPACITY - header)/p->stride : 0;
+    if (p->objects_per_slab < 8) p->objects_per_slab = 8;
+}
+
+static void object__slab_unlink(Object_Slab **list, Object_Slab *s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else *list = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->prev = NULL;
+    s->next = NULL;
+}
+
+static void object__slab_link(Object_Slab **list, Object_Slab *s)
+{
+    s->prev = NULL;
+    s->next = *list;
+    if (*list) (*list)->prev = s;
+    *list = s;
+}
+
+static Object_Slab *object__slab_new(Object_Pool *p)
+{
+    size_t header = (sizeof(Object_Slab) + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    Region *r = new_region(header + p->objects_per_slab*p->stride);
+    Object_Slab *s = (Object_Slab*)r->data;
+    memset(s, 0, sizeof(*s));
+    s->region = r;
+    s->fresh = p->objects_per_slab;
+    return s;
+}
+
+void *object_pool_alloc(Object_Pool *p)
+{
+    Object_Slab *s = p->partial;
+    if (s == NULL) {
+        if (p->spare != NULL) {
+            s = p->spare;
+            p->spare = NULL;
+        } else {
+            s = object__slab_new(p);
+        }
+        object__slab_link(&p->partial, s);
+    }
+
+    uintptr_t *obj;
+    if (s->free != NULL) {
+        obj = (uintptr_t*)s->free;
+        s->free = *(void**)obj;
+    } else {
+        ARENA_ASSERT(s->fresh > 0);
+        s->fresh -= 1;
+        obj = &s->objects[s->fresh*p->stride + 1];
+        obj[-1] = (uintptr_t)s;
+    }
+
+    s->live += 1;
+    if (s->live == p->objects_per_slab) {
+        object__slab_unlink(&p->partial, s);
+        object__slab_link(&p->full, s);
+    }
+    return obj;
+}
+
+void object_pool_free(Object_Pool *p, void *obj)
+{
+    if (obj == NULL) return;
+    Object_Slab *s = (Object_Slab*)((uintptr_t*)obj)[-1];
+    ARENA_ASSERT(s->live > 0);
+
+    if (s->live == p->objects_per_slab) {
+        object__slab_unlink(&p->full, s);
+        object__slab_link(&p->partial, s);
+    }
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->live -= 1;
+
+    if (s->live == 0) {
+        object__slab_unlink(&p->partial, s);
+        if (p->spare == NULL) {
+            // Forget the free list, the whole slab is fresh again
+            s->free = NULL;
+            s->fresh = p->objects_per_slab;
+            p->spare = s;
+        } else {
+            free_region(s->region);
+        }
+    }
+}
+
+static void object__slab_list_free(Object_Slab *s)
+{
+    while (s) {
+        Object_Slab *next = s->next;
+        free_region(s->region);
+        s = next;
+    }
+}
+
+void object_pool_destroy(Object_Pool *p)
+{
+    object__slab_list_free(p->partial);
+    object__slab_list_free(p->full);
+    object__slab_list_free(p->spare);
+    p->partial = NULL;
+    p->full = NULL;
+    p->spare = NULL;
+}
+
+static void object__pool_lock(Object_Pool *p)
+{
+    while (arena__atomic_exchange_int(&p->lock, 1)) {
+        while (arena__atomic_load_int(&p->lock)) {}
+    }
+}
+
+static void object__pool_unlock(Object_Pool *p)
+{
+    arena__atomic_store_int(&p->lock, 0);
+}
+
+void *object_pool_cache_alloc(Object_Pool_Cache *c)
+{
+    if (c->count == 0) {
+        object__pool_lock(c->pool);
+        while (c->count < OBJECT_POOL_CACHE_CAPACITY/2) {
+            c->items[c->count++] = object_pool_alloc(c->pool);
+        }
+        object__pool_unlock(c->pool);
+    }
+    return c->items[--c->count];
+}
+
+void object_pool_cache_free(Object_Pool_Cache *c, void *obj)
+{
+    if (obj == NULL) return;
+    if (c->count == OBJECT_POOL_CACHE_CAPACITY) {
+        object__pool_lock(c->pool);
+        while (c->count > OBJECT_POOL_CACHE_CAPACITY/2) {
+            object_pool_free(c->pool, c->items[--c->count]);
+        }
+        object__pool_unlock(c->pool);
+    }
+    c->items[c->count++] = obj;
+}
+
+void object_pool_cache_flush(Object_Pool_Cache *c)
+{
+    object__pool_lock(c->pool);
+    while (c->count > 0) {
+        object_pool_free(c->pool, c->items[--c->count]);
+    }
+    object__pool_unlock(c->pool);
 }
 
 #endif // ARENA_IMPLEMENTATION
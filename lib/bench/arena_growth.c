@@ -0,0 +1,98 @@
+// Region sizing benchmark for the ARENA_BACKEND_LINUX_MMAP backend. Allocates
+// a bursty mix of small and large objects, then touches them in random order.
+// Reports how many regions (one mmap each) the arena ended up with and the
+// dTLB misses of the access pass. Build it with different
+// ARENA_REGION_MAX_CAPACITY values, or with and without ARENA_HUGE_PAGES, to
+// compare (see `make bench`).
+//
+// Usage: ./build/arena_growth [allocations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define ARENA_BACKEND ARENA_BACKEND_LINUX_MMAP
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    Arena a = {0};
+    char **ptrs = malloc(sizeof(*ptrs)*n);
+    assert(ptrs != NULL);
+
+    srand(69);
+    double begin = now_secs();
+    for (size_t i = 0; i < n; ++i) {
+        // Mostly small objects with an occasional burst of big ones
+        size_t size = (i % 1000) < 10 ? 4096 + rand()%65536 : 8 + rand()%120;
+        ptrs[i] = (char*)arena_alloc(&a, size);
+        ptrs[i][0] = (char)i;
+    }
+    double alloc_secs = now_secs() - begin;
+
+    size_t regions = 0, words = 0;
+    for (Region *r = a.begin; r != NULL; r = r->next) {
+        regions += 1;
+        words += r->capacity;
+    }
+
+    for (size_t i = n - 1; i > 0; --i) {
+        size_t j = rand()%(i + 1);
+        char *t = ptrs[i]; ptrs[i] = ptrs[j]; ptrs[j] = t;
+    }
+
+    int fd = open_dtlb_counter();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    begin = now_secs();
+    unsigned sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += (unsigned char)ptrs[i][0];
+    double access_secs = now_secs() - begin;
+    long long misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(fd);
+    }
+
+    printf("max region capacity: %zu words\n", (size_t)ARENA_REGION_MAX_CAPACITY);
+    printf("regions (mmap calls): %zu, %.1f MB reserved\n", regions, words*sizeof(uintptr_t)/1e6);
+    printf("alloc:  %.2f ns/alloc\n", alloc_secs*1e9/n);
+    printf("access: %.2f ns/access (checksum %u)\n", access_secs*1e9/n, sum);
+    if (misses >= 0) printf("dTLB load misses: %lld\n", misses);
+    else printf("dTLB load misses: n/a (perf_event_open unavailable)\n");
+
+    arena_free(&a);
+    free(ptrs);
+    return 0;
+}
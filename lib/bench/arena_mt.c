@@ -0,0 +1,121 @@
+// Multi-threaded allocation benchmark: malloc vs a shared arena behind a
+// mutex vs per-thread arenas backed by a shared Region_Pool.
+//
+// Usage: ./build/arena_mt [threads] [rounds]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define ALLOCS_PER_ROUND 10000
+
+typedef enum {
+    MODE_MALLOC,
+    MODE_LOCKED_ARENA,
+    MODE_THREAD_ARENA,
+    COUNT_MODES,
+} Mode;
+
+static const char *mode_names[COUNT_MODES] = {
+    [MODE_MALLOC]       = "malloc/free",
+    [MODE_LOCKED_ARENA] = "arena_alloc + mutex",
+    [MODE_THREAD_ARENA] = "arena_thread",
+};
+
+static Mode mode;
+static size_t rounds = 100;
+static pthread_barrier_t barrier;
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Arena shared_arena = {0};
+static Region_Pool pool = {0};
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    void **ptrs = malloc(sizeof(*ptrs)*ALLOCS_PER_ROUND);
+    assert(ptrs != NULL);
+
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < ALLOCS_PER_ROUND; ++i) {
+            size_t size = 16 + rand_r(&seed)%241;
+            switch (mode) {
+            case MODE_MALLOC:
+                ptrs[i] = malloc(size);
+                break;
+            case MODE_LOCKED_ARENA:
+                pthread_mutex_lock(&shared_mutex);
+                ptrs[i] = arena_alloc(&shared_arena, size);
+                pthread_mutex_unlock(&shared_mutex);
+                break;
+            case MODE_THREAD_ARENA:
+                ptrs[i] = arena_alloc(arena_thread(&pool), size);
+                break;
+            default: abort();
+            }
+            *(char*)ptrs[i] = (char)i;
+        }
+
+        switch (mode) {
+        case MODE_MALLOC:
+            for (size_t i = 0; i < ALLOCS_PER_ROUND; ++i) free(ptrs[i]);
+            break;
+        case MODE_LOCKED_ARENA:
+            // The shared arena can only be reset once nobody is using it
+            if (pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+                arena_reset(&shared_arena);
+            }
+            pthread_barrier_wait(&barrier);
+            break;
+        case MODE_THREAD_ARENA:
+            arena_reset(arena_thread(&pool));
+            break;
+        default: abort();
+        }
+    }
+
+    if (mode == MODE_THREAD_ARENA) arena_free(arena_thread(&pool));
+    free(ptrs);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+    if (argc > 2) rounds = strtoul(argv[2], NULL, 10);
+    if (threads == 0) threads = 1;
+
+    pthread_t *ids = malloc(sizeof(*ids)*threads);
+    assert(ids != NULL);
+
+    printf("%zu threads, %zu rounds of %d allocations each\n", threads, rounds, ALLOCS_PER_ROUND);
+    for (mode = 0; mode < COUNT_MODES; ++mode) {
+        pthread_barrier_init(&barrier, NULL, threads);
+        double begin = now_secs();
+        for (size_t i = 0; i < threads; ++i) {
+            pthread_create(&ids[i], NULL, worker, (void*)(uintptr_t)(i + 1));
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            pthread_join(ids[i], NULL);
+        }
+        double elapsed = now_secs() - begin;
+        pthread_barrier_destroy(&barrier);
+
+        double allocs = (double)threads*rounds*ALLOCS_PER_ROUND;
+        printf("%-20s %8.3f s %8.2f ns/alloc\n", mode_names[mode], elapsed, elapsed*1e9/allocs);
+    }
+
+    arena_free(&shared_arena);
+    region_pool_free(&pool);
+    free(ids);
+    return 0;
+}
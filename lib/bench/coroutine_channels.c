@@ -0,0 +1,188 @@
+// Throughput of the coroutine channels.
+//
+// ping-pong: two coroutines bounce a message over a pair of channels, with
+// `idle` more coroutines that are blocked the whole time. They are either parked
+// on a channel nobody sends to, or busy-yielding on a flag the way it had to be
+// done before channels. The ponger yields once per round, as if it did some
+// I/O, so every runnable coroutine gets a turn.
+//
+// fan-in: 100 producers send into one channel with one consumer on the other
+// end, in the single-threaded scheduler and in the M:N runtime.
+//
+// Usage: ./build/coroutine_channels [messages] [idle] [threads]
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "coroutine.h"
+
+#define FAN_IN_PRODUCERS 100
+
+static size_t messages = 1000000;
+static size_t idle = 1000;
+static size_t threads = 4;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+typedef struct {
+    Coroutine_Channel *ping;
+    Coroutine_Channel *pong;
+} Ping_Pong;
+
+static void pong(void *arg)
+{
+    Ping_Pong *pp = arg;
+    size_t n;
+    while (coroutine_channel_recv(pp->ping, &n)) {
+        coroutine_yield();
+        coroutine_channel_send(pp->pong, &n);
+    }
+}
+
+static Coroutine_Channel *never = NULL;
+static volatile int stop = 0;
+
+static void idle_parked(void *arg)
+{
+    (void) arg;
+    size_t n;
+    while (coroutine_channel_recv(never, &n)) {}
+}
+
+static void idle_spinning(void *arg)
+{
+    (void) arg;
+    while (!stop) coroutine_yield();
+}
+
+static void ping_pong(const char *label, void (*idler)(void*))
+{
+    Ping_Pong pp = {
+        .ping = coroutine_channel_new(sizeof(size_t), 1),
+        .pong = coroutine_channel_new(sizeof(size_t), 1),
+    };
+    never = coroutine_channel_new(sizeof(size_t), 1);
+    stop = 0;
+    for (size_t i = 0; i < idle; ++i) coroutine_go(idler, NULL);
+    coroutine_go(pong, &pp);
+
+    size_t rounds = messages/10;
+    double begin = now_secs();
+    for (size_t i = 0; i < rounds; ++i) {
+        size_t n;
+        coroutine_channel_send(pp.ping, &i);
+        coroutine_channel_recv(pp.pong, &n);
+        assert(n == i);
+    }
+    double elapsed = now_secs() - begin;
+
+    coroutine_channel_close(pp.ping);
+    coroutine_channel_close(never);
+    stop = 1;
+    while (coroutine_alive() > 1) coroutine_yield();
+    coroutine_channel_free(pp.ping);
+    coroutine_channel_free(pp.pong);
+    coroutine_channel_free(never);
+
+    printf("ping-pong %-9s %6zu idle %10.1f ns/round trip\n", label, idle, elapsed*1e9/rounds);
+}
+
+typedef struct {
+    Coroutine_Channel *ch;
+    Coroutine_Wait_Group *wg;
+    size_t sum;
+} Fan_In;
+
+static void producer(void *arg)
+{
+    Fan_In *f = arg;
+    for (size_t i = 0; i < messages/FAN_IN_PRODUCERS; ++i) coroutine_channel_send(f->ch, &i);
+    coroutine_wait_group_done(f->wg);
+}
+
+static void consumer(void *arg)
+{
+    Fan_In *f = arg;
+    size_t n;
+    while (coroutine_channel_recv(f->ch, &n)) f->sum += n;
+    coroutine_wait_group_done(f->wg);
+}
+
+static void fan_in(void *arg)
+{
+    size_t capacity = *(size_t*)arg;
+    Fan_In f = {
+        .ch = coroutine_channel_new(sizeof(size_t), capacity),
+        .wg = coroutine_wait_group_new(),
+    };
+    Coroutine_Wait_Group *consumers = coroutine_wait_group_new();
+    coroutine_wait_group_add(f.wg, FAN_IN_PRODUCERS);
+    coroutine_wait_group_add(consumers, 1);
+    Fan_In c = f;
+    c.wg = consumers;
+    coroutine_go(consumer, &c);
+    for (size_t i = 0; i < FAN_IN_PRODUCERS; ++i) coroutine_go(producer, &f);
+
+    coroutine_wait_group_wait(f.wg);
+    coroutine_channel_close(f.ch);
+    coroutine_wait_group_wait(consumers);
+
+    size_t per = messages/FAN_IN_PRODUCERS;
+    assert(c.sum == FAN_IN_PRODUCERS*(per*(per - 1)/2));
+    coroutine_channel_free(f.ch);
+    coroutine_wait_group_free(f.wg);
+    coroutine_wait_group_free(consumers);
+}
+
+static void report_fan_in(const char *mode, size_t capacity, double elapsed)
+{
+    char cap[32];
+    if (capacity == COROUTINE_CHANNEL_UNBOUNDED) snprintf(cap, sizeof(cap), "unbounded");
+    else snprintf(cap, sizeof(cap), "%zu", capacity);
+    size_t sent = messages/FAN_IN_PRODUCERS*FAN_IN_PRODUCERS;
+    printf("fan-in    %-9s capacity %-9s %10.1f M messages/s\n", mode, cap, sent/elapsed/1e6);
+}
+
+static void *fan_in_mn(void *arg)
+{
+    coroutine_run(threads, fan_in, arg);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) messages = strtoul(argv[1], NULL, 10);
+    if (argc > 2) idle = strtoul(argv[2], NULL, 10);
+    if (argc > 3) threads = strtoul(argv[3], NULL, 10);
+    assert(messages >= FAN_IN_PRODUCERS*10);
+
+    coroutine_init();
+    ping_pong("parked", idle_parked);
+    ping_pong("spinning", idle_spinning);
+
+    size_t capacities[] = {1, 64, COROUTINE_CHANNEL_UNBOUNDED};
+    for (size_t i = 0; i < sizeof(capacities)/sizeof(capacities[0]); ++i) {
+        double begin = now_secs();
+        fan_in(&capacities[i]);
+        report_fan_in("1 thread", capacities[i], now_secs() - begin);
+    }
+
+    // coroutine_run() wants a thread of its own
+    char mode[32];
+    snprintf(mode, sizeof(mode), "%zu threads", threads);
+    for (size_t i = 0; i < sizeof(capacities)/sizeof(capacities[0]); ++i) {
+        pthread_t thread;
+        double begin = now_secs();
+        if (pthread_create(&thread, NULL, fan_in_mn, &capacities[i]) != 0) return 1;
+        pthread_join(thread, NULL);
+        report_fan_in(mode, capacities[i], now_secs() - begin);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Serving files from coroutines: every client coroutine opens a file, reads it
+// in chunks and writes them into a socket that a sink coroutine drains. A
+// ticker coroutine wants to wake up every millisecond and records how late it
+// gets, which is how long the scheduler was blocked in a read.
+//
+// Build it as build/coroutine_files (io_uring), build/coroutine_files_ready
+// (-DCOROUTINE_NO_IO_URING) and build/coroutine_files_poll
+// (-DCOROUTINE_USE_POLL) to compare. The files are evicted from the page cache
+// before every pass, so reads go to the disk where posix_fadvise() allows that.
+//
+// Usage: ./build/coroutine_files [dir] [files] [file_size] [clients]
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "coroutine.h"
+
+#define CHUNK (64*1024)
+
+static const char *dir = "build/coroutine_files.d";
+static size_t files = 64;
+static size_t file_size = 4*1024*1024;
+static size_t clients = 16;
+
+static size_t next_file = 0;
+static size_t served = 0;
+static int stop = 0;
+static double worst_lag = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void file_path(char *buf, size_t size, size_t i)
+{
+    snprintf(buf, size, "%s/%zu", dir, i);
+}
+
+static void prepare_files(void)
+{
+    mkdir(dir, 0755);
+    char *data = malloc(CHUNK);
+    assert(data != NULL);
+    memset(data, 'x', CHUNK);
+    for (size_t i = 0; i < files; ++i) {
+        char path[512];
+        file_path(path, sizeof(path), i);
+        struct stat st;
+        if (stat(path, &st) == 0 && (size_t)st.st_size == file_size) continue;
+        int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        assert(fd >= 0);
+        for (size_t written = 0; written < file_size; written += CHUNK) {
+            ssize_t n = write(fd, data, CHUNK);
+            assert(n == CHUNK);
+            (void) n;
+        }
+        fsync(fd);
+        close(fd);
+    }
+    free(data);
+}
+
+static void evict_files(void)
+{
+    for (size_t i = 0; i < files; ++i) {
+        char path[512];
+        file_path(path, sizeof(path), i);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void sink(void *arg)
+{
+    int fd = (int)(long)arg;
+    char *buf = malloc(CHUNK);
+    while (coroutine_read(fd, buf, CHUNK, -1) > 0) {}
+    free(buf);
+    close(fd);
+}
+
+static void client(void *arg)
+{
+    (void) arg;
+    int pair[2];
+    int result = socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, pair);
+    assert(result == 0);
+    (void) result;
+    coroutine_go(sink, (void*)(long)pair[1]);
+
+    char *buf = malloc(CHUNK);
+    while (next_file < files) {
+        char path[512];
+        file_path(path, sizeof(path), next_file++);
+        int fd = coroutine_openat(AT_FDCWD, path, O_RDONLY, 0);
+        assert(fd >= 0);
+        ssize_t n;
+        off_t offset = 0;
+        while ((n = coroutine_read(fd, buf, CHUNK, offset)) > 0) {
+            offset += n;
+            for (ssize_t sent = 0; sent < n;) {
+                ssize_t m = coroutine_write(pair[0], buf + sent, n - sent, -1);
+                assert(m > 0);
+                sent += m;
+            }
+        }
+        close(fd);
+        served += offset;
+    }
+    free(buf);
+    close(pair[0]);
+}
+
+static void ticker(void *arg)
+{
+    (void) arg;
+    while (!stop) {
+        double begin = now_secs();
+        coroutine_sleep_ms(1);
+        double lag = now_secs() - begin - 1e-3;
+        if (lag > worst_lag) worst_lag = lag;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) dir = argv[1];
+    if (argc > 2) files = strtoul(argv[2], NULL, 10);
+    if (argc > 3) file_size = strtoul(argv[3], NULL, 10);
+    if (argc > 4) clients = strtoul(argv[4], NULL, 10);
+
+    prepare_files();
+    evict_files();
+
+    coroutine_init();
+    coroutine_go(ticker, NULL);
+    double begin = now_secs();
+    for (size_t i = 0; i < clients; ++i) coroutine_go(client, NULL);
+    // The ticker is asleep most of the time and does not count as alive
+    while (coroutine_alive() > 1 || served < files*file_size) coroutine_yield();
+    double elapsed = now_secs() - begin;
+    stop = 1;
+    coroutine_sleep_ms(2);
+
+#if defined(COROUTINE_USE_POLL)
+    const char *mode = "poll";
+#elif defined(COROUTINE_NO_IO_URING)
+    const char *mode = "readiness";
+#else
+    const char *mode = "io_uring";
+#endif
+    printf("%-9s %zu files of %zu KB, %zu clients: %8.1f MB/s, worst ticker lag %.2f ms\n",
+           mode, files, file_size/1024, clients, served/elapsed/1e6, worst_lag*1e3);
+    return 0;
+}
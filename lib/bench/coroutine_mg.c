@@ -0,0 +1,219 @@
+// HTTP load test of a mongoose server with plain callbacks vs one with
+// coroutine_mg.h coroutines. Every tenth request goes to /slow, which waits for
+// `slow_ms` milliseconds before replying, like a handler that talks to a
+// database would. The callback server has to block the event loop for that,
+// the coroutine one only blocks the coroutine of that connection. The rest go
+// to /fast, whose latencies make up the p99.
+//
+// The server runs in a forked process, the client keeps `conns` keep-alive
+// connections busy with one request in flight each for `secs` seconds.
+//
+// Usage: ./build/coroutine_mg [conns] [secs] [slow_ms]
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "coroutine.h"
+#include "coroutine_mg.h"
+#include "mongoose.h"
+
+#define PORT 8765
+#define URL "http://127.0.0.1:8765"
+#define SLOW_EVERY 10
+
+static size_t conns = 64;
+static double secs = 3;
+static size_t slow_ms = 10;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void callback_fn(struct mg_connection *c, int ev, void *ev_data)
+{
+    if (ev != MG_EV_HTTP_MSG) return;
+    struct mg_http_message *hm = ev_data;
+    if (mg_match(hm->uri, mg_str("/slow"), NULL)) usleep(slow_ms*1000);
+    mg_http_reply(c, 200, "", "ok\n");
+}
+
+static void serve(Coroutine_Mg_Conn *conn)
+{
+    struct mg_http_message hm;
+    while (coroutine_mg_http_next(conn, &hm)) {
+        if (mg_match(hm.uri, mg_str("/slow"), NULL)) coroutine_sleep_ms(slow_ms);
+        if (conn->c == NULL) return;
+        mg_http_reply(conn->c, 200, "", "ok\n");
+    }
+}
+
+static void server(int coroutines)
+{
+    mg_log_set(MG_LL_NONE);
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+    if (coroutines) {
+        coroutine_init();
+        if (coroutine_mg_listen(&mgr, URL, serve, NULL) == NULL) exit(1);
+        for (;;) coroutine_mg_poll(&mgr, 100);
+    } else {
+        if (mg_http_listen(&mgr, URL, callback_fn, NULL) == NULL) exit(1);
+        for (;;) mg_mgr_poll(&mgr, 100);
+    }
+}
+
+typedef struct {
+    int fd;
+    int slow;
+    double sent_at;
+    char buf[1024];
+    size_t len;
+} Client;
+
+static double *lat = NULL;
+static size_t lat_count = 0;
+static size_t lat_capacity = 0;
+
+static void client_send(Client *cl, size_t n)
+{
+    static const char fast[] = "GET /fast HTTP/1.1\r\nHost: x\r\n\r\n";
+    static const char slow[] = "GET /slow HTTP/1.1\r\nHost: x\r\n\r\n";
+    cl->slow = n%SLOW_EVERY == 0;
+    const char *req = cl->slow ? slow : fast;
+    size_t len = cl->slow ? sizeof(slow) - 1 : sizeof(fast) - 1;
+    ssize_t n_sent = write(cl->fd, req, len);
+    assert((size_t)n_sent == len);
+    (void) n_sent;
+    cl->sent_at = now_secs();
+    cl->len = 0;
+}
+
+// Returns 1 once the whole response has arrived
+static int client_response_done(Client *cl)
+{
+    cl->buf[cl->len] = '\0';
+    char *end = strstr(cl->buf, "\r\n\r\n");
+    if (end == NULL) return 0;
+    char *cl_header = strstr(cl->buf, "Content-Length:");
+    size_t body = cl_header != NULL && cl_header < end ? strtoul(cl_header + 15, NULL, 10) : 0;
+    return cl->len >= (size_t)(end + 4 - cl->buf) + body;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int connect_to_server(void)
+{
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        assert(fd >= 0);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(10*1000);
+    }
+    fprintf(stderr, "ERROR: could not connect to the server: %s\n", strerror(errno));
+    exit(1);
+}
+
+static void run(const char *name, int coroutines)
+{
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) server(coroutines);
+
+    Client *clients = calloc(conns, sizeof(*clients));
+    struct pollfd *pfds = calloc(conns, sizeof(*pfds));
+    assert(clients != NULL && pfds != NULL);
+    size_t sent = 0, done = 0;
+    lat_count = 0;
+
+    for (size_t i = 0; i < conns; ++i) {
+        clients[i].fd = connect_to_server();
+        pfds[i].fd = clients[i].fd;
+        pfds[i].events = POLLIN;
+        client_send(&clients[i], sent++);
+    }
+
+    double start = now_secs();
+    double stop = start + secs;
+    while (now_secs() < stop) {
+        int n = poll(pfds, conns, 100);
+        assert(n >= 0);
+        for (size_t i = 0; i < conns && n > 0; ++i) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            n -= 1;
+            Client *cl = &clients[i];
+            ssize_t n_read = read(cl->fd, cl->buf + cl->len, sizeof(cl->buf) - 1 - cl->len);
+            if (n_read <= 0) {
+                fprintf(stderr, "ERROR: server closed the connection\n");
+                exit(1);
+            }
+            cl->len += n_read;
+            if (!client_response_done(cl)) continue;
+
+            done += 1;
+            if (!cl->slow) {
+                if (lat_count >= lat_capacity) {
+                    lat_capacity = lat_capacity ? lat_capacity*2 : 1024;
+                    lat = realloc(lat, lat_capacity*sizeof(*lat));
+                    assert(lat != NULL && "Buy more RAM lol");
+                }
+                lat[lat_count++] = now_secs() - cl->sent_at;
+            }
+            client_send(cl, sent++);
+        }
+    }
+    double elapsed = now_secs() - start;
+
+    for (size_t i = 0; i < conns; ++i) close(clients[i].fd);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    free(clients);
+    free(pfds);
+
+    qsort(lat, lat_count, sizeof(*lat), compare_doubles);
+    double p50 = lat_count ? lat[lat_count/2] : 0;
+    double p99 = lat_count ? lat[lat_count*99/100] : 0;
+    printf("%-10s %10.0f req/s   fast p50 %8.3f ms   fast p99 %8.3f ms\n",
+           name, done/elapsed, p50*1e3, p99*1e3);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) conns = strtoul(argv[1], NULL, 10);
+    if (argc > 2) secs = strtod(argv[2], NULL);
+    if (argc > 3) slow_ms = strtoul(argv[3], NULL, 10);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%zu connections, %.1f s, every %dth request sleeps %zu ms\n",
+           conns, secs, SLOW_EVERY, slow_ms);
+    run("callbacks", 0);
+    run("coroutines", 1);
+    free(lat);
+    return 0;
+}
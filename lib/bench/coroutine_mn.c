@@ -0,0 +1,108 @@
+// Scaling of the M:N runtime over 1..N worker threads on a mixed workload:
+// every coroutine burns some CPU, then pings itself through a socketpair and
+// sleeps until the byte arrives.
+//
+// Usage: ./build/coroutine_mn [max_threads] [tasks] [iterations] [work]
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "coroutine.h"
+
+static size_t tasks = 256;
+static size_t iterations = 200;
+static size_t work = 20000;
+static uint64_t checksum = 0;
+
+typedef struct {
+    int fds[2];
+    uint64_t state;
+} Task;
+
+static Task *task_states = NULL;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void task(void *arg)
+{
+    Task *t = arg;
+    for (size_t i = 0; i < iterations; ++i) {
+        // xorshift64 standing in for the CPU part of a request
+        for (size_t j = 0; j < work; ++j) {
+            t->state ^= t->state << 13;
+            t->state ^= t->state >> 7;
+            t->state ^= t->state << 17;
+        }
+
+        char c = 'x';
+        ssize_t n = write(t->fds[0], &c, 1);
+        assert(n == 1);
+        coroutine_sleep_read(t->fds[1]);
+        n = read(t->fds[1], &c, 1);
+        assert(n == 1);
+        (void) n;
+    }
+    __atomic_add_fetch(&checksum, t->state, __ATOMIC_RELAXED);
+}
+
+static void spawner(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < tasks; ++i) {
+        task_states[i].state = 0x9E3779B97F4A7C15ull + i;
+        coroutine_go_on(i%coroutine_workers(), task, &task_states[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (cpus > 0 ? (size_t)cpus : 1);
+    if (argc > 2) tasks = strtoul(argv[2], NULL, 10);
+    if (argc > 3) iterations = strtoul(argv[3], NULL, 10);
+    if (argc > 4) work = strtoul(argv[4], NULL, 10);
+
+    task_states = calloc(tasks, sizeof(*task_states));
+    assert(task_states != NULL);
+    for (size_t i = 0; i < tasks; ++i) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, task_states[i].fds) < 0) {
+            perror("socketpair");
+            return 1;
+        }
+    }
+
+    printf("%zu tasks x %zu iterations x %zu work\n", tasks, iterations, work);
+    uint64_t expected = 0;
+    double base = 0;
+    for (size_t threads = 1; threads <= max_threads; threads = threads < max_threads && threads*2 > max_threads ? max_threads : threads*2) {
+        checksum = 0;
+        double begin = now_secs();
+        coroutine_run(threads, spawner, NULL);
+        double elapsed = now_secs() - begin;
+
+        if (threads == 1) {
+            expected = checksum;
+            base = elapsed;
+        }
+        assert(checksum == expected && "Every task must run to completion exactly once");
+        printf("%3zu threads: %8.3fs %10.0f iterations/s %6.2fx\n",
+               threads, elapsed, tasks*iterations/elapsed, base/elapsed);
+        if (threads == max_threads) break;
+    }
+
+    for (size_t i = 0; i < tasks; ++i) {
+        close(task_states[i].fds[0]);
+        close(task_states[i].fds[1]);
+    }
+    free(task_states);
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Coroutines on dedicated stacks vs coroutine_go_shared() ones: memory per
+// suspended coroutine and the cost of a switch. Every coroutine keeps a frame of
+// `frame` bytes alive and yields `yields` times.
+//
+// Dedicated guarded stacks are limited by vm.max_map_count (see
+// bench/coroutine_stacks.c), so they are only measured up to the first count.
+//
+// Usage: ./build/coroutine_shared [coroutines] [frame_bytes] [yields]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coroutine.h"
+
+#define DEDICATED_STACK_SIZE (16*1024)
+#define DEDICATED_MAX 20000
+
+static size_t frame = 256;
+static size_t yields = 100;
+static size_t started = 0;
+static size_t checksum = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static size_t rss_kb(void)
+{
+    size_t pages_virt = 0, pages_rss = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%zu %zu", &pages_virt, &pages_rss) != 2) pages_rss = 0;
+        fclose(f);
+    }
+    return pages_rss*getpagesize()/1024;
+}
+
+static void worker(void *arg)
+{
+    (void) arg;
+    volatile char *buf = alloca(frame);
+    memset((char*)buf, 1, frame);
+    started += 1;
+    for (size_t i = 0; i < yields; ++i) {
+        buf[i%frame] += 1;
+        coroutine_yield();
+    }
+    checksum += buf[0];
+}
+
+static void run(const char *label, size_t count, void (*go)(void (*)(void*), void*))
+{
+    size_t before = rss_kb();
+    started = 0;
+    for (size_t i = 0; i < count; ++i) go(worker, NULL);
+    // Let every coroutine get to its first yield, so all of them are suspended
+    // with their frames alive
+    while (started < count) coroutine_yield();
+    size_t peak = rss_kb();
+
+    double begin = now_secs();
+    while (coroutine_alive() > 1) coroutine_yield();
+    double elapsed = now_secs() - begin;
+
+    printf("%-10s %8zu coroutines %8.0f bytes each %8.1f ns/switch\n",
+           label, count, (double)(peak - before)*1024/count,
+           elapsed*1e9/(count*(yields - 1)));
+}
+
+static void go_dedicated(void (*f)(void*), void *arg)
+{
+    coroutine_go_sized(f, arg, DEDICATED_STACK_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    if (argc > 2) frame = strtoul(argv[2], NULL, 10);
+    if (argc > 3) yields = strtoul(argv[3], NULL, 10);
+    assert(frame > 0 && yields > 1);
+
+    coroutine_init();
+    printf("%zu byte frames, %zu yields, dedicated stacks of %d bytes\n", frame, yields, DEDICATED_STACK_SIZE);
+    size_t counts[] = {1000, DEDICATED_MAX, count};
+    for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+        if (counts[i] <= DEDICATED_MAX) run("dedicated", counts[i], go_dedicated);
+        run("shared", counts[i], coroutine_go_shared);
+    }
+    assert(checksum > 0);
+    return 0;
+}
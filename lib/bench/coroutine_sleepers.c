@@ -0,0 +1,110 @@
+// Yield latency with a growing amount of coroutines sleeping on idle sockets.
+// With the epoll backend it should stay flat, with poll() (build/coroutine_sleepers_poll)
+// it grows with the amount of sleepers.
+//
+// Usage: ./build/coroutine_sleepers [yields]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "coroutine.h"
+
+#define MAX_SOCKETS 100000
+
+static int sockets[MAX_SOCKETS];
+static size_t awake = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void sleeper(void *arg)
+{
+    int fd = (int)(long)arg;
+    coroutine_sleep_read(fd);
+    char c;
+    ssize_t n = read(fd, &c, 1);
+    assert(n == 1);
+    (void) n;
+    awake += 1;
+}
+
+static void spinner(void *arg)
+{
+    size_t yields = (size_t)arg;
+    for (size_t i = 0; i < yields; ++i) coroutine_yield();
+}
+
+static size_t max_sockets(void)
+{
+    // Leave some fds for stdio and the poller itself
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return 0;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return 0;
+    size_t n = rl.rlim_cur > 64 ? rl.rlim_cur - 64 : 0;
+    n &= ~(size_t)1;
+    return n < MAX_SOCKETS ? n : MAX_SOCKETS;
+}
+
+static void bench(size_t count, size_t yields)
+{
+    for (size_t i = 0; i < count; i += 2) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        sockets[i] = pair[0];
+        sockets[i + 1] = pair[1];
+    }
+
+    // Both ends of every pair sleep waiting for the other one to say something
+    for (size_t i = 0; i < count; ++i) coroutine_go(sleeper, (void*)(long)sockets[i]);
+    coroutine_go(spinner, (void*)yields);
+    coroutine_yield(); // let everybody fall asleep
+
+    double begin = now_secs();
+    for (size_t i = 0; i < yields; ++i) coroutine_yield();
+    double elapsed = now_secs() - begin;
+
+    printf("%8zu sleepers: %10.1f ns/yield\n", count, elapsed*1e9/(yields*2));
+
+    for (size_t i = 0; i < count; ++i) {
+        ssize_t n = write(sockets[i], "x", 1);
+        assert(n == 1);
+        (void) n;
+    }
+    // coroutine_alive() does not count the sleeping coroutines
+    awake = 0;
+    while (awake < count || coroutine_alive() > 1) coroutine_yield();
+    for (size_t i = 0; i < count; ++i) close(sockets[i]);
+}
+
+int main(int argc, char **argv)
+{
+    size_t yields = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    size_t limit = max_sockets();
+
+    coroutine_init();
+
+    size_t counts[] = {0, 1000, 10000, 50000, 100000};
+    for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+        if (counts[i] > limit) {
+            printf("%8zu sleepers: skipped, RLIMIT_NOFILE allows %zu sockets\n", counts[i], limit);
+            continue;
+        }
+        bench(counts[i], yields);
+    }
+    if (limit < MAX_SOCKETS) bench(limit, yields);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Cost of a single coroutine_yield() from one coroutine to the next, for a
+// couple of coroutines (everything stays in L1) and for many of them.
+//
+// `make bench-aarch64` cross-compiles it for aarch64 and runs it under
+// qemu-user, whose numbers are only good for comparing runs with each other.
+// build/coroutine_switch_stats is the same with -DCOROUTINE_STATS, to see what
+// the instrumentation costs.
+//
+// Usage: ./build/coroutine_switch [switches]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "coroutine.h"
+
+#if defined(__x86_64__)
+#define ARCH "x86_64"
+#elif defined(__aarch64__)
+#define ARCH "aarch64"
+#else
+#define ARCH "unknown"
+#endif
+
+static size_t switches_left = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void spin(void *arg)
+{
+    (void) arg;
+    while (switches_left > 0) {
+        switches_left -= 1;
+        coroutine_yield();
+    }
+}
+
+static void run(size_t coroutines, size_t switches, void (*go)(void (*)(void*), void*), const char *label)
+{
+    for (size_t i = 0; i < coroutines; ++i) go(spin, NULL);
+    // Get all of them started first
+    coroutine_yield();
+
+    switches_left = switches;
+    double begin = now_secs();
+    while (switches_left > 0) {
+        switches_left -= 1;
+        coroutine_yield();
+    }
+    double elapsed = now_secs() - begin;
+    while (coroutine_alive() > 1) coroutine_yield();
+
+    printf("%-8s %-9s %6zu coroutines %8.1f ns/switch\n", ARCH, label, coroutines + 1, elapsed*1e9/switches);
+}
+
+int main(int argc, char **argv)
+{
+    size_t switches = argc > 1 ? strtoul(argv[1], NULL, 10) : 10*1000*1000;
+
+    coroutine_init();
+    size_t counts[] = {1, 10, 1000};
+    for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+        run(counts[i], switches, coroutine_go, "dedicated");
+    }
+    for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+        run(counts[i], switches, coroutine_go_shared, "shared");
+    }
+    return 0;
+}
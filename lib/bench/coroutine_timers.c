@@ -0,0 +1,88 @@
+// Thousands of coroutines sleeping on timers: how late they wake up and how
+// much CPU the scheduler burns while they wait.
+//
+// Usage: ./build/coroutine_timers [rounds]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "coroutine.h"
+
+static size_t rounds = 10;
+static double total_lateness = 0;
+static size_t wakeups = 0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double cpu_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void sleeper(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg;
+    for (size_t i = 0; i < rounds; ++i) {
+        size_t ms = 1 + rand_r(&seed)%20;
+        double begin = now_secs();
+        coroutine_sleep_ms(ms);
+        total_lateness += now_secs() - begin - ms*1e-3;
+        wakeups += 1;
+    }
+}
+
+// Nobody ever writes to the socket, so every wait must end by the timeout
+static void reader(void *arg)
+{
+    int fd = (int)(long)arg;
+    for (size_t i = 0; i < rounds; ++i) {
+        int ready = coroutine_sleep_read_timeout(fd, 5);
+        assert(!ready);
+        (void) ready;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) rounds = strtoul(argv[1], NULL, 10);
+
+    coroutine_init();
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    size_t counts[] = {1, 1000, 10000, 50000};
+    for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+        total_lateness = 0;
+        wakeups = 0;
+
+        double wall = now_secs();
+        double cpu = cpu_secs();
+        for (size_t j = 0; j < counts[i]; ++j) coroutine_go(sleeper, (void*)j);
+        coroutine_go(reader, (void*)(long)pair[0]);
+        // The main coroutine sleeps too, so the scheduler may block in the kernel
+        while (wakeups < counts[i]*rounds || coroutine_alive() > 1) coroutine_sleep_ms(1);
+        wall = now_secs() - wall;
+        cpu = cpu_secs() - cpu;
+
+        printf("%6zu timers: %8.3f ms average lateness, %6.2fs wall, %6.2fs cpu\n",
+               counts[i], total_lateness/wakeups*1e3, wall, cpu);
+    }
+
+    close(pair[0]);
+    close(pair[1]);
+    return 0;
+}
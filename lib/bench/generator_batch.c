@@ -0,0 +1,102 @@
+// A lexer-style producer: a generator that splits a source buffer into tokens
+// (identifiers, numbers, punctuation) and yields each one, consumed by
+// foreach. Once with a context switch per token (generator_batch() not
+// called) and once per batch of various sizes.
+//
+// Usage: ./build/generator_batch [source_size]
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "generator.h"
+
+static char *source = NULL;
+static size_t source_size = 16*1024*1024;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void generate_source(void)
+{
+    static const char *words[] = {"int", "x", "return", "foo_bar", "42", "3", "(", ")", "{", "}", ";", "+", "=", "while"};
+    source = malloc(source_size + 1);
+    size_t n = 0;
+    srand(69);
+    while (n < source_size) {
+        const char *w = words[rand()%(sizeof(words)/sizeof(words[0]))];
+        while (*w && n < source_size) source[n++] = *w++;
+        if (n < source_size) source[n++] = rand()%8 == 0 ? '\n' : ' ';
+    }
+    source[n] = '\0';
+}
+
+// Yields the start of every token
+static void lex(void *arg)
+{
+    const char *s = arg;
+    while (*s) {
+        if (isspace((unsigned char)*s)) {
+            s += 1;
+        } else if (isalpha((unsigned char)*s) || *s == '_') {
+            generator_yield_batched((void*)s);
+            while (isalnum((unsigned char)*s) || *s == '_') s += 1;
+        } else if (isdigit((unsigned char)*s)) {
+            generator_yield_batched((void*)s);
+            while (isdigit((unsigned char)*s)) s += 1;
+        } else {
+            generator_yield_batched((void*)s);
+            s += 1;
+        }
+    }
+}
+
+static uint64_t run(size_t batch_size, size_t *tokens)
+{
+    static void *items[1024];
+    Generator *g = generator_create(lex);
+    if (batch_size > 0) generator_batch(g, items, batch_size);
+
+    uint64_t hash = 0;
+    *tokens = 0;
+    foreach (token, g, source) {
+        hash = hash*31 + (uint64_t)((char*)token - source);
+        *tokens += 1;
+    }
+    generator_destroy(g);
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) source_size = strtoul(argv[1], NULL, 10);
+    generator_init();
+    generate_source();
+
+    static const size_t batch_sizes[] = {0, 4, 16, 64, 256, 1024};
+    uint64_t expected = 0;
+    for (size_t i = 0; i < sizeof(batch_sizes)/sizeof(batch_sizes[0]); ++i) {
+        size_t tokens;
+        double start = now_secs();
+        uint64_t hash = run(batch_sizes[i], &tokens);
+        double elapsed = now_secs() - start;
+        if (i == 0) expected = hash;
+        if (hash != expected) {
+            fprintf(stderr, "ERROR: batch %zu produced different tokens\n", batch_sizes[i]);
+            return 1;
+        }
+        if (batch_sizes[i] == 0) printf("per item    ");
+        else printf("batch %-5zu ", batch_sizes[i]);
+        printf("%8.1f Mtokens/s  %6.2f ns/token  (%zu tokens)\n",
+               tokens/elapsed*1e-6, elapsed*1e9/tokens, tokens);
+    }
+
+    generator_pool_trim();
+    free(source);
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Throughput of short-lived generators, like a lexer that gets a generator per
+// input file: create one, iterate over its `tokens` items, destroy it. Once
+// through generator_create()/generator_destroy() and once re-arming a single
+// generator with generator_reset().
+//
+// build/generator_pool_nopool is the same with -DGENERATOR_POOL_HOT=0, where
+// every generator_create() maps a fresh stack and generator_destroy() unmaps it.
+//
+// Usage: ./build/generator_pool [files] [tokens]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "generator.h"
+
+static size_t files = 100000;
+static size_t tokens = 100;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void lex(void *arg)
+{
+    size_t n = (size_t)arg;
+    for (size_t i = 0; i < n; ++i) generator_yield((void*)(i + 1));
+}
+
+static void report(const char *name, double elapsed, size_t sum)
+{
+    size_t expected = files*tokens*(tokens + 1)/2;
+    if (sum != expected) {
+        fprintf(stderr, "ERROR: %s: got %zu, expected %zu\n", name, sum, expected);
+        exit(1);
+    }
+    printf("%-16s %10.0f files/s  %8.1f ns/token\n",
+           name, files/elapsed, elapsed*1e9/(files*tokens));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) files = strtoul(argv[1], NULL, 10);
+    if (argc > 2) tokens = strtoul(argv[2], NULL, 10);
+    generator_init();
+
+    size_t sum = 0;
+    double start = now_secs();
+    for (size_t i = 0; i < files; ++i) {
+        Generator *g = generator_create(lex);
+        foreach (token, g, (void*)tokens) sum += (size_t)token;
+        generator_destroy(g);
+    }
+    report("create/destroy", now_secs() - start, sum);
+
+    sum = 0;
+    start = now_secs();
+    Generator *g = generator_create(lex);
+    for (size_t i = 0; i < files; ++i) {
+        foreach (token, g, (void*)tokens) sum += (size_t)token;
+        generator_reset(g, NULL);
+    }
+    generator_destroy(g);
+    report("reset", now_secs() - start, sum);
+
+    generator_pool_trim();
+    return 0;
+}
@@ -0,0 +1,128 @@
+// 64-byte object churn: keep a working set of live objects and keep replacing
+// random ones. Compares malloc/free with Object_Pool and with per-thread
+// Object_Pool_Caches.
+//
+// Usage: ./build/object_pool [threads] [operations per thread]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define WORKING_SET 100000
+
+typedef struct {
+    char bytes[64];
+} Object;
+
+typedef enum {
+    MODE_MALLOC,
+    MODE_POOL,
+    MODE_POOL_CACHE,
+    COUNT_MODES,
+} Mode;
+
+static const char *mode_names[COUNT_MODES] = {
+    [MODE_MALLOC]     = "malloc/free",
+    [MODE_POOL]       = "object_pool",
+    [MODE_POOL_CACHE] = "object_pool_cache",
+};
+
+static Mode mode;
+static size_t operations = 10*1000*1000;
+static Object_Pool pool;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t threads = 1;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static Object *object_alloc(Object_Pool_Cache *cache)
+{
+    Object *obj = NULL;
+    switch (mode) {
+    case MODE_MALLOC: obj = malloc(sizeof(Object)); break;
+    case MODE_POOL:
+        // The bare pool is not thread-safe, serialize it when it's shared
+        if (threads > 1) pthread_mutex_lock(&pool_mutex);
+        obj = object_pool_new(&pool, Object);
+        if (threads > 1) pthread_mutex_unlock(&pool_mutex);
+        break;
+    case MODE_POOL_CACHE: obj = object_pool_cache_alloc(cache); break;
+    default: abort();
+    }
+    obj->bytes[0] = 1;
+    return obj;
+}
+
+static void object_free(Object_Pool_Cache *cache, Object *obj)
+{
+    switch (mode) {
+    case MODE_MALLOC: free(obj); break;
+    case MODE_POOL:
+        if (threads > 1) pthread_mutex_lock(&pool_mutex);
+        object_pool_free(&pool, obj);
+        if (threads > 1) pthread_mutex_unlock(&pool_mutex);
+        break;
+    case MODE_POOL_CACHE: object_pool_cache_free(cache, obj); break;
+    default: abort();
+    }
+}
+
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    Object_Pool_Cache cache = {0};
+    cache.pool = &pool;
+    Object **live = malloc(sizeof(*live)*WORKING_SET);
+    assert(live != NULL);
+
+    for (size_t i = 0; i < WORKING_SET; ++i) live[i] = object_alloc(&cache);
+    for (size_t i = 0; i < operations; ++i) {
+        size_t j = rand_r(&seed)%WORKING_SET;
+        object_free(&cache, live[j]);
+        live[j] = object_alloc(&cache);
+    }
+    for (size_t i = 0; i < WORKING_SET; ++i) object_free(&cache, live[i]);
+
+    if (mode == MODE_POOL_CACHE) object_pool_cache_flush(&cache);
+    free(live);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) threads = strtoul(argv[1], NULL, 10);
+    if (argc > 2) operations = strtoul(argv[2], NULL, 10);
+    if (threads == 0) threads = 1;
+
+    pthread_t *ids = malloc(sizeof(*ids)*threads);
+    assert(ids != NULL);
+
+    printf("%zu threads, %zu replacements each, %d live %zu-byte objects per thread\n",
+           threads, operations, WORKING_SET, sizeof(Object));
+    for (mode = 0; mode < COUNT_MODES; ++mode) {
+        object_pool_init_for(&pool, Object);
+        double begin = now_secs();
+        for (size_t i = 0; i < threads; ++i) {
+            pthread_create(&ids[i], NULL, worker, (void*)(uintptr_t)(i + 1));
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            pthread_join(ids[i], NULL);
+        }
+        double elapsed = now_secs() - begin;
+        object_pool_destroy(&pool);
+
+        double ops = (double)threads*(operations + WORKING_SET);
+        printf("%-20s %8.3f s %8.2f ns/(alloc+free)\n", mode_names[mode], elapsed, elapsed*1e9/ops);
+    }
+
+    free(ids);
+    return 0;
+}
@@ -0,0 +1,156 @@
+// bench/wb_present.c - Headless benchmark of the front/back buffer diff of
+// wb_present() on a 400x120 grid with 1%, 10% and 100% of the cells changed
+// per frame. Reports per frame:
+//   cells  - the old cell by cell compare, one console write per changed cell
+//   spans  - wb_diff_row() and wb_next_span(), one write per span
+//   present - the whole POSIX wb_present() into a file: time and bytes
+//
+// Build with the SIMD path of the machine and compare against the others:
+//   cc -O2 -o wb_present bench/wb_present.c
+//   cc -O2 -mavx2 -o wb_present_avx2 bench/wb_present.c
+//   cc -O2 -DWB_NO_SIMD -o wb_present_scalar bench/wb_present.c
+//
+// Usage: ./wb_present [frames]
+#define WB_IMPL
+#include "../lib/winbox.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WIDTH 400
+#define HEIGHT 120
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Same cells for the same frame in every pass
+static void mutate(int percent, int frame) {
+    rng_state = 0x9E3779B9u * (frame + 1);
+    int count = WIDTH * HEIGHT * percent / 100;
+    for (int i = 0; i < count; i++) {
+        int cell = percent == 100 ? i : (int)(rng() % (WIDTH * HEIGHT));
+        global.back[cell].ch = 'a' + (global.back[cell].ch - 'a' + 1 + frame) % 26;
+        global.back[cell].fg = (uintattr_t)(1 + frame % 7);
+    }
+}
+
+static long diff_cells(void) {
+    long writes = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        if (global.back[i].ch != global.front[i].ch ||
+            global.back[i].fg != global.front[i].fg ||
+            global.back[i].bg != global.front[i].bg) {
+            global.front[i] = global.back[i];
+            writes++;
+        }
+    }
+    return writes;
+}
+
+static long diff_spans(void) {
+    long writes = 0;
+    int start, end;
+    for (int y = 0; y < HEIGHT; y++) {
+        struct wb_cell *back = global.back + y * WIDTH;
+        struct wb_cell *front = global.front + y * WIDTH;
+        int x = 0;
+        wb_diff_row(back, front, WIDTH, global.row_mask);
+        while (wb_next_span(global.row_mask, WIDTH, x, &start, &end)) {
+            memcpy(front + start, back + start, sizeof(struct wb_cell) * (end - start));
+            writes++;
+            x = end;
+        }
+    }
+    return writes;
+}
+
+static void reset(void) {
+    wb_clear();
+    memcpy(global.front, global.back, sizeof(struct wb_cell) * WIDTH * HEIGHT);
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 1000;
+    static const int percents[] = {1, 10, 100};
+
+    char path[] = "/tmp/wb_present_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+
+    setenv("COLUMNS", "400", 1);
+    setenv("LINES", "120", 1);
+    if (wb_init_rwfd(STDIN_FILENO, fd) != WB_OK || wb_width() != WIDTH || wb_height() != HEIGHT) {
+        fprintf(stderr, "wb_init_rwfd() failed\n");
+        return 1;
+    }
+
+#if defined(WB_SIMD_AVX2)
+    const char *simd = "avx2";
+#elif defined(WB_SIMD_SSE2)
+    const char *simd = "sse2";
+#elif defined(WB_SIMD_NEON)
+    const char *simd = "neon";
+#else
+    const char *simd = "scalar";
+#endif
+    printf("%dx%d, %d frames, %s\n", WIDTH, HEIGHT, frames, simd);
+
+    for (size_t p = 0; p < sizeof(percents) / sizeof(percents[0]); p++) {
+        int percent = percents[p];
+        double begin, cells_secs = 0, spans_secs = 0, present_secs = 0;
+        long cells_writes = 0, spans_writes = 0;
+
+        reset();
+        for (int frame = 0; frame < frames; frame++) {
+            mutate(percent, frame);
+            begin = now_secs();
+            cells_writes += diff_cells();
+            cells_secs += now_secs() - begin;
+        }
+
+        reset();
+        for (int frame = 0; frame < frames; frame++) {
+            mutate(percent, frame);
+            begin = now_secs();
+            spans_writes += diff_spans();
+            spans_secs += now_secs() - begin;
+        }
+
+        reset();
+        off_t bytes_before = lseek(fd, 0, SEEK_CUR);
+        for (int frame = 0; frame < frames; frame++) {
+            mutate(percent, frame);
+            begin = now_secs();
+            wb_present();
+            present_secs += now_secs() - begin;
+        }
+        off_t bytes = lseek(fd, 0, SEEK_CUR) - bytes_before;
+
+        printf("%3d%%: cells %7.2f us %6ld writes | spans %7.2f us %6ld writes | present %7.2f us %8.0f B\n",
+               percent,
+               cells_secs * 1e6 / frames, cells_writes / frames,
+               spans_secs * 1e6 / frames, spans_writes / frames,
+               present_secs * 1e6 / frames, (double)bytes / frames);
+    }
+
+    wb_shutdown();
+    close(fd);
+    return 0;
+}
@@ -8,7 +8,9 @@
 #define _DEFAULT_SOURCE
 #endif
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <stdint.h>
 #include <stdio.h>  // For vsnprintf
 #include <string.h> //For strlen
@@ -109,6 +111,12 @@ int wb_poll_event(struct wb_event *event);
 int wb_set_output_mode(int mode);
 int wb_printf(int x, int y, uintattr_t fg, uintattr_t bg, const char *fmt, ...);
 const char *wb_version(void);
+#ifndef _WIN32
+// Same as wb_init(), but with the terminal on other fds. The size comes from
+// the terminal, or from $COLUMNS and $LINES if wfd is not one (80x24 if those
+// are not set either), so wfd may just as well be a file or a pipe.
+int wb_init_rwfd(int rfd, int wfd);
+#endif
 
 #ifdef __cplusplus
 }
@@ -122,14 +130,64 @@ const char *wb_version(void);
 #define WB_PRINTF_BUF 4096
 #endif
 
+// Unchanged cells between two changed ones that wb_present() rewrites rather
+// than starting a new span (a console API call or a cursor move) after them.
+// At most 63, gaps are merged a mask word at a time.
+#ifndef WB_SPAN_GAP
+#define WB_SPAN_GAP 4
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#ifndef WB_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WB_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WB_SIMD_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define WB_SIMD_NEON
+#endif
+#endif // WB_NO_SIMD
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
 struct wb_global {
+#ifdef _WIN32
     HANDLE hconin;
     HANDLE hconout;
+    CONSOLE_SCREEN_BUFFER_INFO orig_csbi;
+    WCHAR *span_chars;  // one span of wb_present(), a row long
+    WORD *span_attrs;
+#else
+    int rfd;
+    int wfd;
+    int tty;            // wfd is a terminal that got set up by wb_init()
+    int raw;            // rfd is in raw mode, orig_termios restores it
+    struct termios orig_termios;
+    char *out;          // ANSI output of the frame, sent with one write()
+    size_t out_len;
+    size_t out_cap;
+    int cursor_dirty;   // wb_set_cursor() got called since the last wb_present()
+#endif
     int width;
     int height;
     struct wb_cell *back;
     struct wb_cell *front;
-    CONSOLE_SCREEN_BUFFER_INFO orig_csbi;
+    uint64_t *row_mask; // changed cells of the row wb_present() is at
     uintattr_t fg;
     uintattr_t bg;
     int cursor_x;
@@ -141,13 +199,150 @@ struct wb_global {
 static struct wb_global global = {0};
 
 static int wb_resize_buffers(void);
+static int wb_alloc_buffers(void);
+#ifdef _WIN32
 static WORD wb_attr_to_win(uintattr_t fg, uintattr_t bg);
 static int wb_utf8_to_utf16(const char *str, WCHAR *out, int max_out);
 static int wb_utf16_to_utf8(const WCHAR* str, char* out, int max_out);
+#endif
 static int wb_utf8_char_length(char c);
 static int wb_utf8_char_to_unicode(uint32_t *out, const char *c);
 static int wb_utf32_to_utf8(uint32_t c, char *out);
 
+// --- Front/back buffer diffing ---
+//
+// wb_present() first turns a row into a bitmask of the cells that changed,
+// fills the short gaps between them and then walks the runs of set bits, so a
+// mostly static screen costs a compare per cell and not a branch per cell. A
+// wb_cell is 8 bytes without padding, so two cells are equal exactly when
+// their bytes are, and 2 (SSE2, NEON) or 4 (AVX2) of them are compared at
+// once. The scan is memory bound at terminal sizes (bench/wb_present: on par
+// with cell by cell, a bit ahead at 10% changed), the point is one write per
+// span of changed cells instead of one per cell.
+
+_Static_assert(sizeof(struct wb_cell) == 8, "the SIMD compares of wb_diff_row() need 8 byte cells without padding");
+
+static int wb_cell_eq(const struct wb_cell *a, const struct wb_cell *b) {
+    return memcmp(a, b, sizeof(struct wb_cell)) == 0;
+}
+
+static int wb_ctz64(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// Bit i of the result is set if cell i is the same in both buffers, for
+// WB_SIMD_CELLS cells at once
+#if defined(WB_SIMD_AVX2)
+#define WB_SIMD_CELLS 4
+static int wb_simd_eq_mask(const struct wb_cell *back, const struct wb_cell *front) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)back);
+    __m256i b = _mm256_loadu_si256((const __m256i *)front);
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)));
+}
+#elif defined(WB_SIMD_SSE2)
+#define WB_SIMD_CELLS 2
+static int wb_simd_eq_mask(const struct wb_cell *back, const struct wb_cell *front) {
+    __m128i a = _mm_loadu_si128((const __m128i *)back);
+    __m128i b = _mm_loadu_si128((const __m128i *)front);
+    // No 64-bit compare in SSE2: a cell is equal if both of its halves are
+    __m128i e = _mm_cmpeq_epi32(a, b);
+    e = _mm_and_si128(e, _mm_shuffle_epi32(e, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_movemask_pd(_mm_castsi128_pd(e));
+}
+#elif defined(WB_SIMD_NEON)
+#define WB_SIMD_CELLS 2
+static int wb_simd_eq_mask(const struct wb_cell *back, const struct wb_cell *front) {
+    uint64x2_t a = vreinterpretq_u64_u8(vld1q_u8((const uint8_t *)back));
+    uint64x2_t b = vreinterpretq_u64_u8(vld1q_u8((const uint8_t *)front));
+    uint32x2_t e = vmovn_u64(vceqq_u64(a, b));
+    return (vget_lane_u32(e, 0) & 1) | (vget_lane_u32(e, 1) & 2);
+}
+#endif
+
+// Also sets the bits of the gaps of up to WB_SPAN_GAP unchanged cells between
+// changed ones, so wb_next_span() only has to find runs of set bits. A cell is
+// in such a gap if there is a changed one a cells before it and another one b
+// cells after it, with a + b <= WB_SPAN_GAP + 1. Works a word at a time, the
+// neighbour words bring in what crosses their boundaries.
+static void wb_merge_gaps(uint64_t *mask, int words) {
+    uint64_t prev = 0, cur = mask[0];
+    for (int k = 0; k < words; ++k) {
+        uint64_t next = k + 1 < words ? mask[k + 1] : 0;
+        // Nothing to merge in a word without changes around it or one all changed
+        if ((prev | cur | next) == 0 || cur == ~(uint64_t)0) {
+            prev = cur;
+            cur = next;
+            continue;
+        }
+        uint64_t before = 0, fill = 0;
+        for (int a = 1; a <= WB_SPAN_GAP; ++a) {
+            int b = WB_SPAN_GAP + 1 - a;
+            before |= (cur << a) | (prev >> (64 - a));
+            fill |= before & ((cur >> b) | (next << (64 - b)));
+        }
+        mask[k] = cur | fill;
+        prev = cur;
+        cur = next;
+    }
+}
+
+// Sets bit x of mask, (width + 63) / 64 words, if cell x of the row changed or
+// is in a gap wb_present() sends along with the cells around it
+static void wb_diff_row(const struct wb_cell *back, const struct wb_cell *front, int width, uint64_t *mask) {
+    int base;
+    for (base = 0; base < width; base += 64) {
+        int n = width - base < 64 ? width - base : 64;
+        int i = 0;
+        uint64_t word = 0;
+#ifdef WB_SIMD_CELLS
+        for (; i + WB_SIMD_CELLS <= n; i += WB_SIMD_CELLS) {
+            int eq = wb_simd_eq_mask(back + base + i, front + base + i);
+            word |= (uint64_t)(~eq & ((1 << WB_SIMD_CELLS) - 1)) << i;
+        }
+#endif
+        for (; i < n; ++i) {
+            if (!wb_cell_eq(back + base + i, front + base + i)) word |= (uint64_t)1 << i;
+        }
+        mask[base >> 6] = word;
+    }
+    if (width > 0) wb_merge_gaps(mask, (width + 63) >> 6);
+}
+
+// The next span of changed cells of a row at or after x, gaps merged. Returns
+// 0 if there is none. The start of a run is the lowest set bit of word, its end
+// that of ~word. The bits past width are never set.
+static int wb_next_span(const uint64_t *mask, int width, int x, int *start, int *end) {
+    int words = (width + 63) >> 6;
+    int i = x >> 6;
+    if (i >= words) return 0;
+    uint64_t word = mask[i] & (~(uint64_t)0 << (x & 63));
+    while (word == 0) {
+        if (++i >= words) return 0;
+        word = mask[i];
+    }
+    x = (i << 6) + wb_ctz64(word);
+    *start = x;
+    word = ~mask[i] & (~(uint64_t)0 << (x & 63));
+    while (word == 0) {
+        if (++i >= words) {
+            *end = width;
+            return 1;
+        }
+        word = ~mask[i];
+    }
+    x = (i << 6) + wb_ctz64(word);
+    *end = x < width ? x : width;
+    return 1;
+}
+
+#ifdef _WIN32
+
 int wb_init(void) {
     if (global.initialized) return WB_OK;
 
@@ -199,6 +394,122 @@ int wb_shutdown(void) {
 
     if (global.back) free(global.back);
     if (global.front) free(global.front);
+    if (global.row_mask) free(global.row_mask);
+    if (global.span_chars) free(global.span_chars);
+    if (global.span_attrs) free(global.span_attrs);
+
+    memset(&global, 0, sizeof(global));
+    global.cursor_x = -1;
+    global.cursor_y = -1;
+    return WB_OK;
+}
+
+#else // _WIN32
+
+// Makes room for n more bytes of output
+static int wb_out_reserve(size_t n) {
+    if (global.out_len + n > global.out_cap) {
+        size_t cap = global.out_cap ? global.out_cap : 4096;
+        while (cap < global.out_len + n) cap *= 2;
+        char *out = (char *)realloc(global.out, cap);
+        if (!out) return WB_ERR_MEM;
+        global.out = out;
+        global.out_cap = cap;
+    }
+    return WB_OK;
+}
+
+// Drops what does not fit, wb_present() reserves its spans up front instead
+static void wb_out(const char *s, size_t n) {
+    if (wb_out_reserve(n) != WB_OK) return;
+    memcpy(global.out + global.out_len, s, n);
+    global.out_len += n;
+}
+
+static void wb_out_str(const char *s) {
+    wb_out(s, strlen(s));
+}
+
+static void wb_out_num(int n) {
+    char buf[12];
+    int i = sizeof(buf);
+    do {
+        buf[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    wb_out(buf + i, sizeof(buf) - i);
+}
+
+static int wb_flush(void) {
+    size_t done = 0;
+    while (done < global.out_len) {
+        ssize_t n = write(global.wfd, global.out + done, global.out_len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                // Non-blocking wfd: wait until it takes more instead of spinning
+                struct pollfd pfd = {global.wfd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            global.out_len = 0;
+            return WB_ERR;
+        }
+        done += n;
+    }
+    global.out_len = 0;
+    return WB_OK;
+}
+
+int wb_init(void) {
+    return wb_init_rwfd(STDIN_FILENO, STDOUT_FILENO);
+}
+
+int wb_init_rwfd(int rfd, int wfd) {
+    if (global.initialized) return WB_OK;
+
+    global.rfd = rfd;
+    global.wfd = wfd;
+    global.fg = WB_DEFAULT;
+    global.bg = WB_DEFAULT;
+    if (wb_resize_buffers() != WB_OK) return WB_ERR_MEM;
+
+    if (isatty(rfd) && tcgetattr(rfd, &global.orig_termios) == 0) {
+        struct termios raw = global.orig_termios;
+        cfmakeraw(&raw);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(rfd, TCSAFLUSH, &raw);
+        global.raw = 1;
+    }
+    global.tty = isatty(wfd);
+    if (global.tty) {
+        // Alternate screen, cleared to the default colors like the front buffer
+        wb_out_str("\x1b[?1049h\x1b[0m\x1b[2J\x1b[?25l");
+        wb_flush();
+    }
+
+    global.cursor_x = -1;
+    global.cursor_y = -1;
+    global.output_mode = WB_OUTPUT_NORMAL;
+    global.initialized = 1;
+
+    return WB_OK;
+}
+
+int wb_shutdown(void) {
+    if (!global.initialized) return WB_OK;
+
+    if (global.tty) {
+        wb_out_str("\x1b[0m\x1b[?25h\x1b[?1049l");
+        wb_flush();
+    }
+    if (global.raw) tcsetattr(global.rfd, TCSAFLUSH, &global.orig_termios);
+
+    if (global.back) free(global.back);
+    if (global.front) free(global.front);
+    if (global.row_mask) free(global.row_mask);
+    if (global.out) free(global.out);
 
     memset(&global, 0, sizeof(global));
     global.cursor_x = -1;
@@ -206,6 +517,8 @@ int wb_shutdown(void) {
     return WB_OK;
 }
 
+#endif // _WIN32
+
 int wb_width(void) {
     if (!global.initialized) return -1;
     return global.width;
@@ -234,38 +547,31 @@ int wb_set_clear_attrs(uintattr_t fg, uintattr_t bg) {
     return WB_OK;
 }
 
+#ifdef _WIN32
+// Every span of changed cells goes out with one call for the characters and
+// one for the attributes. Console cells hold a single UTF-16 unit, so code
+// points outside of the BMP are shown as U+FFFD.
 int wb_present(void) {
     if (!global.initialized) return WB_ERR_NOT_INIT;
 
-    int x, y;
-    COORD coord = {0, 0};
+    int y, start, end;
     DWORD written;
-    WORD attr;
 
     for (y = 0; y < global.height; ++y) {
-        for (x = 0; x < global.width; ++x) {
-            int i = y * global.width + x;
-
-            if (global.back[i].ch != global.front[i].ch ||
-                global.back[i].fg != global.front[i].fg ||
-                global.back[i].bg != global.front[i].bg) {
-
-                char utf8_char[5]; // To store UTF-8
-                int utf8_len = wb_utf32_to_utf8(global.back[i].ch, utf8_char);
-                utf8_char[utf8_len] = '\0'; // Null-terminate
-
-                WCHAR wide_char[2]; // UTF-16 character
-                // Use the UTF-8 string for conversion:
-                int n_chars = wb_utf8_to_utf16(utf8_char, wide_char, 2);
-
-                coord.X = (SHORT)x;
-                coord.Y = (SHORT)y;
-                attr = wb_attr_to_win(global.back[i].fg, global.back[i].bg);
-                FillConsoleOutputAttribute(global.hconout, attr, n_chars, coord, &written);
-                WriteConsoleOutputCharacterW(global.hconout, wide_char, n_chars, coord, &written);
-
-                global.front[i] = global.back[i];
+        struct wb_cell *back = global.back + y * global.width;
+        struct wb_cell *front = global.front + y * global.width;
+        int x = 0;
+        wb_diff_row(back, front, global.width, global.row_mask);
+        while (wb_next_span(global.row_mask, global.width, x, &start, &end)) {
+            int n = end - start;
+            for (x = start; x < end; ++x) {
+                global.span_chars[x - start] = back[x].ch <= 0xFFFF ? (WCHAR)back[x].ch : (WCHAR)0xFFFD;
+                global.span_attrs[x - start] = wb_attr_to_win(back[x].fg, back[x].bg);
             }
+            COORD coord = {(SHORT)start, (SHORT)y};
+            WriteConsoleOutputCharacterW(global.hconout, global.span_chars, n, coord, &written);
+            WriteConsoleOutputAttribute(global.hconout, global.span_attrs, n, coord, &written);
+            memcpy(front + start, back + start, sizeof(struct wb_cell) * n);
         }
     }
     if (global.cursor_x != -1 && global.cursor_y != -1) {
@@ -276,7 +582,6 @@ int wb_present(void) {
     return WB_OK;
 }
 
-
 int wb_set_cursor(int cx, int cy) {
     if (!global.initialized) return WB_ERR_NOT_INIT;
 
@@ -304,6 +609,123 @@ int wb_set_cursor(int cx, int cy) {
     return WB_OK;
 }
 
+#else // _WIN32
+
+// WB colors are console attribute bits (blue is bit 0), ANSI has red there
+static int wb_ansi_color(uintattr_t c) {
+    return ((c & 1) << 2) | (c & 2) | ((c & 4) >> 2);
+}
+
+// WB_DEFAULT doubles as black, it is mapped to the terminal's default colors
+static void wb_out_sgr(uintattr_t fg, uintattr_t bg) {
+    wb_out_str("\x1b[0");
+    if (fg & WB_BOLD) wb_out_str(";1");
+    if (fg & WB_UNDERLINE) wb_out_str(";4");
+    if (fg & WB_REVERSE) wb_out_str(";7");
+    if (fg & 7) {
+        char sgr[4] = {';', '3', (char)('0' + wb_ansi_color(fg)), 0};
+        wb_out_str(sgr);
+    }
+    if (bg & 7) {
+        char sgr[5] = {';', '4', (char)('0' + wb_ansi_color(bg)), 0, 0};
+        if (bg & WB_BOLD) {
+            sgr[1] = '1';
+            sgr[2] = '0';
+            sgr[3] = (char)('0' + wb_ansi_color(bg));
+        }
+        wb_out_str(sgr);
+    }
+    wb_out("m", 1);
+}
+
+// The longest cursor move and SGR sequence wb_present() sends
+#define WB_MOVE_MAX_BYTES 24
+#define WB_SGR_MAX_BYTES 20
+
+// Every span of changed cells is one cursor move followed by its characters,
+// with an SGR sequence only where the attributes change. The whole frame goes
+// out with a single write(). A span is copied to the front buffer only once
+// its output is buffered. If the buffer cannot grow, what is buffered is sent,
+// the rest stays changed for the next call and WB_ERR_MEM is returned.
+int wb_present(void) {
+    if (!global.initialized) return WB_ERR_NOT_INIT;
+
+    int result = WB_OK;
+    int x, y, start, end;
+    int have_attrs = 0;
+    uintattr_t fg = 0, bg = 0;
+    char utf8[4];
+
+    for (y = 0; y < global.height; ++y) {
+        struct wb_cell *back = global.back + y * global.width;
+        struct wb_cell *front = global.front + y * global.width;
+        x = 0;
+        wb_diff_row(back, front, global.width, global.row_mask);
+        while (wb_next_span(global.row_mask, global.width, x, &start, &end)) {
+            size_t worst = WB_MOVE_MAX_BYTES + (size_t)(end - start) * (WB_SGR_MAX_BYTES + 4);
+            if (wb_out_reserve(worst) != WB_OK) {
+                result = WB_ERR_MEM;
+                goto flush;
+            }
+            wb_out("\x1b[", 2);
+            wb_out_num(y + 1);
+            wb_out(";", 1);
+            wb_out_num(start + 1);
+            wb_out("H", 1);
+            for (x = start; x < end; ++x) {
+                if (!have_attrs || back[x].fg != fg || back[x].bg != bg) {
+                    fg = back[x].fg;
+                    bg = back[x].bg;
+                    wb_out_sgr(fg, bg);
+                    have_attrs = 1;
+                }
+                int n = wb_utf32_to_utf8(back[x].ch >= ' ' ? back[x].ch : ' ', utf8);
+                if (n == 0) n = wb_utf32_to_utf8(0xFFFD, utf8);
+                wb_out(utf8, n);
+            }
+            memcpy(front + start, back + start, sizeof(struct wb_cell) * (end - start));
+        }
+    }
+
+    int visible = global.cursor_x != -1 && global.cursor_y != -1;
+    if (wb_out_reserve(WB_MOVE_MAX_BYTES + 6) != WB_OK) {
+        result = WB_ERR_MEM;
+    } else if (visible && (global.cursor_dirty || global.out_len > 0)) {
+        wb_out("\x1b[", 2);
+        wb_out_num(global.cursor_y + 1);
+        wb_out(";", 1);
+        wb_out_num(global.cursor_x + 1);
+        wb_out_str("H\x1b[?25h");
+        global.cursor_dirty = 0;
+    } else if (!visible && global.cursor_dirty) {
+        wb_out_str("\x1b[?25l");
+        global.cursor_dirty = 0;
+    }
+
+flush:
+    // Cut short, the cursor is left after the last span that went out
+    if (result != WB_OK) global.cursor_dirty = 1;
+    if (wb_flush() != WB_OK) return WB_ERR;
+    return result;
+}
+
+int wb_set_cursor(int cx, int cy) {
+    if (!global.initialized) return WB_ERR_NOT_INIT;
+
+    if (cx < 0 || cx >= global.width || cy < 0 || cy >= global.height) {
+        global.cursor_x = -1;
+        global.cursor_y = -1;
+    } else {
+        global.cursor_x = cx;
+        global.cursor_y = cy;
+    }
+    global.cursor_dirty = 1;
+
+    return WB_OK;
+}
+
+#endif // _WIN32
+
 int wb_hide_cursor(void) {
       return wb_set_cursor(-1, -1);
 }
@@ -320,6 +742,7 @@ int wb_set_cell(int x, int y, uint32_t ch, uintattr_t fg, uintattr_t bg) {
     return WB_OK;
 }
 
+#ifdef _WIN32
 int wb_poll_event(struct wb_event *event) {
     if (!global.initialized) return WB_ERR_NOT_INIT;
     INPUT_RECORD record;
@@ -412,6 +835,95 @@ int wb_poll_event(struct wb_event *event) {
     return WB_OK;
 }
 
+#else // _WIN32
+
+// Only the escape sequences of the keys that have a WB_KEY_* are understood,
+// anything else comes out as the ESC key.
+static uint16_t wb_escape_key(const unsigned char *seq, int len) {
+    if (len >= 2 && (seq[0] == '[' || seq[0] == 'O')) {
+        switch (seq[1]) {
+            case 'A': return WB_KEY_ARROW_UP;
+            case 'B': return WB_KEY_ARROW_DOWN;
+            case 'C': return WB_KEY_ARROW_RIGHT;
+            case 'D': return WB_KEY_ARROW_LEFT;
+            case 'H': return WB_KEY_HOME;
+            case 'F': return WB_KEY_END;
+            case 'P': return WB_KEY_F1;
+            case 'Q': return WB_KEY_F2;
+            case 'R': return WB_KEY_F3;
+            case 'S': return WB_KEY_F4;
+        }
+    }
+    if (len >= 3 && seq[0] == '[' && seq[2] == '~') {
+        switch (seq[1]) {
+            case '1': return WB_KEY_HOME;
+            case '2': return WB_KEY_INSERT;
+            case '3': return WB_KEY_DELETE;
+            case '4': return WB_KEY_END;
+            case '5': return WB_KEY_PGUP;
+            case '6': return WB_KEY_PGDN;
+        }
+    }
+    return WB_KEY_ESC;
+}
+
+int wb_poll_event(struct wb_event *event) {
+    if (!global.initialized) return WB_ERR_NOT_INIT;
+
+    memset(event, 0, sizeof(*event));
+
+    int width = global.width, height = global.height;
+    if (wb_resize_buffers() != WB_OK) return WB_ERR_MEM;
+    if (global.width != width || global.height != height) {
+        // The new front buffer is blank, so must be the screen
+        if (global.tty) {
+            wb_out_str("\x1b[0m\x1b[2J");
+            wb_flush();
+        }
+        event->type = WB_EVENT_RESIZE;
+        event->w = global.width;
+        event->h = global.height;
+        return WB_OK;
+    }
+
+    struct pollfd pfd = {global.rfd, POLLIN, 0};
+    unsigned char buf[8];
+    if (poll(&pfd, 1, 0) <= 0) return WB_ERR_NO_EVENT;
+    if (read(global.rfd, buf, 1) != 1) return WB_ERR_NO_EVENT;
+
+    event->type = WB_EVENT_KEY;
+    if (buf[0] == WB_KEY_ESC) {
+        // The rest of an escape sequence is already there, a lone ESC is not
+        // followed by anything
+        int len = 0;
+        while (len < (int)sizeof(buf) && poll(&pfd, 1, 0) > 0 && read(global.rfd, buf + len, 1) == 1) {
+            len++;
+            if (len >= 2 && ((buf[len - 1] >= 'A' && buf[len - 1] <= 'Z') || buf[len - 1] == '~')) break;
+        }
+        event->key = wb_escape_key(buf, len);
+        return WB_OK;
+    }
+
+    int len = wb_utf8_char_length((char)buf[0]);
+    int got = 1;
+    while (got < len && poll(&pfd, 1, 0) > 0 && read(global.rfd, buf + got, 1) == 1) got++;
+    buf[got] = 0;
+    if (got < len || wb_utf8_char_to_unicode(&event->ch, (const char *)buf) < 0) {
+        event->ch = 0xFFFD;
+    }
+
+    if (event->ch == 127) {
+        event->ch = WB_KEY_BACKSPACE;
+    }
+    if (event->ch <= 31) {
+        event->key = event->ch;
+        event->mod |= WB_MOD_CTRL;
+    }
+
+    return WB_OK;
+}
+#endif // _WIN32
+
 int wb_set_output_mode(int mode)
 {
     if (!global.initialized) return WB_ERR_NOT_INIT;
@@ -461,11 +973,8 @@ const char *wb_version(void) {
     return WB_VERSION_STR;
 }
 
+#ifdef _WIN32
 static int wb_resize_buffers(void) {
-
-    if (global.back) free(global.back);
-    if (global.front) free(global.front);
-
     // Get updated buffer size
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(global.hconout, &csbi)) {
@@ -474,10 +983,50 @@ static int wb_resize_buffers(void) {
     global.width = csbi.dwSize.X;
     global.height = csbi.dwSize.Y;
 
+    if (global.span_chars) free(global.span_chars);
+    if (global.span_attrs) free(global.span_attrs);
+    global.span_chars = (WCHAR *)malloc(sizeof(WCHAR) * global.width);
+    global.span_attrs = (WORD *)malloc(sizeof(WORD) * global.width);
+    if (!global.span_chars || !global.span_attrs) {
+        return WB_ERR_MEM;
+    }
+    return wb_alloc_buffers();
+}
+#else // _WIN32
+// The size of the terminal on wfd, or $COLUMNS x $LINES, or 80x24. The
+// buffers are only reallocated if it changed.
+static int wb_resize_buffers(void) {
+    int width = 80, height = 24;
+    struct winsize ws;
+    if (ioctl(global.wfd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+        width = ws.ws_col;
+        height = ws.ws_row;
+    } else {
+        const char *columns = getenv("COLUMNS");
+        const char *lines = getenv("LINES");
+        if (columns && atoi(columns) > 0) width = atoi(columns);
+        if (lines && atoi(lines) > 0) height = atoi(lines);
+    }
+    if (global.back && width == global.width && height == global.height) {
+        return WB_OK;
+    }
+    global.width = width;
+    global.height = height;
+    return wb_alloc_buffers();
+}
+#endif // _WIN32
+
+// (Re)allocate both buffers for global.width x global.height
+static int wb_alloc_buffers(void) {
+    if (global.back) free(global.back);
+    if (global.front) free(global.front);
+    if (global.row_mask) free(global.row_mask);
+
     global.back = (struct wb_cell *)malloc(sizeof(struct wb_cell) * global.width * global.height);
     global.front = (struct wb_cell *)malloc(sizeof(struct wb_cell) * global.width * global.height);
+    global.row_mask = (uint64_t *)malloc(sizeof(uint64_t) * ((global.width + 63) / 64));
 
-    if (!global.back || !global.front) {
+    if (!global.back || !global.front || !global.row_mask) {
         return WB_ERR_MEM;
     }
 
@@ -494,6 +1043,7 @@ static int wb_resize_buffers(void) {
     return WB_OK;
 }
 
+#ifdef _WIN32
 static WORD wb_attr_to_win(uintattr_t fg, uintattr_t bg) {
     WORD out = 0;
 
@@ -539,6 +1089,7 @@ static int wb_utf8_to_utf16(const char *str, WCHAR *out, int max_out) {
 static int wb_utf16_to_utf8(const WCHAR* str, char* out, int max_out) {
     return WideCharToMultiByte(CP_UTF8, 0, str, -1, out, max_out, NULL, NULL);
 }
+#endif // _WIN32
 
 static int wb_utf8_char_length(char c) {
     // Check the first byte to determine the length
@@ -4,15 +4,82 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 #include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 
+// The epoll backend keeps every fd registered with the kernel and only looks
+// at the ready ones, so a switch does not depend on the amount of sleepers.
+// Define COROUTINE_USE_POLL to fall back to rebuilding a poll() set.
+#if defined(__linux__) && !defined(COROUTINE_USE_POLL)
+#define COROUTINE_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+// coroutine_read() and friends go through io_uring, so regular files do not
+// block the scheduler either. Define COROUTINE_NO_IO_URING to always do them
+// the readiness way. Also falls back to that at runtime if the kernel does
+// not have io_uring or forbids it.
+#if defined(COROUTINE_USE_EPOLL) && !defined(COROUTINE_NO_IO_URING)
+#define COROUTINE_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+// How many operations a thread can queue up between two scheduler ticks
+// before they have to be submitted right away
+#ifndef COROUTINE_IO_URING_ENTRIES
+#define COROUTINE_IO_URING_ENTRIES 256
+#endif
+
 #include "coroutine.h"
 
-// TODO: make the STACK_CAPACITY customizable by the user
-//#define STACK_CAPACITY (4*1024)
-#define STACK_CAPACITY (1024*getpagesize())
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#endif // __SANITIZE_ADDRESS__
+
+// The stack size of coroutine_go(). coroutine_go_sized() picks its own.
+#ifndef COROUTINE_STACK_SIZE
+#define COROUTINE_STACK_SIZE (1024*getpagesize())
+#endif
+
+// Inaccessible pages below every stack, so an overflow crashes right away
+// instead of silently corrupting whatever is mapped next to it. Each guard
+// splits the mapping, so a guarded stack costs two of vm.max_map_count (65530
+// by default). So only the first vm.max_map_count/4 stacks of the process get
+// one, the rest go without and are mapped COROUTINE_STACK_BATCH at a time,
+// which is what lets 100k coroutines run. Set it to 0 to never guard them.
+#ifndef COROUTINE_STACK_GUARD_PAGES
+#define COROUTINE_STACK_GUARD_PAGES 1
+#endif
+
+#ifndef COROUTINE_STACK_BATCH
+#define COROUTINE_STACK_BATCH 64
+#endif
+
+// How many stacks of each size a thread keeps around with their pages intact
+// after their coroutines have died. The rest are kept for reuse too, but their
+// memory is given back to the kernel with MADV_DONTNEED, so RSS follows the
+// amount of live coroutines rather than the peak.
+#ifndef COROUTINE_STACK_POOL_HOT
+#define COROUTINE_STACK_POOL_HOT 16
+#endif
+static_assert(COROUTINE_STACK_POOL_HOT >= 1, "the stack of a finishing coroutine must not be the one released");
+
+// The stack the coroutine_go_shared() ones take turns running on. Only the part
+// of it a suspended coroutine actually uses is kept around on the heap.
+#ifndef COROUTINE_SHARED_STACK_SIZE
+#define COROUTINE_SHARED_STACK_SIZE COROUTINE_STACK_SIZE
+#endif
 
 // Initial capacity of a dynamic array
 #ifndef DA_INIT_CAP
@@ -42,17 +109,42 @@
 #define TODO(message) do { fprintf(stderr, "%s:%d: TODO: %s\n", __FILE__, __LINE__, message); abort(); } while(0)
 #define UNREACHABLE(message) do { fprintf(stderr, "%s:%d: UNREACHABLE: %s\n", __FILE__, __LINE__, message); abort(); } while(0)
 
+typedef enum {
+    SM_NONE = 0,
+    SM_READ,
+    SM_WRITE,
+    SM_TIMER,
+    SM_PARKED, // waiting on a channel, wait group, mutex or cond
+    SM_DEAD,  // not a sleep, the coroutine has returned (M:N mode only)
+} Sleep_Mode;
+
+#define NO_COROUTINE ((size_t)-1)
+#define NO_TIMER ((size_t)-1)
+
 typedef struct {
     void *rsp;
-    void *stack_base;
+    void *stack_base;      // lowest usable address, the guard pages are right below
+    size_t stack_size;
+    int sleep_fd;          // the fd the coroutine sleeps on or -1
+    size_t sleep_index;    // position in asleep and polls (poll backend)
+    Sleep_Mode sleep_mode; // SM_NONE unless the coroutine is asleep
+    size_t timer;          // position in the timers heap or NO_TIMER
+    uint64_t deadline;     // CLOCK_MONOTONIC nanoseconds
+    bool timed_out;
+    size_t worker;         // the worker the coroutine last ran on in M:N mode
+    size_t wait_next;      // the next one in the Wait_Queue the coroutine is parked in
+    int io_result;         // cqe.res of the io_uring operation the coroutine waited for
+    bool shared;           // runs on the shared stack, see coroutine_go_shared()
+    void *saved;           // the used part of the shared stack while somebody else has it
+    size_t saved_size;
+    size_t saved_capacity;
+#ifdef COROUTINE_STATS
+    Coroutine_Context_Stats stats;
+    uint64_t stats_since;  // when it last got switched to, switched out or ready
+    bool stats_asleep;     // switched out to sleep or park, not runnable yet
+#endif // COROUTINE_STATS
 } Context;
 
-typedef struct {
-    Context *items;
-    size_t count;
-    size_t capacity;
-} Contexts;
-
 typedef struct {
     size_t *items;
     size_t count;
@@ -65,23 +157,145 @@ typedef struct {
     size_t capacity;
 } Polls;
 
-// TODO: coroutines library probably does not work well in multithreaded environment
-static size_t current     = 0;
-static Indices active     = {0};
-static Indices dead       = {0};
-static Contexts contexts  = {0};
-static Indices asleep     = {0};
-static Polls polls        = {0};
+typedef struct {
+    void *base;
+    size_t size;
+} Stack;
 
-// TODO: ARM support
-//   Requires modifications in all the @arch places
+typedef struct {
+    Stack *items;
+    size_t count;
+    size_t capacity;
+} Stacks;
 
-typedef enum {
-    SM_NONE = 0,
-    SM_READ,
-    SM_WRITE,
-} Sleep_Mode;
+// Free stacks of one size class
+typedef struct {
+    Stacks hot;   // still backed by memory, reused first
+    Stacks cold;  // released with MADV_DONTNEED, fault in on reuse
+} Stack_Pool;
+
+// Stack sizes are rounded up to page_size << class
+#define STACK_CLASSES 32
+
+// Contexts live in chunks that never move, so in M:N mode a worker can look up
+// any coroutine while another one is creating new ones.
+#define CONTEXTS_PER_CHUNK 1024
+#define CONTEXT_CHUNKS_CAP 4096
+
+static Context *context_chunks[CONTEXT_CHUNKS_CAP] = {0};
+static size_t contexts_count = 0;
+static size_t guarded_stacks = 0;
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static Indices free_contexts = {0}; // dead contexts left behind by finished workers
+
+// Everything else is the state of a scheduler. Each thread has its own: the
+// single-threaded one started by coroutine_init(), or one per worker of the
+// M:N runtime started by coroutine_run().
+static __thread size_t current      = 0;
+static __thread Indices active      = {0};
+static __thread Indices dead        = {0};
+static __thread size_t main_id      = NO_COROUTINE;
+static __thread Stack_Pool stack_pools[STACK_CLASSES] = {0};
+static __thread Stack shared_stack  = {0};
+static __thread size_t shared_owner = NO_COROUTINE; // whose frames are on shared_stack
+static __thread Stack copy_stack    = {0};          // swaps the contents of shared_stack
+static __thread int *parking_lock   = NULL;         // released once the parked coroutine is off its stack
+#ifndef COROUTINE_USE_EPOLL
+static __thread Indices asleep      = {0};
+static __thread Polls polls         = {0};
+#endif // COROUTINE_USE_EPOLL
+
+#ifdef COROUTINE_USE_EPOLL
+// Coroutines sleeping on a particular fd. Indexed by fd.
+typedef struct {
+    size_t reader;
+    size_t writer;
+} Fd_Waiters;
+
+typedef struct {
+    Fd_Waiters *items;
+    size_t count;
+    size_t capacity;
+} Fd_Table;
+
+#define EPOLL_EVENTS_CAP 256
+
+static __thread int epfd = -1;
+static __thread Fd_Table fds = {0};
+static __thread size_t sleepers = 0;
+#endif // COROUTINE_USE_EPOLL
+
+// Min-heap of the ids of the coroutines that have a deadline, ordered by
+// Context.deadline. Each coroutine remembers its position in Context.timer so
+// cancelling a timer is O(log n) as well.
+static __thread Indices timers = {0};
+
+#ifdef COROUTINE_STATS
+static __thread Coroutine_Stats stats = {0};
+// When the last coroutine was switched out, unless the scheduler has polled
+// since. Saves reading the clock again for the one switched to next.
+static __thread uint64_t stats_clock = 0;
+#endif // COROUTINE_STATS
+
+#ifdef COROUTINE_USE_EPOLL
+typedef struct {
+    size_t capacity;    // power of two
+    size_t items[];
+} Run_Buffer;
+
+typedef struct {
+    Run_Buffer **items;
+    size_t count;
+    size_t capacity;
+} Run_Buffers;
+
+// Chase-Lev work-stealing deque of runnable coroutines. Only the owner pushes,
+// at the bottom. Unlike the classic deque the owner also takes from the top,
+// same as the thieves, so a worker runs its coroutines round robin like the
+// single-threaded scheduler does.
+typedef struct {
+    size_t top;
+    size_t bottom;
+    Run_Buffer *buffer;
+    Run_Buffers retired; // outgrown buffers, thieves may still be reading them
+} Run_Queue;
+
+typedef struct {
+    pthread_t thread;
+    Run_Queue queue;
+    void *rsp;          // the scheduler loop, coroutines switch back here
+    size_t current;     // the coroutine being run or NO_COROUTINE
+    Sleep_Mode sm;      // why the current coroutine switched back
+    int fd;
+    int kick_fd;        // eventfd that wakes the worker up from epoll_wait()
+    int idle;           // blocked in epoll_wait() with nothing to run
+    uint32_t seed;
+
+    pthread_mutex_t inbox_lock;
+    int inbox_pending;
+    Indices inbox_ready; // coroutines sent to run on this worker
+    Indices inbox_wake;  // coroutines to wake up on this worker
+} Worker;
+
+static Worker *workers = NULL;
+static size_t workers_count = 0;
+static size_t alive = 0;               // coroutines alive in M:N mode
+static size_t idle_workers = 0;
+static __thread Worker *worker = NULL; // NULL in the single-threaded mode
+static __thread int kick_fd = -1;
+#endif // COROUTINE_USE_EPOLL
+
+// The context switching primitives. The layout of a saved context is only
+// known to them and to coroutine__frame(), everything else just passes the
+// stack pointer around. All the @arch places are here.
+void coroutine_restore_context(void *rsp);
+void coroutine__switch(void **save, void *rsp);
+void coroutine__suspend(Sleep_Mode sm);
+void coroutine__call_on(void *top, void (*f)(size_t), size_t arg);
+void coroutine__finish_current(void);
+void coroutine_switch_context(void *rsp, Sleep_Mode sm, int fd);
 
+#if defined(__x86_64__)
 // Linux x86_64 call convention
 // %rdi, %rsi, %rdx, %rcx, %r8, and %r9
 
@@ -98,7 +312,7 @@ void __attribute__((naked)) coroutine_yield(void)
     "    pushq %r15\n"
     "    movq %rsp, %rdi\n"     // rsp
     "    movq $0, %rsi\n"       // sm = SM_NONE
-    "    jmp coroutine_switch_context\n");
+    "    call coroutine_switch_context\n"); // never returns, call keeps rsp 16-byte aligned
 }
 
 void __attribute__((naked)) coroutine_sleep_read(int fd)
@@ -116,7 +330,7 @@ void __attribute__((naked)) coroutine_sleep_read(int fd)
     "    movq %rdi, %rdx\n"     // fd
     "    movq %rsp, %rdi\n"     // rsp
     "    movq $1, %rsi\n"       // sm = SM_READ
-    "    jmp coroutine_switch_context\n");
+    "    call coroutine_switch_context\n"); // never returns, call keeps rsp 16-byte aligned
 }
 
 void __attribute__((naked)) coroutine_sleep_write(int fd)
@@ -134,7 +348,27 @@ void __attribute__((naked)) coroutine_sleep_write(int fd)
     "    movq %rdi, %rdx\n"     // fd
     "    movq %rsp, %rdi\n"     // rsp
     "    movq $2, %rsi\n"       // sm = SM_WRITE
-    "    jmp coroutine_switch_context\n");
+    "    call coroutine_switch_context\n"); // never returns, call keeps rsp 16-byte aligned
+}
+
+// Leave the run queue without anything to wake up on. Somebody else is
+// supposed to make the coroutine ready again: the timers for SM_TIMER, a
+// synchronization primitive for SM_PARKED.
+void __attribute__((naked)) coroutine__suspend(Sleep_Mode sm)
+{
+    (void) sm;
+    // @arch
+    asm(
+    "    pushq %rdi\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rdi, %rsi\n"     // sm
+    "    movq %rsp, %rdi\n"     // rsp
+    "    call coroutine_switch_context\n"); // never returns, call keeps rsp 16-byte aligned
 }
 
 void __attribute__((naked)) coroutine_restore_context(void *rsp)
@@ -153,137 +387,1952 @@ void __attribute__((naked)) coroutine_restore_context(void *rsp)
     "    ret\n");
 }
 
-void coroutine_switch_context(void *rsp, Sleep_Mode sm, int fd)
+// Save the current context into *save and switch to rsp. Returns once somebody
+// restores *save. That is how the M:N workers enter their coroutines.
+void __attribute__((naked)) coroutine__switch(void **save, void *rsp)
 {
-    contexts.items[active.items[current]].rsp = rsp;
+    // @arch
+    (void)save;
+    (void)rsp;
+    asm(
+    "    pushq %rdi\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"   // *save = rsp
+    "    movq %rsi, %rdi\n"
+    "    jmp coroutine_restore_context\n");
+}
 
-    switch (sm) {
-    case SM_NONE: current += 1; break;
-    case SM_READ: {
-        da_append(&asleep, active.items[current]);
-        struct pollfd pfd = {.fd = fd, .events = POLLRDNORM,};
-        da_append(&polls, pfd);
-        da_remove_unordered(&active, current);
-    } break;
+// Switch to the stack that ends at top and call f(arg) there. f must never
+// return, there is nothing to return to.
+void __attribute__((naked)) coroutine__call_on(void *top, void (*f)(size_t), size_t arg)
+{
+    // @arch
+    (void)top;
+    (void)f;
+    (void)arg;
+    asm(
+    "    movq %rdi, %rsp\n"
+    "    movq %rdx, %rdi\n"
+    "    call *%rsi\n");       // top is 16-byte aligned, so is rsp in f
+}
 
-    case SM_WRITE: {
-        da_append(&asleep, active.items[current]);
-        struct pollfd pfd = {.fd = fd, .events = POLLWRNORM,};
-        da_append(&polls, pfd);
-        da_remove_unordered(&active, current);
-    } break;
+#define COROUTINE_FRAME_SIZE (9*sizeof(void*))
 
-    default: UNREACHABLE("coroutine_switch_context");
-    }
+// The frame coroutine_restore_context() starts f(arg) from, right below top
+static void *coroutine__frame(void *top, void (*f)(void*), void *arg)
+{
+    void **rsp = top;
+    // @arch
+    *(--rsp) = coroutine__finish_current;
+    *(--rsp) = f;
+    *(--rsp) = arg; // push rdi
+    *(--rsp) = 0;   // push rbx
+    *(--rsp) = 0;   // push rbp
+    *(--rsp) = 0;   // push r12
+    *(--rsp) = 0;   // push r13
+    *(--rsp) = 0;   // push r14
+    *(--rsp) = 0;   // push r15
+    return rsp;
+}
+#elif defined(__aarch64__)
+// AAPCS64: arguments in x0-x7. Only the callee-saved registers are kept across
+// a switch: x19-x28, the frame pointer x29, the link register x30 and the low
+// halves of v8-v15. The saved frame mirrors the x86_64 one, x0 included.
+//
+//     sp + 0   x19 x20 x21 x22 x23 x24 x25 x26 x27 x28
+//     sp + 80  x29 x30
+//     sp + 96  d8 d9 d10 d11 d12 d13 d14 d15
+//     sp + 160 x0, padding to keep sp 16-byte aligned
+//
+// gcc does not support naked functions on aarch64, so these are plain asm.
+#define COROUTINE__SAVE                 \
+    "    sub sp, sp, #176\n"            \
+    "    stp x19, x20, [sp, #0]\n"      \
+    "    stp x21, x22, [sp, #16]\n"     \
+    "    stp x23, x24, [sp, #32]\n"     \
+    "    stp x25, x26, [sp, #48]\n"     \
+    "    stp x27, x28, [sp, #64]\n"     \
+    "    stp x29, x30, [sp, #80]\n"     \
+    "    stp d8, d9, [sp, #96]\n"       \
+    "    stp d10, d11, [sp, #112]\n"    \
+    "    stp d12, d13, [sp, #128]\n"    \
+    "    stp d14, d15, [sp, #144]\n"    \
+    "    str x0, [sp, #160]\n"
 
-    if (polls.count > 0) {
-        int timeout = active.count == 0 ? -1 : 0;
-        int result = poll(polls.items, polls.count, timeout);
-        if (result < 0) TODO("poll");
+#define COROUTINE__FUNCTION(name) \
+    "    .global " name "\n"      \
+    "    .type " name ", %function\n" \
+    "    .p2align 4\n"            \
+    name ":\n"
 
-        for (size_t i = 0; i < polls.count;) {
-            if (polls.items[i].revents) {
-                size_t id = asleep.items[i];
-                da_remove_unordered(&polls, i);
-                da_remove_unordered(&asleep, i);
-                da_append(&active, id);
-            } else {
-                ++i;
-            }
+asm(
+"    .pushsection .text\n"
+COROUTINE__FUNCTION("coroutine_yield")
+COROUTINE__SAVE
+"    mov x0, sp\n"               // rsp
+"    mov x1, #0\n"               // sm = SM_NONE
+"    b coroutine_switch_context\n" // never returns
+
+COROUTINE__FUNCTION("coroutine_sleep_read")
+COROUTINE__SAVE
+"    mov x2, x0\n"               // fd
+"    mov x0, sp\n"               // rsp
+"    mov x1, #1\n"               // sm = SM_READ
+"    b coroutine_switch_context\n"
+
+COROUTINE__FUNCTION("coroutine_sleep_write")
+COROUTINE__SAVE
+"    mov x2, x0\n"               // fd
+"    mov x0, sp\n"               // rsp
+"    mov x1, #2\n"               // sm = SM_WRITE
+"    b coroutine_switch_context\n"
+
+COROUTINE__FUNCTION("coroutine__suspend")
+COROUTINE__SAVE
+"    mov x1, x0\n"               // sm
+"    mov x0, sp\n"               // rsp
+"    b coroutine_switch_context\n"
+
+COROUTINE__FUNCTION("coroutine_restore_context")
+"    mov sp, x0\n"
+"    ldp x19, x20, [sp, #0]\n"
+"    ldp x21, x22, [sp, #16]\n"
+"    ldp x23, x24, [sp, #32]\n"
+"    ldp x25, x26, [sp, #48]\n"
+"    ldp x27, x28, [sp, #64]\n"
+"    ldp x29, x30, [sp, #80]\n"
+"    ldp d8, d9, [sp, #96]\n"
+"    ldp d10, d11, [sp, #112]\n"
+"    ldp d12, d13, [sp, #128]\n"
+"    ldp d14, d15, [sp, #144]\n"
+"    ldr x0, [sp, #160]\n"
+"    add sp, sp, #176\n"
+"    ret\n"
+
+COROUTINE__FUNCTION("coroutine__switch")
+COROUTINE__SAVE
+"    mov x9, sp\n"
+"    str x9, [x0]\n"             // *save = sp
+"    mov x0, x1\n"
+"    b coroutine_restore_context\n"
+
+COROUTINE__FUNCTION("coroutine__call_on")
+"    mov sp, x0\n"
+"    mov x0, x2\n"
+"    blr x1\n"                   // never returns
+"    brk #0\n"
+
+// A fresh frame returns here with f in x19 and arg in x0. Unlike on x86_64 the
+// return address of f can not be put on the stack, so call it from here.
+COROUTINE__FUNCTION("coroutine__start")
+"    blr x19\n"
+"    b coroutine__finish_current\n"
+"    .popsection\n"
+);
+
+#define COROUTINE_FRAME_SIZE 176
+
+void coroutine__start(void);
+
+// The frame coroutine_restore_context() starts f(arg) from, right below top
+static void *coroutine__frame(void *top, void (*f)(void*), void *arg)
+{
+    void **rsp = (void**)((char*)top - COROUTINE_FRAME_SIZE);
+    memset(rsp, 0, COROUTINE_FRAME_SIZE);
+    // @arch
+    rsp[0] = f;                // x19
+    rsp[11] = coroutine__start; // x30
+    rsp[20] = arg;             // x0
+    return rsp;
+}
+#else
+#error "coroutine.c only supports x86_64 and aarch64"
+#endif // __x86_64__
+
+static inline Context *coroutine__context(size_t id)
+{
+    return &context_chunks[id/CONTEXTS_PER_CHUNK][id%CONTEXTS_PER_CHUNK];
+}
+
+// A brand new context without a stack
+static size_t coroutine__context_alloc(void)
+{
+    size_t id = __atomic_fetch_add(&contexts_count, 1, __ATOMIC_RELAXED);
+    size_t chunk = id/CONTEXTS_PER_CHUNK;
+    assert(chunk < CONTEXT_CHUNKS_CAP && "Too many coroutines");
+    if (__atomic_load_n(&context_chunks[chunk], __ATOMIC_ACQUIRE) == NULL) {
+        pthread_mutex_lock(&contexts_lock);
+        if (context_chunks[chunk] == NULL) {
+            Context *items = calloc(CONTEXTS_PER_CHUNK, sizeof(*items));
+            assert(items != NULL && "Buy more RAM lol");
+            __atomic_store_n(&context_chunks[chunk], items, __ATOMIC_RELEASE);
         }
+        pthread_mutex_unlock(&contexts_lock);
     }
 
-    assert(active.count > 0);
-    current %= active.count;
-    coroutine_restore_context(contexts.items[active.items[current]].rsp);
+    *coroutine__context(id) = (Context){.sleep_fd = -1, .timer = NO_TIMER};
+    return id;
 }
 
-// TODO: think how to get rid of coroutine_init() call at all
-void coroutine_init(void)
+static size_t coroutine__stack_class(size_t size)
 {
-    if (contexts.count != 0) return;
-    da_append(&contexts, (Context){0});
-    da_append(&active, 0);
+    size_t page = getpagesize();
+    size_t class = 0;
+    while ((page << class) < size) class += 1;
+    assert(class < STACK_CLASSES && "Stack size is too big");
+    return class;
 }
 
-void coroutine__finish_current(void)
+// How many stacks may get a guard: half of the mappings the kernel allows
+static size_t coroutine__guarded_stacks_max(void)
 {
-    if (active.items[current] == 0) {
-        UNREACHABLE("Main Coroutine with id == 0 should never reach this place");
+    static size_t max = 0;
+    size_t result = __atomic_load_n(&max, __ATOMIC_RELAXED);
+    if (result > 0) return result;
+
+    size_t max_map_count = 65530;
+    int fd = open("/proc/sys/vm/max_map_count", O_RDONLY);
+    if (fd >= 0) {
+        char buf[32] = {0};
+        if (read(fd, buf, sizeof(buf) - 1) > 0 && atol(buf) > 0) max_map_count = atol(buf);
+        close(fd);
     }
+    result = max_map_count/4 > 0 ? max_map_count/4 : 1;
+    __atomic_store_n(&max, result, __ATOMIC_RELAXED);
+    return result;
+}
 
-    da_append(&dead, active.items[current]);
-    da_remove_unordered(&active, current);
+static Stack coroutine__stack_get(size_t size)
+{
+    size_t class = coroutine__stack_class(size);
+    Stack_Pool *pool = &stack_pools[class];
+    if (pool->hot.count > 0) return pool->hot.items[--pool->hot.count];
+    if (pool->cold.count > 0) return pool->cold.items[--pool->cold.count];
 
-    if (polls.count > 0) {
-        int timeout = active.count == 0 ? -1 : 0;
-        int result = poll(polls.items, polls.count, timeout);
-        if (result < 0) TODO("poll");
+    // Every stack sits right above its guard, which is left accessible when it
+    // is not wanted, so all of them are unmapped the same way. Unguarded ones
+    // come in batches, the extra ones go to the cold pool.
+    size_t guard = COROUTINE_STACK_GUARD_PAGES*getpagesize();
+    Stack stack = {.size = (size_t)getpagesize() << class};
+    bool guarded = guard > 0 && __atomic_add_fetch(&guarded_stacks, 1, __ATOMIC_RELAXED) <= coroutine__guarded_stacks_max();
+    size_t count = guarded ? 1 : COROUTINE_STACK_BATCH;
+    char *map = mmap(NULL, count*(guard + stack.size), PROT_WRITE|PROT_READ, MAP_PRIVATE|MAP_STACK|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    assert(map != MAP_FAILED);
+    // ENOMEM: the rest of the program used up the mappings, go on without
+    if (guarded && mprotect(map, guard, PROT_NONE) < 0 && errno != ENOMEM) TODO("mprotect");
+    for (size_t i = 1; i < count; ++i) {
+        da_append(&pool->cold, ((Stack){.base = map + i*(guard + stack.size) + guard, .size = stack.size}));
+    }
+    stack.base = map + guard;
+    return stack;
+}
 
-        for (size_t i = 0; i < polls.count;) {
-            if (polls.items[i].revents) {
-                size_t id = asleep.items[i];
-                da_remove_unordered(&polls, i);
-                da_remove_unordered(&asleep, i);
-                da_append(&active, id);
-            } else {
-                ++i;
+// Must not release the memory of the stack right away, the single-threaded
+// scheduler is still running on it when a coroutine finishes
+static void coroutine__stack_put(Stack stack)
+{
+    Stack_Pool *pool = &stack_pools[coroutine__stack_class(stack.size)];
+    da_append(&pool->hot, stack);
+    if (pool->hot.count > COROUTINE_STACK_POOL_HOT) {
+        Stack cold = pool->hot.items[0];
+        da_remove_unordered(&pool->hot, 0);
+        if (madvise(cold.base, cold.size, MADV_DONTNEED) < 0) TODO("madvise");
+        da_append(&pool->cold, cold);
+    }
+}
+
+#ifdef COROUTINE_USE_EPOLL
+// Only workers of the M:N runtime ever finish
+static void coroutine__stack_pools_free(void)
+{
+    size_t guard = COROUTINE_STACK_GUARD_PAGES*getpagesize();
+    for (size_t class = 0; class < STACK_CLASSES; ++class) {
+        Stacks *lists[] = {&stack_pools[class].hot, &stack_pools[class].cold};
+        for (size_t i = 0; i < 2; ++i) {
+            for (size_t j = 0; j < lists[i]->count; ++j) {
+                Stack stack = lists[i]->items[j];
+                munmap((char*)stack.base - guard, guard + stack.size);
             }
+            free(lists[i]->items);
+            memset(lists[i], 0, sizeof(*lists[i]));
         }
     }
+}
+#endif // COROUTINE_USE_EPOLL
 
-    assert(active.count > 0);
-    current %= active.count;
-    coroutine_restore_context(contexts.items[active.items[current]].rsp);
+static uint64_t coroutine__now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
 }
 
-void coroutine_go(void (*f)(void*), void *arg)
+#ifdef COROUTINE_STATS
+static size_t coroutine__stats_bucket(uint64_t x)
+{
+    size_t i = 0;
+    while (x > 0 && i < COROUTINE_STATS_BUCKETS - 1) {
+        x >>= 1;
+        i += 1;
+    }
+    return i;
+}
+
+static void coroutine__stats_spawn(size_t id)
+{
+    Context *ctx = coroutine__context(id);
+    ctx->stats = (Coroutine_Context_Stats){.alive = 1};
+    ctx->stats_since = coroutine__now_ns();
+    ctx->stats_asleep = false;
+}
+
+// The coroutine is about to be switched to, `ready` coroutines (it included)
+// are runnable at the moment
+static void coroutine__stats_in(size_t id, size_t ready)
+{
+    Context *ctx = coroutine__context(id);
+    uint64_t now = stats_clock != 0 ? stats_clock : coroutine__now_ns();
+    stats_clock = 0;
+    ctx->stats.switches += 1;
+    ctx->stats.wait_ns += now - ctx->stats_since;
+    ctx->stats_since = now;
+    stats.switches += 1;
+    stats.ready_histogram[coroutine__stats_bucket(ready)] += 1;
+}
+
+// The coroutine has just been switched out for the reason of sm. Must happen
+// before anybody else can make it runnable again.
+static void coroutine__stats_out(size_t id, Sleep_Mode sm)
 {
-    size_t id;
-    if (dead.count > 0) {
-        id = dead.items[--dead.count];
+    Context *ctx = coroutine__context(id);
+    uint64_t now = coroutine__now_ns();
+    ctx->stats.run_ns += now - ctx->stats_since;
+    ctx->stats_since = now;
+    ctx->stats_asleep = sm != SM_NONE;
+    stats_clock = now;
+    if (sm == SM_DEAD) ctx->stats.alive = 0;
+}
+
+static void coroutine__stats_ready(size_t id)
+{
+    Context *ctx = coroutine__context(id);
+    if (!ctx->stats_asleep) return;
+    uint64_t now = coroutine__now_ns();
+    ctx->stats.sleep_ns += now - ctx->stats_since;
+    ctx->stats_since = now;
+    ctx->stats_asleep = false;
+}
+
+static void coroutine__stats_poll(int timeout)
+{
+    stats.poll_calls += 1;
+    stats_clock = 0;
+    if (timeout < 0) stats.poll_infinite += 1;
+    else stats.poll_timeout_histogram[coroutine__stats_bucket(timeout)] += 1;
+}
+#endif // COROUTINE_STATS
+
+// Give the stack of a finished coroutine back to the pool
+static void coroutine__context_bury(size_t id)
+{
+    Context *ctx = coroutine__context(id);
+    if (ctx->shared) {
+        // Still running on the shared stack, but there is nothing left to save
+        if (shared_owner == id) shared_owner = NO_COROUTINE;
+        free(ctx->saved);
+        ctx->shared = false;
+        ctx->saved = NULL;
+        ctx->saved_size = 0;
+        ctx->saved_capacity = 0;
     } else {
-        da_append(&contexts, ((Context){0}));
-        id = contexts.count-1;
-        contexts.items[id].stack_base = mmap(NULL, STACK_CAPACITY, PROT_WRITE|PROT_READ, MAP_PRIVATE|MAP_STACK|MAP_ANONYMOUS|MAP_GROWSDOWN, -1, 0);
-        assert(contexts.items[id].stack_base != MAP_FAILED);
+        coroutine__stack_put((Stack){.base = ctx->stack_base, .size = ctx->stack_size});
+        ctx->stack_base = NULL;
+        ctx->stack_size = 0;
     }
+    da_append(&dead, id);
+}
 
-    void **rsp = (void**)((char*)contexts.items[id].stack_base + STACK_CAPACITY);
-    // @arch
-    *(--rsp) = coroutine__finish_current;
-    *(--rsp) = f;
-    *(--rsp) = arg; // push rdi
-    *(--rsp) = 0;   // push rbx
-    *(--rsp) = 0;   // push rbp
-    *(--rsp) = 0;   // push r12
-    *(--rsp) = 0;   // push r13
-    *(--rsp) = 0;   // push r14
-    *(--rsp) = 0;   // push r15
-    contexts.items[id].rsp = rsp;
+// Keep the saved stack of a coroutine close to what it actually uses, so a
+// single deep call does not pin the memory forever
+static void coroutine__saved_reserve(Context *ctx, size_t size)
+{
+    if (ctx->saved_capacity >= size && ctx->saved_capacity <= 2*size) return;
+    ctx->saved = realloc(ctx->saved, size);
+    assert(ctx->saved != NULL && "Buy more RAM lol");
+    ctx->saved_capacity = size;
+}
 
-    da_append(&active, id);
+// Runs on copy_stack. Moves the frames of the coroutine that has the shared
+// stack to the heap, puts the ones of id in their place and resumes it.
+static void coroutine__shared_enter(size_t id)
+{
+    char *top = (char*)shared_stack.base + shared_stack.size;
+    if (shared_owner != NO_COROUTINE) {
+        Context *owner = coroutine__context(shared_owner);
+        size_t size = top - (char*)owner->rsp;
+        coroutine__saved_reserve(owner, size);
+        // The redzones of its frames are poisoned, but the copy is fine
+        ASAN_UNPOISON_MEMORY_REGION(owner->rsp, size);
+        memcpy(owner->saved, owner->rsp, size);
+        owner->saved_size = size;
+    }
+
+    Context *ctx = coroutine__context(id);
+    ASAN_UNPOISON_MEMORY_REGION(top - ctx->saved_size, ctx->saved_size);
+    memcpy(top - ctx->saved_size, ctx->saved, ctx->saved_size);
+    shared_owner = id;
+    coroutine_restore_context(ctx->rsp);
 }
 
-size_t coroutine_id(void)
+// Switch to a coroutine. Its frames have to be brought back first if it runs on
+// the shared stack and somebody else has been using it since.
+static void coroutine__resume(size_t id)
 {
-    return active.items[current];
+#ifdef COROUTINE_STATS
+    coroutine__stats_in(id, active.count);
+#endif // COROUTINE_STATS
+    Context *ctx = coroutine__context(id);
+    if (ctx->shared && shared_owner != id) {
+        // The current coroutine may be the one on the shared stack
+        coroutine__call_on((char*)copy_stack.base + copy_stack.size, coroutine__shared_enter, id);
+    }
+    coroutine_restore_context(ctx->rsp);
 }
 
-size_t coroutine_alive(void)
+// A context for a new coroutine, a dead one if there is any
+static size_t coroutine__context_new(void)
 {
-    return active.count;
+    if (dead.count > 0) return dead.items[--dead.count];
+
+    if (__atomic_load_n(&free_contexts.count, __ATOMIC_RELAXED) > 0) {
+        size_t id = NO_COROUTINE;
+        pthread_mutex_lock(&contexts_lock);
+        if (free_contexts.count > 0) id = free_contexts.items[--free_contexts.count];
+        pthread_mutex_unlock(&contexts_lock);
+        if (id != NO_COROUTINE) return id;
+    }
+
+    return coroutine__context_alloc();
 }
 
-void coroutine_wake_up(size_t id)
+static void coroutine__timers_swap(size_t i, size_t j)
 {
-    // @speed coroutine_wake_up is linear
-    for (size_t i = 0; i < asleep.count; ++i) {
-        if (asleep.items[i] == id) {
-            da_remove_unordered(&asleep, id);
-            da_remove_unordered(&polls, id);
-            da_append(&active, id);
-            return;
+    size_t t = timers.items[i];
+    timers.items[i] = timers.items[j];
+    timers.items[j] = t;
+    coroutine__context(timers.items[i])->timer = i;
+    coroutine__context(timers.items[j])->timer = j;
+}
+
+static bool coroutine__timers_less(size_t i, size_t j)
+{
+    return coroutine__context(timers.items[i])->deadline < coroutine__context(timers.items[j])->deadline;
+}
+
+static void coroutine__timers_sift_up(size_t i)
+{
+    while (i > 0 && coroutine__timers_less(i, (i - 1)/2)) {
+        coroutine__timers_swap(i, (i - 1)/2);
+        i = (i - 1)/2;
+    }
+}
+
+static void coroutine__timers_sift_down(size_t i)
+{
+    for (;;) {
+        size_t min = i;
+        size_t l = 2*i + 1, r = 2*i + 2;
+        if (l < timers.count && coroutine__timers_less(l, min)) min = l;
+        if (r < timers.count && coroutine__timers_less(r, min)) min = r;
+        if (min == i) return;
+        coroutine__timers_swap(i, min);
+        i = min;
+    }
+}
+
+static void coroutine__timer_add(size_t id, uint64_t deadline)
+{
+    Context *ctx = coroutine__context(id);
+    assert(ctx->timer == NO_TIMER);
+    ctx->deadline = deadline;
+    ctx->timed_out = false;
+    ctx->timer = timers.count;
+    da_append(&timers, id);
+    coroutine__timers_sift_up(timers.count - 1);
+}
+
+static void coroutine__timer_remove(size_t id)
+{
+    size_t i = coroutine__context(id)->timer;
+    assert(i < timers.count && timers.items[i] == id);
+    coroutine__context(id)->timer = NO_TIMER;
+    timers.count -= 1;
+    if (i == timers.count) return;
+    timers.items[i] = timers.items[timers.count];
+    coroutine__context(timers.items[i])->timer = i;
+    coroutine__timers_sift_down(i);
+    coroutine__timers_sift_up(i);
+}
+
+// Milliseconds until the nearest deadline or -1 if there is none
+static int coroutine__timers_timeout(void)
+{
+    if (timers.count == 0) return -1;
+    uint64_t deadline = coroutine__context(timers.items[0])->deadline;
+    uint64_t now = coroutine__now_ns();
+    if (deadline <= now) return 0;
+    // Round up, waking up a millisecond early would just spin one more time
+    uint64_t ms = (deadline - now + 999999)/1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+// How long the poller may block: not at all if there is something to run,
+// until the nearest deadline if there is one, forever otherwise.
+static int coroutine__poll_timeout(void)
+{
+    if (active.count > 0) return 0;
+    return coroutine__timers_timeout();
+}
+
+#ifdef COROUTINE_USE_EPOLL
+static void coroutine__queue_init(Run_Queue *q)
+{
+    q->buffer = malloc(sizeof(Run_Buffer) + DA_INIT_CAP*sizeof(size_t));
+    assert(q->buffer != NULL && "Buy more RAM lol");
+    q->buffer->capacity = DA_INIT_CAP;
+}
+
+static void coroutine__queue_free(Run_Queue *q)
+{
+    for (size_t i = 0; i < q->retired.count; ++i) free(q->retired.items[i]);
+    free(q->retired.items);
+    free(q->buffer);
+    memset(q, 0, sizeof(*q));
+}
+
+// Owner only
+static void coroutine__queue_push(Run_Queue *q, size_t id)
+{
+    size_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    size_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    Run_Buffer *buf = q->buffer;
+    if (b - t >= buf->capacity) {
+        Run_Buffer *grown = malloc(sizeof(Run_Buffer) + 2*buf->capacity*sizeof(size_t));
+        assert(grown != NULL && "Buy more RAM lol");
+        grown->capacity = 2*buf->capacity;
+        for (size_t i = t; i < b; ++i) {
+            size_t id = __atomic_load_n(&buf->items[i & (buf->capacity - 1)], __ATOMIC_RELAXED);
+            grown->items[i & (grown->capacity - 1)] = id;
+        }
+        da_append(&q->retired, buf);
+        __atomic_store_n(&q->buffer, grown, __ATOMIC_RELEASE);
+        buf = grown;
+    }
+    __atomic_store_n(&buf->items[b & (buf->capacity - 1)], id, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+// Anybody, the owner included
+static size_t coroutine__queue_take(Run_Queue *q)
+{
+    for (;;) {
+        size_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        size_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+        if (t >= b) return NO_COROUTINE;
+
+        Run_Buffer *buf = __atomic_load_n(&q->buffer, __ATOMIC_ACQUIRE);
+        size_t id = __atomic_load_n(&buf->items[t & (buf->capacity - 1)], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&q->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return id;
         }
     }
 }
+
+static size_t coroutine__queue_size(Run_Queue *q)
+{
+    size_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    size_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+    return b > t ? b - t : 0;
+}
+
+static void coroutine__kick(Worker *w)
+{
+    uint64_t one = 1;
+    ssize_t n = write(w->kick_fd, &one, sizeof(one));
+    UNUSED(n); // EAGAIN means the counter is saturated, the worker is kicked anyway
+}
+
+// Wake up one idle worker, if there is any, to steal the work we just pushed
+static void coroutine__kick_idle(void)
+{
+    if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) == 0) return;
+    for (size_t i = 0; i < workers_count; ++i) {
+        int expected = 1;
+        if (__atomic_compare_exchange_n(&workers[i].idle, &expected, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            coroutine__kick(&workers[i]);
+            return;
+        }
+    }
+}
+
+static void coroutine__inbox_send(Worker *w, Indices *box, size_t id)
+{
+    pthread_mutex_lock(&w->inbox_lock);
+    da_append(box, id);
+    __atomic_store_n(&w->inbox_pending, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&w->inbox_lock);
+    coroutine__kick(w);
+}
+#endif // COROUTINE_USE_EPOLL
+
+// Protects the state of the synchronization primitives. Only ever held for a
+// couple of instructions, and never across a switch except by coroutine__park().
+static void coroutine__spin_lock(int *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {}
+    }
+}
+
+static void coroutine__spin_unlock(int *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// Make a coroutine runnable on the current scheduler
+static void coroutine__ready(size_t id)
+{
+#ifdef COROUTINE_STATS
+    coroutine__stats_ready(id);
+#endif // COROUTINE_STATS
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) {
+        coroutine__queue_push(&worker->queue, id);
+        coroutine__kick_idle();
+        return;
+    }
+#endif // COROUTINE_USE_EPOLL
+    da_append(&active, id);
+}
+
+// Make a sleeping coroutine active again. Its fd registration, if any, must be
+// already gone.
+static void coroutine__wake(size_t id)
+{
+    if (coroutine__context(id)->timer != NO_TIMER) coroutine__timer_remove(id);
+    __atomic_store_n(&coroutine__context(id)->sleep_mode, SM_NONE, __ATOMIC_RELAXED);
+    coroutine__ready(id);
+}
+
+#ifdef COROUTINE_USE_EPOLL
+static uint32_t coroutine__fd_events(Fd_Waiters *w)
+{
+    uint32_t events = 0;
+    if (w->reader != NO_COROUTINE) events |= EPOLLIN;
+    if (w->writer != NO_COROUTINE) events |= EPOLLOUT;
+    return events;
+}
+
+// (Re)arm the one-shot registration of fd for whoever is waiting on it. The fd
+// is added to epoll only once. Re-arming is a single EPOLL_CTL_MOD, unless the
+// fd was closed and its number reused in the meantime. Returns false for fds
+// epoll refuses with EPERM (regular files, directories), which poll() reports
+// as always ready, so there is nothing to wait for.
+static bool coroutine__fd_arm(int fd)
+{
+    struct epoll_event ev = {0};
+    ev.events = coroutine__fd_events(&fds.items[fd]) | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        if (errno == EPERM) return false;
+        if (errno != ENOENT) TODO("epoll_ctl");
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            if (errno == EPERM) return false;
+            TODO("epoll_ctl");
+        }
+    }
+    return true;
+}
+
+// Returns false, without putting id to sleep, if fd is always ready
+static bool coroutine__fd_sleep(size_t id, int fd, Sleep_Mode sm)
+{
+    assert(fd >= 0);
+    while ((size_t)fd >= fds.count) {
+        da_append(&fds, ((Fd_Waiters){.reader = NO_COROUTINE, .writer = NO_COROUTINE}));
+    }
+
+    size_t *slot = sm == SM_READ ? &fds.items[fd].reader : &fds.items[fd].writer;
+    assert(*slot == NO_COROUTINE && "Only one coroutine can sleep on each direction of an fd");
+    *slot = id;
+    if (!coroutine__fd_arm(fd)) {
+        *slot = NO_COROUTINE;
+        if (coroutine__context(id)->timer != NO_TIMER) coroutine__timer_remove(id);
+        return false;
+    }
+    coroutine__context(id)->sleep_fd = fd;
+    sleepers += 1;
+    return true;
+}
+
+static void coroutine__fd_wake(size_t *slot)
+{
+    if (*slot == NO_COROUTINE) return;
+    size_t id = *slot;
+    coroutine__context(id)->sleep_fd = -1;
+    *slot = NO_COROUTINE;
+    sleepers -= 1;
+    coroutine__wake(id);
+}
+#endif // COROUTINE_USE_EPOLL
+
+#ifndef COROUTINE_USE_EPOLL
+static void coroutine__asleep_append(size_t id, int fd, short events)
+{
+    Context *ctx = coroutine__context(id);
+    ctx->sleep_fd = fd;
+    ctx->sleep_index = asleep.count;
+    da_append(&asleep, id);
+    struct pollfd pfd = {.fd = fd, .events = events,};
+    da_append(&polls, pfd);
+}
+
+// Removal swaps the last sleeper into i, which has to learn its new position
+static void coroutine__asleep_remove(size_t i)
+{
+    coroutine__context(asleep.items[i])->sleep_fd = -1;
+    da_remove_unordered(&asleep, i);
+    da_remove_unordered(&polls, i);
+    if (i < asleep.count) coroutine__context(asleep.items[i])->sleep_index = i;
+}
+#endif // COROUTINE_USE_EPOLL
+
+// Forget that the coroutine is waiting for its fd, if it is.
+static void coroutine__fd_cancel(size_t id)
+{
+#ifdef COROUTINE_USE_EPOLL
+    // The fd stays armed. If it fires later nobody is waiting on it anymore and
+    // the event is dropped.
+    int fd = coroutine__context(id)->sleep_fd;
+    if (fd < 0) return;
+    if (fds.items[fd].reader == id) fds.items[fd].reader = NO_COROUTINE;
+    if (fds.items[fd].writer == id) fds.items[fd].writer = NO_COROUTINE;
+    coroutine__context(id)->sleep_fd = -1;
+    sleepers -= 1;
+#else
+    if (coroutine__context(id)->sleep_fd < 0) return;
+    coroutine__asleep_remove(coroutine__context(id)->sleep_index);
+#endif // COROUTINE_USE_EPOLL
+}
+
+static void coroutine__timers_expire(void)
+{
+    if (timers.count == 0) return;
+    uint64_t now = coroutine__now_ns();
+    while (timers.count > 0 && coroutine__context(timers.items[0])->deadline <= now) {
+        size_t id = timers.items[0];
+        // Before the wake: in M:N mode another worker may resume it right away
+        coroutine__context(id)->timed_out = true;
+        coroutine__fd_cancel(id);
+        coroutine__wake(id);
+    }
+}
+
+#ifdef COROUTINE_USE_IO_URING
+static void coroutine__park(int *lock);
+static void coroutine__unpark(size_t id);
+
+// The io_uring of a thread. Operations are only put in the submission queue
+// while coroutines run and get submitted with a single io_uring_enter() per
+// scheduler tick, right before looking for events. The ring fd sits in the
+// epoll set, so completions wake up the scheduler like any other fd does.
+typedef struct {
+    int fd;                 // -1 until the first use, -2 if io_uring is not available
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_map;
+    size_t ring_map_size;
+    size_t sqes_map_size;
+    unsigned unsubmitted;
+    size_t in_flight;       // submitted or not, but not completed yet
+} Io_Ring;
+
+static __thread Io_Ring io_ring = {.fd = -1};
+
+static bool coroutine__io_ring_init(void)
+{
+    if (io_ring.fd != -1) return io_ring.fd >= 0;
+    io_ring.fd = -2;
+
+    struct io_uring_params params = {0};
+    int fd = syscall(__NR_io_uring_setup, COROUTINE_IO_URING_ENTRIES, &params);
+    if (fd < 0) return false;
+    // FAST_POLL (5.7) implies all the operations below and keeps sockets that
+    // are not ready off the kernel worker threads
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if ((params.features & required) != required) {
+        close(fd);
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    io_ring.ring_map_size = sq_size > cq_size ? sq_size : cq_size;
+    io_ring.ring_map = mmap(NULL, io_ring.ring_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (io_ring.ring_map == MAP_FAILED) TODO("mmap");
+    io_ring.sqes_map_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    io_ring.sqes = mmap(NULL, io_ring.sqes_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (io_ring.sqes == MAP_FAILED) TODO("mmap");
+
+    char *map = io_ring.ring_map;
+    io_ring.sq_head = (unsigned*)(map + params.sq_off.head);
+    io_ring.sq_tail = (unsigned*)(map + params.sq_off.tail);
+    io_ring.sq_mask = *(unsigned*)(map + params.sq_off.ring_mask);
+    io_ring.sq_array = (unsigned*)(map + params.sq_off.array);
+    io_ring.cq_head = (unsigned*)(map + params.cq_off.head);
+    io_ring.cq_tail = (unsigned*)(map + params.cq_off.tail);
+    io_ring.cq_mask = *(unsigned*)(map + params.cq_off.ring_mask);
+    io_ring.cqes = (struct io_uring_cqe*)(map + params.cq_off.cqes);
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) TODO("epoll_ctl");
+    io_ring.fd = fd;
+    return true;
+}
+
+static void coroutine__io_ring_free(void)
+{
+    if (io_ring.fd < 0) {
+        io_ring.fd = -1;
+        return;
+    }
+    assert(io_ring.in_flight == 0);
+    munmap(io_ring.sqes, io_ring.sqes_map_size);
+    munmap(io_ring.ring_map, io_ring.ring_map_size);
+    close(io_ring.fd);
+    io_ring = (Io_Ring){.fd = -1};
+}
+
+static void coroutine__io_submit(void)
+{
+    while (io_ring.unsubmitted > 0) {
+        int n = syscall(__NR_io_uring_enter, io_ring.fd, io_ring.unsubmitted, 0, 0, NULL, 0);
+        if (n < 0) {
+            // Too many completions nobody has looked at, submit the rest later
+            if (errno == EAGAIN || errno == EBUSY) return;
+            if (errno == EINTR) continue;
+            TODO("io_uring_enter");
+        }
+        io_ring.unsubmitted -= n;
+    }
+}
+
+static void coroutine__io_reap(void)
+{
+    unsigned head = *io_ring.cq_head;
+    unsigned tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &io_ring.cqes[head & io_ring.cq_mask];
+        size_t id = cqe->user_data;
+        coroutine__context(id)->io_result = cqe->res;
+        io_ring.in_flight -= 1;
+        coroutine__unpark(id);
+    }
+    __atomic_store_n(io_ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// A free submission queue entry, submitting what is already queued if there is
+// none left
+static struct io_uring_sqe *coroutine__io_sqe(void)
+{
+    for (;;) {
+        unsigned head = __atomic_load_n(io_ring.sq_head, __ATOMIC_ACQUIRE);
+        unsigned tail = *io_ring.sq_tail;
+        if (tail - head <= io_ring.sq_mask) {
+            struct io_uring_sqe *sqe = &io_ring.sqes[tail & io_ring.sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+        coroutine__io_submit();
+        // The completions of the ones in the way are only reaped by the
+        // scheduler, which is fine since we are not parked yet
+        coroutine__io_reap();
+    }
+}
+
+// Queue sqe up, park until it completes and return its cqe.res
+static int coroutine__io_wait(struct io_uring_sqe *sqe)
+{
+    static __thread int io_lock = 0; // parking needs one, but only this thread reaps
+    size_t id = coroutine_id();
+    sqe->user_data = id;
+    unsigned tail = *io_ring.sq_tail;
+    io_ring.sq_array[tail & io_ring.sq_mask] = tail & io_ring.sq_mask;
+    __atomic_store_n(io_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io_ring.unsubmitted += 1;
+    io_ring.in_flight += 1;
+
+    coroutine__spin_lock(&io_lock);
+    coroutine__park(&io_lock);
+    // Possibly on another thread by now in M:N mode
+    return coroutine__context(id)->io_result;
+}
+#endif // COROUTINE_USE_IO_URING
+
+#ifdef COROUTINE_USE_EPOLL
+static void coroutine__epoll(int timeout)
+{
+#ifdef COROUTINE_USE_IO_URING
+    if (io_ring.fd >= 0) {
+        coroutine__io_submit();
+        // Already done ones do not need to wait
+        if (*io_ring.cq_head != __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE)) timeout = 0;
+    }
+#endif // COROUTINE_USE_IO_URING
+
+#ifdef COROUTINE_STATS
+    coroutine__stats_poll(timeout);
+#endif // COROUTINE_STATS
+    struct epoll_event events[EPOLL_EVENTS_CAP];
+    int n = epoll_wait(epfd, events, EPOLL_EVENTS_CAP, timeout);
+    if (n < 0 && errno != EINTR) TODO("epoll_wait");
+
+#ifdef COROUTINE_USE_IO_URING
+    if (io_ring.fd >= 0) coroutine__io_reap();
+#endif // COROUTINE_USE_IO_URING
+
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+#ifdef COROUTINE_USE_IO_URING
+        if (fd == io_ring.fd) continue;
+#endif // COROUTINE_USE_IO_URING
+        if (fd == kick_fd) {
+            uint64_t kicks;
+            ssize_t r = read(kick_fd, &kicks, sizeof(kicks));
+            UNUSED(r);
+            continue;
+        }
+        Fd_Waiters *w = &fds.items[fd];
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) coroutine__fd_wake(&w->reader);
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) coroutine__fd_wake(&w->writer);
+        // The registration is one-shot, keep waiting for the other direction
+        if (coroutine__fd_events(w) != 0 && !coroutine__fd_arm(fd)) {
+            coroutine__fd_wake(&w->reader);
+            coroutine__fd_wake(&w->writer);
+        }
+    }
+}
+#endif // COROUTINE_USE_EPOLL
+
+// Move the sleeping coroutines whose fds became ready or whose deadlines have
+// passed to active. Blocks if there is nothing else to run.
+static void coroutine__poll(void)
+{
+    do {
+#ifdef COROUTINE_USE_EPOLL
+#ifdef COROUTINE_USE_IO_URING
+        if (sleepers == 0 && timers.count == 0 && io_ring.in_flight == 0) return;
+#else
+        if (sleepers == 0 && timers.count == 0) return;
+#endif // COROUTINE_USE_IO_URING
+        coroutine__epoll(coroutine__poll_timeout());
+#else
+        if (polls.count == 0 && timers.count == 0) return;
+
+        int timeout = coroutine__poll_timeout();
+#ifdef COROUTINE_STATS
+        coroutine__stats_poll(timeout);
+#endif // COROUTINE_STATS
+        int result = poll(polls.items, polls.count, timeout);
+        if (result < 0 && errno != EINTR) TODO("poll");
+
+        for (size_t i = 0; result > 0 && i < polls.count;) {
+            if (polls.items[i].revents) {
+                size_t id = asleep.items[i];
+                coroutine__asleep_remove(i);
+                coroutine__wake(id);
+            } else {
+                ++i;
+            }
+        }
+#endif // COROUTINE_USE_EPOLL
+
+        coroutine__timers_expire();
+        // Woken up by a signal, a stale event or too early for the deadline
+    } while (active.count == 0);
+}
+
+void coroutine_switch_context(void *rsp, Sleep_Mode sm, int fd)
+{
+#ifdef COROUTINE_USE_EPOLL
+    // The scheduler loop of the worker takes it from here. It runs on its own
+    // stack, so other workers can steal the coroutine without racing with us
+    // for its stack.
+    if (worker != NULL) {
+        coroutine__context(worker->current)->rsp = rsp;
+        worker->sm = sm;
+        worker->fd = fd;
+        coroutine_restore_context(worker->rsp);
+    }
+#endif // COROUTINE_USE_EPOLL
+
+    coroutine__context(active.items[current])->rsp = rsp;
+    coroutine__context(active.items[current])->sleep_mode = sm;
+#ifdef COROUTINE_STATS
+    coroutine__stats_out(active.items[current], sm);
+#endif // COROUTINE_STATS
+
+    switch (sm) {
+    case SM_NONE: current += 1; break;
+    case SM_TIMER: da_remove_unordered(&active, current); break;
+    case SM_PARKED: {
+        // Nobody else could have unparked us before this point anyway
+        da_remove_unordered(&active, current);
+        coroutine__spin_unlock(parking_lock);
+    } break;
+#ifdef COROUTINE_USE_EPOLL
+    case SM_READ:
+    case SM_WRITE: {
+        if (coroutine__fd_sleep(active.items[current], fd, sm)) {
+            da_remove_unordered(&active, current);
+        } else {
+            coroutine__context(active.items[current])->sleep_mode = SM_NONE;
+            current += 1;
+        }
+    } break;
+#else
+    case SM_READ: {
+        coroutine__asleep_append(active.items[current], fd, POLLRDNORM);
+        da_remove_unordered(&active, current);
+    } break;
+
+    case SM_WRITE: {
+        coroutine__asleep_append(active.items[current], fd, POLLWRNORM);
+        da_remove_unordered(&active, current);
+    } break;
+#endif // COROUTINE_USE_EPOLL
+
+    default: UNREACHABLE("coroutine_switch_context");
+    }
+
+    // Check the sleepers once per round over the active coroutines
+    if (current >= active.count) coroutine__poll();
+
+    assert(active.count > 0);
+    current %= active.count;
+    coroutine__resume(active.items[current]);
+}
+
+// TODO: think how to get rid of coroutine_init() call at all
+void coroutine_init(void)
+{
+    if (main_id != NO_COROUTINE) return;
+#ifdef COROUTINE_USE_EPOLL
+    assert(worker == NULL && "coroutine_init() can not be called inside of coroutine_run()");
+#endif // COROUTINE_USE_EPOLL
+    // The main coroutine keeps running on the stack of the thread
+    main_id = coroutine__context_alloc();
+#ifdef COROUTINE_STATS
+    coroutine__stats_spawn(main_id);
+#endif // COROUTINE_STATS
+    da_append(&active, main_id);
+#ifdef COROUTINE_USE_EPOLL
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epfd >= 0);
+#endif // COROUTINE_USE_EPOLL
+}
+
+// Entered by ret from the coroutine function, on x86_64 with the stack off by 8
+// bytes
+#ifdef __x86_64__
+__attribute__((force_align_arg_pointer))
+#endif // __x86_64__
+void coroutine__finish_current(void)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) {
+        worker->sm = SM_DEAD;
+        coroutine_restore_context(worker->rsp);
+    }
+#endif // COROUTINE_USE_EPOLL
+
+    if (active.items[current] == main_id) {
+        UNREACHABLE("Main Coroutine should never reach this place");
+    }
+
+#ifdef COROUTINE_STATS
+    coroutine__stats_out(active.items[current], SM_DEAD);
+#endif // COROUTINE_STATS
+    coroutine__context_bury(active.items[current]);
+    da_remove_unordered(&active, current);
+
+    if (current >= active.count) coroutine__poll();
+
+    assert(active.count > 0);
+    current %= active.count;
+    coroutine__resume(active.items[current]);
+}
+
+// Prepare a coroutine that starts with f(arg) once it is switched to
+static size_t coroutine__spawn(void (*f)(void*), void *arg, size_t stack_size)
+{
+    size_t id = coroutine__context_new();
+    Context *ctx = coroutine__context(id);
+    Stack stack = coroutine__stack_get(stack_size);
+    ctx->stack_base = stack.base;
+    ctx->stack_size = stack.size;
+    ctx->rsp = coroutine__frame((char*)ctx->stack_base + ctx->stack_size, f, arg);
+#ifdef COROUTINE_STATS
+    coroutine__stats_spawn(id);
+#endif // COROUTINE_STATS
+    return id;
+}
+
+// Same, but the coroutine starts out on the heap and gets copied onto the
+// shared stack whenever it runs
+static size_t coroutine__spawn_shared(void (*f)(void*), void *arg)
+{
+    if (shared_stack.base == NULL) {
+        shared_stack = coroutine__stack_get(COROUTINE_SHARED_STACK_SIZE);
+        copy_stack = coroutine__stack_get(16*getpagesize());
+    }
+
+    size_t id = coroutine__context_new();
+    Context *ctx = coroutine__context(id);
+    ctx->shared = true;
+    coroutine__saved_reserve(ctx, COROUTINE_FRAME_SIZE);
+    coroutine__frame((char*)ctx->saved + COROUTINE_FRAME_SIZE, f, arg);
+    ctx->saved_size = COROUTINE_FRAME_SIZE;
+    ctx->rsp = (char*)shared_stack.base + shared_stack.size - COROUTINE_FRAME_SIZE;
+#ifdef COROUTINE_STATS
+    coroutine__stats_spawn(id);
+#endif // COROUTINE_STATS
+    return id;
+}
+
+void coroutine_go(void (*f)(void*), void *arg)
+{
+    coroutine_go_sized(f, arg, COROUTINE_STACK_SIZE);
+}
+
+void coroutine_go_sized(void (*f)(void*), void *arg, size_t stack_size)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) __atomic_add_fetch(&alive, 1, __ATOMIC_SEQ_CST);
+#endif // COROUTINE_USE_EPOLL
+    coroutine__ready(coroutine__spawn(f, arg, stack_size));
+}
+
+void coroutine_go_shared(void (*f)(void*), void *arg)
+{
+#ifdef COROUTINE_USE_EPOLL
+    // The saved frames point into the shared stack of the worker they were
+    // saved on, so they could not be resumed after getting stolen
+    if (worker != NULL) {
+        coroutine_go(f, arg);
+        return;
+    }
+#endif // COROUTINE_USE_EPOLL
+    coroutine__ready(coroutine__spawn_shared(f, arg));
+}
+
+size_t coroutine_id(void)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) return worker->current;
+#endif // COROUTINE_USE_EPOLL
+    return active.items[current];
+}
+
+size_t coroutine_alive(void)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) return __atomic_load_n(&alive, __ATOMIC_RELAXED);
+#endif // COROUTINE_USE_EPOLL
+    return active.count;
+}
+
+static void coroutine__wake_local(size_t id)
+{
+    Sleep_Mode sm = coroutine__context(id)->sleep_mode;
+    if (sm == SM_NONE || sm == SM_PARKED) return;
+    coroutine__fd_cancel(id);
+    coroutine__wake(id);
+}
+
+void coroutine_wake_up(size_t id)
+{
+    // A stale or made up id may point past the allocated contexts, or into a
+    // chunk that is still being allocated
+    if (id >= __atomic_load_n(&contexts_count, __ATOMIC_RELAXED)) return;
+    if (id/CONTEXTS_PER_CHUNK >= CONTEXT_CHUNKS_CAP) return;
+    if (__atomic_load_n(&context_chunks[id/CONTEXTS_PER_CHUNK], __ATOMIC_ACQUIRE) == NULL) return;
+
+#ifdef COROUTINE_USE_EPOLL
+    // A sleeping coroutine belongs to the worker it fell asleep on, only that
+    // one may touch its fd and timer
+    if (worker != NULL) {
+        Context *ctx = coroutine__context(id);
+        Sleep_Mode sm = __atomic_load_n(&ctx->sleep_mode, __ATOMIC_ACQUIRE);
+        if (sm == SM_NONE || sm == SM_PARKED) return;
+        Worker *owner = &workers[__atomic_load_n(&ctx->worker, __ATOMIC_RELAXED)];
+        if (owner != worker) {
+            coroutine__inbox_send(owner, &owner->inbox_wake, id);
+            return;
+        }
+    }
+#endif // COROUTINE_USE_EPOLL
+
+    coroutine__wake_local(id);
+}
+
+void coroutine_sleep_ms(size_t ms)
+{
+    coroutine__timer_add(coroutine_id(), coroutine__now_ns() + (uint64_t)ms*1000000);
+    coroutine__suspend(SM_TIMER);
+}
+
+int coroutine_sleep_read_timeout(int fd, size_t ms)
+{
+    size_t id = coroutine_id();
+    coroutine__timer_add(id, coroutine__now_ns() + (uint64_t)ms*1000000);
+    coroutine_sleep_read(fd);
+    return !coroutine__context(id)->timed_out;
+}
+
+int coroutine_sleep_write_timeout(int fd, size_t ms)
+{
+    size_t id = coroutine_id();
+    coroutine__timer_add(id, coroutine__now_ns() + (uint64_t)ms*1000000);
+    coroutine_sleep_write(fd);
+    return !coroutine__context(id)->timed_out;
+}
+
+// Coroutines parked on a synchronization primitive, linked through
+// Context.wait_next. All of them are retried in FIFO order.
+typedef struct {
+    size_t head;
+    size_t tail;
+} Wait_Queue;
+
+#define WAIT_QUEUE_EMPTY ((Wait_Queue){.head = NO_COROUTINE, .tail = NO_COROUTINE})
+
+static void coroutine__wait_push(Wait_Queue *q, size_t id)
+{
+    coroutine__context(id)->wait_next = NO_COROUTINE;
+    if (q->tail == NO_COROUTINE) q->head = id;
+    else coroutine__context(q->tail)->wait_next = id;
+    q->tail = id;
+}
+
+static size_t coroutine__wait_pop(Wait_Queue *q)
+{
+    size_t id = q->head;
+    if (id == NO_COROUTINE) return id;
+    q->head = coroutine__context(id)->wait_next;
+    if (q->head == NO_COROUTINE) q->tail = NO_COROUTINE;
+    return id;
+}
+
+// Suspend the current coroutine until somebody calls coroutine__unpark() on it.
+// The caller holds *lock and has put itself in a Wait_Queue under it. The lock
+// is released once the coroutine is completely switched out, so whoever pops it
+// from the queue can not resume it too early on another worker.
+static void coroutine__park(int *lock)
+{
+    parking_lock = lock;
+    coroutine__suspend(SM_PARKED);
+}
+
+static void coroutine__unpark(size_t id)
+{
+    if (id == NO_COROUTINE) return;
+    __atomic_store_n(&coroutine__context(id)->sleep_mode, SM_NONE, __ATOMIC_RELAXED);
+    coroutine__ready(id);
+}
+
+static void coroutine__unpark_all(Wait_Queue *q)
+{
+    for (size_t id = coroutine__wait_pop(q); id != NO_COROUTINE; id = coroutine__wait_pop(q)) {
+        coroutine__unpark(id);
+    }
+}
+
+struct Coroutine_Channel {
+    int lock;
+    size_t item_size;
+    size_t capacity;       // COROUTINE_CHANNEL_UNBOUNDED or the most items it holds
+    char *items;           // ring buffer
+    size_t items_capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+    Wait_Queue senders;    // waiting for space
+    Wait_Queue receivers;  // waiting for items
+};
+
+Coroutine_Channel *coroutine_channel_new(size_t item_size, size_t capacity)
+{
+    assert(item_size > 0);
+    assert(capacity > 0 && "Unbuffered channels are not supported");
+    Coroutine_Channel *ch = calloc(1, sizeof(*ch));
+    assert(ch != NULL && "Buy more RAM lol");
+    ch->item_size = item_size;
+    ch->capacity = capacity;
+    // Bounded channels never grow, unbounded ones start small
+    ch->items_capacity = capacity != COROUTINE_CHANNEL_UNBOUNDED ? capacity : DA_INIT_CAP;
+    ch->items = malloc(ch->items_capacity*item_size);
+    assert(ch->items != NULL && "Buy more RAM lol");
+    ch->senders = WAIT_QUEUE_EMPTY;
+    ch->receivers = WAIT_QUEUE_EMPTY;
+    return ch;
+}
+
+void coroutine_channel_free(Coroutine_Channel *ch)
+{
+    assert(ch->senders.head == NO_COROUTINE && ch->receivers.head == NO_COROUTINE && "Freeing a channel somebody waits on");
+    free(ch->items);
+    free(ch);
+}
+
+static void coroutine__channel_grow(Coroutine_Channel *ch)
+{
+    size_t capacity = ch->items_capacity*2;
+    char *items = malloc(capacity*ch->item_size);
+    assert(items != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < ch->count; ++i) {
+        size_t j = (ch->head + i)%ch->items_capacity;
+        memcpy(items + i*ch->item_size, ch->items + j*ch->item_size, ch->item_size);
+    }
+    free(ch->items);
+    ch->items = items;
+    ch->items_capacity = capacity;
+    ch->head = 0;
+}
+
+int coroutine_channel_send(Coroutine_Channel *ch, const void *item)
+{
+    for (;;) {
+        coroutine__spin_lock(&ch->lock);
+        if (ch->closed) {
+            coroutine__spin_unlock(&ch->lock);
+            return 0;
+        }
+        if (ch->count < ch->capacity) {
+            if (ch->count == ch->items_capacity) coroutine__channel_grow(ch);
+            size_t i = (ch->head + ch->count)%ch->items_capacity;
+            memcpy(ch->items + i*ch->item_size, item, ch->item_size);
+            ch->count += 1;
+            size_t receiver = coroutine__wait_pop(&ch->receivers);
+            coroutine__spin_unlock(&ch->lock);
+            coroutine__unpark(receiver);
+            return 1;
+        }
+        coroutine__wait_push(&ch->senders, coroutine_id());
+        coroutine__park(&ch->lock);
+    }
+}
+
+int coroutine_channel_recv(Coroutine_Channel *ch, void *item)
+{
+    for (;;) {
+        coroutine__spin_lock(&ch->lock);
+        if (ch->count > 0) {
+            memcpy(item, ch->items + ch->head*ch->item_size, ch->item_size);
+            ch->head = (ch->head + 1)%ch->items_capacity;
+            ch->count -= 1;
+            size_t sender = coroutine__wait_pop(&ch->senders);
+            coroutine__spin_unlock(&ch->lock);
+            coroutine__unpark(sender);
+            return 1;
+        }
+        if (ch->closed) {
+            coroutine__spin_unlock(&ch->lock);
+            return 0;
+        }
+        coroutine__wait_push(&ch->receivers, coroutine_id());
+        coroutine__park(&ch->lock);
+    }
+}
+
+void coroutine_channel_close(Coroutine_Channel *ch)
+{
+    coroutine__spin_lock(&ch->lock);
+    ch->closed = true;
+    Wait_Queue senders = ch->senders;
+    Wait_Queue receivers = ch->receivers;
+    ch->senders = WAIT_QUEUE_EMPTY;
+    ch->receivers = WAIT_QUEUE_EMPTY;
+    coroutine__spin_unlock(&ch->lock);
+    coroutine__unpark_all(&senders);
+    coroutine__unpark_all(&receivers);
+}
+
+struct Coroutine_Wait_Group {
+    int lock;
+    size_t count;
+    Wait_Queue waiters;
+};
+
+Coroutine_Wait_Group *coroutine_wait_group_new(void)
+{
+    Coroutine_Wait_Group *wg = calloc(1, sizeof(*wg));
+    assert(wg != NULL && "Buy more RAM lol");
+    wg->waiters = WAIT_QUEUE_EMPTY;
+    return wg;
+}
+
+void coroutine_wait_group_free(Coroutine_Wait_Group *wg)
+{
+    assert(wg->waiters.head == NO_COROUTINE && "Freeing a wait group somebody waits on");
+    free(wg);
+}
+
+void coroutine_wait_group_add(Coroutine_Wait_Group *wg, size_t n)
+{
+    coroutine__spin_lock(&wg->lock);
+    wg->count += n;
+    coroutine__spin_unlock(&wg->lock);
+}
+
+void coroutine_wait_group_done(Coroutine_Wait_Group *wg)
+{
+    coroutine__spin_lock(&wg->lock);
+    assert(wg->count > 0 && "More coroutine_wait_group_done() than coroutine_wait_group_add()");
+    wg->count -= 1;
+    Wait_Queue waiters = WAIT_QUEUE_EMPTY;
+    if (wg->count == 0) {
+        waiters = wg->waiters;
+        wg->waiters = WAIT_QUEUE_EMPTY;
+    }
+    coroutine__spin_unlock(&wg->lock);
+    coroutine__unpark_all(&waiters);
+}
+
+void coroutine_wait_group_wait(Coroutine_Wait_Group *wg)
+{
+    for (;;) {
+        coroutine__spin_lock(&wg->lock);
+        if (wg->count == 0) {
+            coroutine__spin_unlock(&wg->lock);
+            return;
+        }
+        coroutine__wait_push(&wg->waiters, coroutine_id());
+        coroutine__park(&wg->lock);
+    }
+}
+
+struct Coroutine_Mutex {
+    int lock;
+    bool locked;
+    Wait_Queue waiters;
+};
+
+Coroutine_Mutex *coroutine_mutex_new(void)
+{
+    Coroutine_Mutex *m = calloc(1, sizeof(*m));
+    assert(m != NULL && "Buy more RAM lol");
+    m->waiters = WAIT_QUEUE_EMPTY;
+    return m;
+}
+
+void coroutine_mutex_free(Coroutine_Mutex *m)
+{
+    assert(!m->locked && "Freeing a locked mutex");
+    free(m);
+}
+
+void coroutine_mutex_lock(Coroutine_Mutex *m)
+{
+    for (;;) {
+        coroutine__spin_lock(&m->lock);
+        if (!m->locked) {
+            m->locked = true;
+            coroutine__spin_unlock(&m->lock);
+            return;
+        }
+        coroutine__wait_push(&m->waiters, coroutine_id());
+        coroutine__park(&m->lock);
+    }
+}
+
+void coroutine_mutex_unlock(Coroutine_Mutex *m)
+{
+    coroutine__spin_lock(&m->lock);
+    assert(m->locked && "Unlocking a mutex that is not locked");
+    m->locked = false;
+    size_t waiter = coroutine__wait_pop(&m->waiters);
+    coroutine__spin_unlock(&m->lock);
+    coroutine__unpark(waiter);
+}
+
+struct Coroutine_Cond {
+    int lock;
+    Wait_Queue waiters;
+};
+
+Coroutine_Cond *coroutine_cond_new(void)
+{
+    Coroutine_Cond *c = calloc(1, sizeof(*c));
+    assert(c != NULL && "Buy more RAM lol");
+    c->waiters = WAIT_QUEUE_EMPTY;
+    return c;
+}
+
+void coroutine_cond_free(Coroutine_Cond *c)
+{
+    assert(c->waiters.head == NO_COROUTINE && "Freeing a cond somebody waits on");
+    free(c);
+}
+
+void coroutine_cond_wait(Coroutine_Cond *c, Coroutine_Mutex *m)
+{
+    // Queue up before letting go of m, so a signal in between is not lost
+    coroutine__spin_lock(&c->lock);
+    coroutine__wait_push(&c->waiters, coroutine_id());
+    coroutine_mutex_unlock(m);
+    coroutine__park(&c->lock);
+    coroutine_mutex_lock(m);
+}
+
+void coroutine_cond_signal(Coroutine_Cond *c)
+{
+    coroutine__spin_lock(&c->lock);
+    size_t waiter = coroutine__wait_pop(&c->waiters);
+    coroutine__spin_unlock(&c->lock);
+    coroutine__unpark(waiter);
+}
+
+void coroutine_cond_broadcast(Coroutine_Cond *c)
+{
+    coroutine__spin_lock(&c->lock);
+    Wait_Queue waiters = c->waiters;
+    c->waiters = WAIT_QUEUE_EMPTY;
+    coroutine__spin_unlock(&c->lock);
+    coroutine__unpark_all(&waiters);
+}
+
+#ifdef COROUTINE_USE_IO_URING
+// The kernel works on the buffers after the coroutine is switched out, which a
+// coroutine on the shared stack can not allow for its locals
+static bool coroutine__io_uring(void)
+{
+    if (coroutine__context(coroutine_id())->shared) return false;
+    return coroutine__io_ring_init();
+}
+
+// io_uring results are -errno on failure
+static ssize_t coroutine__io_result(int res)
+{
+    if (res >= 0) return res;
+    errno = -res;
+    return -1;
+}
+#endif // COROUTINE_USE_IO_URING
+
+// Transfers are capped to what a cqe.res can report
+#define COROUTINE_IO_MAX (1u << 30)
+
+ssize_t coroutine_read(int fd, void *buf, size_t count, off_t offset)
+{
+    if (count > COROUTINE_IO_MAX) count = COROUTINE_IO_MAX;
+#ifdef COROUTINE_USE_IO_URING
+    if (coroutine__io_uring()) {
+        struct io_uring_sqe *sqe = coroutine__io_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = count;
+        sqe->off = offset; // -1 means the current position
+        return coroutine__io_result(coroutine__io_wait(sqe));
+    }
+#endif // COROUTINE_USE_IO_URING
+    for (;;) {
+        ssize_t n = offset < 0 ? read(fd, buf, count) : pread(fd, buf, count, offset);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+        coroutine_sleep_read(fd);
+    }
+}
+
+ssize_t coroutine_write(int fd, const void *buf, size_t count, off_t offset)
+{
+    if (count > COROUTINE_IO_MAX) count = COROUTINE_IO_MAX;
+#ifdef COROUTINE_USE_IO_URING
+    if (coroutine__io_uring()) {
+        struct io_uring_sqe *sqe = coroutine__io_sqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = count;
+        sqe->off = offset;
+        return coroutine__io_result(coroutine__io_wait(sqe));
+    }
+#endif // COROUTINE_USE_IO_URING
+    for (;;) {
+        ssize_t n = offset < 0 ? write(fd, buf, count) : pwrite(fd, buf, count, offset);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+        coroutine_sleep_write(fd);
+    }
+}
+
+int coroutine_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+#ifdef COROUTINE_USE_IO_URING
+    if (coroutine__io_uring()) {
+        struct io_uring_sqe *sqe = coroutine__io_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)addr;
+        sqe->addr2 = (uintptr_t)addrlen;
+        return coroutine__io_result(coroutine__io_wait(sqe));
+    }
+#endif // COROUTINE_USE_IO_URING
+    for (;;) {
+        int client = accept(fd, addr, addrlen);
+        if (client >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return client;
+        coroutine_sleep_read(fd);
+    }
+}
+
+int coroutine_openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+#ifdef COROUTINE_USE_IO_URING
+    if (coroutine__io_uring()) {
+        struct io_uring_sqe *sqe = coroutine__io_sqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = dirfd;
+        sqe->addr = (uintptr_t)path;
+        sqe->len = mode;
+        sqe->open_flags = flags;
+        return coroutine__io_result(coroutine__io_wait(sqe));
+    }
+#endif // COROUTINE_USE_IO_URING
+    return openat(dirfd, path, flags, mode);
+}
+
+#ifdef COROUTINE_USE_EPOLL
+static void coroutine__inbox_drain(void)
+{
+    if (!__atomic_load_n(&worker->inbox_pending, __ATOMIC_ACQUIRE)) return;
+
+    pthread_mutex_lock(&worker->inbox_lock);
+    worker->inbox_pending = 0;
+    for (size_t i = 0; i < worker->inbox_ready.count; ++i) {
+        coroutine__ready(worker->inbox_ready.items[i]);
+    }
+    for (size_t i = 0; i < worker->inbox_wake.count; ++i) {
+        size_t id = worker->inbox_wake.items[i];
+        // It could have been woken up and moved on since the request was sent
+        Context *ctx = coroutine__context(id);
+        if (__atomic_load_n(&ctx->sleep_mode, __ATOMIC_ACQUIRE) == SM_NONE) continue;
+        if (&workers[__atomic_load_n(&ctx->worker, __ATOMIC_RELAXED)] != worker) continue;
+        coroutine__wake_local(id);
+    }
+    worker->inbox_ready.count = 0;
+    worker->inbox_wake.count = 0;
+    pthread_mutex_unlock(&worker->inbox_lock);
+}
+
+static size_t coroutine__steal(void)
+{
+    // xorshift32, so the thieves do not all line up behind the same victim
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+
+    size_t start = worker->seed%workers_count;
+    for (size_t i = 0; i < workers_count; ++i) {
+        Worker *victim = &workers[(start + i)%workers_count];
+        if (victim == worker) continue;
+        size_t id = coroutine__queue_take(&victim->queue);
+        if (id != NO_COROUTINE) return id;
+    }
+    return NO_COROUTINE;
+}
+
+static bool coroutine__work_available(void)
+{
+    if (__atomic_load_n(&worker->inbox_pending, __ATOMIC_ACQUIRE)) return true;
+    for (size_t i = 0; i < workers_count; ++i) {
+        if (coroutine__queue_size(&workers[i].queue) > 0) return true;
+    }
+    return false;
+}
+
+// Nothing to run and nothing to steal. Sleep until one of our fds or timers
+// fires, or until somebody kicks us because there is new work.
+static void coroutine__worker_idle(void)
+{
+    __atomic_store_n(&worker->idle, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+
+    // Whatever was pushed before we announced ourselves idle did not kick us
+    bool recheck = coroutine__work_available() || __atomic_load_n(&alive, __ATOMIC_SEQ_CST) == 0;
+    coroutine__epoll(recheck ? 0 : coroutine__timers_timeout());
+    coroutine__timers_expire();
+
+    __atomic_store_n(&worker->idle, 0, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void coroutine__worker_run(size_t id)
+{
+    Context *ctx = coroutine__context(id);
+    __atomic_store_n(&ctx->worker, (size_t)(worker - workers), __ATOMIC_RELAXED);
+    worker->current = id;
+#ifdef COROUTINE_STATS
+    coroutine__stats_in(id, coroutine__queue_size(&worker->queue) + 1);
+#endif // COROUTINE_STATS
+    coroutine__switch(&worker->rsp, ctx->rsp);
+    worker->current = NO_COROUTINE;
+#ifdef COROUTINE_STATS
+    coroutine__stats_out(id, worker->sm);
+#endif // COROUTINE_STATS
+
+    // Back on the stack of the worker, nobody is using the coroutine's one now
+    switch (worker->sm) {
+    case SM_NONE: coroutine__ready(id); break;
+    case SM_TIMER:
+        __atomic_store_n(&ctx->sleep_mode, SM_TIMER, __ATOMIC_RELEASE);
+        break;
+    case SM_PARKED:
+        // Only now that the coroutine is off its stack may somebody unpark it
+        // and send it to another worker
+        __atomic_store_n(&ctx->sleep_mode, SM_PARKED, __ATOMIC_RELEASE);
+        coroutine__spin_unlock(parking_lock);
+        break;
+    case SM_READ:
+    case SM_WRITE:
+        if (coroutine__fd_sleep(id, worker->fd, worker->sm)) {
+            __atomic_store_n(&ctx->sleep_mode, worker->sm, __ATOMIC_RELEASE);
+        } else {
+            coroutine__ready(id);
+        }
+        break;
+    case SM_DEAD:
+        coroutine__context_bury(id);
+        if (__atomic_sub_fetch(&alive, 1, __ATOMIC_SEQ_CST) == 0) {
+            for (size_t i = 0; i < workers_count; ++i) coroutine__kick(&workers[i]);
+        }
+        break;
+    default: UNREACHABLE("coroutine__worker_run");
+    }
+}
+
+static void *coroutine__worker_loop(void *arg)
+{
+    worker = arg;
+    kick_fd = worker->kick_fd;
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epfd >= 0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = kick_fd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, kick_fd, &ev) < 0) TODO("epoll_ctl");
+
+    // Check the sleepers once per round over the run queue, same as the
+    // single-threaded scheduler does
+    size_t until_poll = 0;
+    while (__atomic_load_n(&alive, __ATOMIC_SEQ_CST) > 0) {
+        if (until_poll == 0) {
+            coroutine__epoll(0);
+            coroutine__timers_expire();
+            until_poll = coroutine__queue_size(&worker->queue) + 1;
+        }
+        coroutine__inbox_drain();
+
+        size_t id = coroutine__queue_take(&worker->queue);
+        if (id == NO_COROUTINE) id = coroutine__steal();
+        if (id == NO_COROUTINE) {
+            coroutine__worker_idle();
+            continue;
+        }
+        coroutine__worker_run(id);
+        until_poll -= 1;
+    }
+
+    // Let the next coroutine_run() reuse the contexts that died here
+    pthread_mutex_lock(&contexts_lock);
+    for (size_t i = 0; i < dead.count; ++i) da_append(&free_contexts, dead.items[i]);
+    pthread_mutex_unlock(&contexts_lock);
+
+    assert(sleepers == 0 && timers.count == 0);
+#ifdef COROUTINE_USE_IO_URING
+    coroutine__io_ring_free();
+#endif // COROUTINE_USE_IO_URING
+    free(dead.items);
+    free(timers.items);
+    free(fds.items);
+    coroutine__stack_pools_free();
+    memset(&dead, 0, sizeof(dead));
+    memset(&timers, 0, sizeof(timers));
+    memset(&fds, 0, sizeof(fds));
+    close(epfd);
+    epfd = -1;
+    kick_fd = -1;
+    worker = NULL;
+    return NULL;
+}
+#endif // COROUTINE_USE_EPOLL
+
+void coroutine_run(size_t count, void (*f)(void*), void *arg)
+{
+#ifdef COROUTINE_USE_EPOLL
+    assert(worker == NULL && main_id == NO_COROUTINE && "coroutine_run() can not be mixed with coroutine_init() on the same thread");
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    workers_count = count;
+    workers = calloc(count, sizeof(*workers));
+    assert(workers != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < count; ++i) {
+        Worker *w = &workers[i];
+        coroutine__queue_init(&w->queue);
+        w->current = NO_COROUTINE;
+        w->kick_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        assert(w->kick_fd >= 0);
+        w->seed = 2463534242u + (uint32_t)i*2654435761u;
+        pthread_mutex_init(&w->inbox_lock, NULL);
+    }
+
+    // The first coroutine starts on the worker of the calling thread
+    alive = 1;
+    coroutine__queue_push(&workers[0].queue, coroutine__spawn(f, arg, COROUTINE_STACK_SIZE));
+
+    for (size_t i = 1; i < count; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, coroutine__worker_loop, &workers[i]) != 0) TODO("pthread_create");
+    }
+    coroutine__worker_loop(&workers[0]);
+    for (size_t i = 1; i < count; ++i) pthread_join(workers[i].thread, NULL);
+
+    for (size_t i = 0; i < count; ++i) {
+        Worker *w = &workers[i];
+        coroutine__queue_free(&w->queue);
+        close(w->kick_fd);
+        pthread_mutex_destroy(&w->inbox_lock);
+        free(w->inbox_ready.items);
+        free(w->inbox_wake.items);
+    }
+    free(workers);
+    workers = NULL;
+    workers_count = 0;
+#else
+    UNUSED(count);
+    UNUSED(f);
+    UNUSED(arg);
+    TODO("coroutine_run() requires the epoll backend");
+#endif // COROUTINE_USE_EPOLL
+}
+
+void coroutine_go_on(size_t index, void (*f)(void*), void *arg)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) {
+        assert(index < workers_count);
+        Worker *target = &workers[index];
+        if (target == worker) {
+            coroutine_go(f, arg);
+            return;
+        }
+        __atomic_add_fetch(&alive, 1, __ATOMIC_SEQ_CST);
+        coroutine__inbox_send(target, &target->inbox_ready, coroutine__spawn(f, arg, COROUTINE_STACK_SIZE));
+        return;
+    }
+#endif // COROUTINE_USE_EPOLL
+    UNUSED(index);
+    coroutine_go(f, arg);
+}
+
+size_t coroutine_worker(void)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) return worker - workers;
+#endif // COROUTINE_USE_EPOLL
+    return 0;
+}
+
+size_t coroutine_workers(void)
+{
+#ifdef COROUTINE_USE_EPOLL
+    if (worker != NULL) return workers_count;
+#endif // COROUTINE_USE_EPOLL
+    return 1;
+}
+
+void coroutine_stats(Coroutine_Stats *s)
+{
+#ifdef COROUTINE_STATS
+    *s = stats;
+#else
+    memset(s, 0, sizeof(*s));
+#endif // COROUTINE_STATS
+}
+
+void coroutine_stats_of(size_t id, Coroutine_Context_Stats *s)
+{
+#ifdef COROUTINE_STATS
+    Context *ctx = coroutine__context(id);
+    *s = ctx->stats;
+    if (id == coroutine_id()) s->run_ns += coroutine__now_ns() - ctx->stats_since;
+#else
+    UNUSED(id);
+    memset(s, 0, sizeof(*s));
+#endif // COROUTINE_STATS
+}
+
+static void coroutine__stats_write_histogram(Coroutine_Stats_Writer write, void *user, const char *name, const size_t *histogram)
+{
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "\"%s\":[", name);
+    write(user, buf, n);
+    for (size_t i = 0; i < COROUTINE_STATS_BUCKETS; ++i) {
+        n = snprintf(buf, sizeof(buf), "%s%zu", i > 0 ? "," : "", histogram[i]);
+        write(user, buf, n);
+    }
+    write(user, "]", 1);
+}
+
+void coroutine_stats_dump_json(Coroutine_Stats_Writer write, void *user)
+{
+    Coroutine_Stats s;
+    coroutine_stats(&s);
+
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "{\"switches\":%zu,\"poll_calls\":%zu,\"poll_infinite\":%zu,",
+                     s.switches, s.poll_calls, s.poll_infinite);
+    write(user, buf, n);
+    coroutine__stats_write_histogram(write, user, "poll_timeout_histogram", s.poll_timeout_histogram);
+    write(user, ",", 1);
+    coroutine__stats_write_histogram(write, user, "ready_histogram", s.ready_histogram);
+
+    const char *sep = "";
+    write(user, ",\"coroutines\":[", 15);
+    size_t count = __atomic_load_n(&contexts_count, __ATOMIC_RELAXED);
+    for (size_t id = 0; id < count; ++id) {
+        // Allocated, but maybe not initialized yet
+        if (__atomic_load_n(&context_chunks[id/CONTEXTS_PER_CHUNK], __ATOMIC_ACQUIRE) == NULL) continue;
+        Coroutine_Context_Stats cs;
+        coroutine_stats_of(id, &cs);
+        if (!cs.alive) continue;
+        n = snprintf(buf, sizeof(buf),
+                     "%s{\"id\":%zu,\"switches\":%zu,\"run_ns\":%llu,\"sleep_ns\":%llu,\"wait_ns\":%llu}",
+                     sep, id, cs.switches, (unsigned long long)cs.run_ns,
+                     (unsigned long long)cs.sleep_ns, (unsigned long long)cs.wait_ns);
+        write(user, buf, n);
+        sep = ",";
+    }
+    write(user, "]}", 2);
+}
@@ -22,8 +22,31 @@
 // Each coroutine has its own separate call stack. Every time a new coroutine is
 // created with coroutine_go() a new call stack is allocated in dynamic memory.
 // The library manages a global array of coroutine stacks and switches between
-// them (on x86_64 literally swaps out the value of the RSP register) on every
-// coroutine_yield(), coroutine_sleep_read(), or coroutine_sleep_write().
+// them (literally swaps out the value of the RSP register on x86_64 or SP on
+// aarch64) on every coroutine_yield(), coroutine_sleep_read(), or
+// coroutine_sleep_write().
+//
+// Sleeping coroutines are tracked with epoll on Linux, so the cost of a switch
+// does not depend on how many of them there are. Only one coroutine may sleep
+// on each direction of a particular fd at a time. Compile coroutine.c with
+// -DCOROUTINE_USE_POLL to use the portable poll() scheduler instead.
+//
+// # Threads
+//
+// Every thread that calls coroutine_init() gets its own independent scheduler.
+// Coroutines never leave the thread they were created on in that mode.
+//
+// Alternatively coroutine_run() starts an M:N runtime: a pool of worker threads
+// each with its own run queue, stealing coroutines from each other when they
+// run out of work. A coroutine may resume on a different thread after any
+// coroutine_yield() or coroutine_sleep_*(), so it must not hold on to thread
+// local state (including the address of errno) across those calls. Only
+// available with the epoll backend.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,13 +71,50 @@ void coroutine_yield(void);
 // handling the chains of coroutine_yield()-s.
 void coroutine_go(void (*f)(void*), void *arg);
 
+// Same as coroutine_go() but with a stack of at least `stack_size` bytes
+// instead of the default COROUTINE_STACK_SIZE (1024 pages unless defined
+// otherwise when compiling coroutine.c). Sizes are rounded up to a power of two
+// pages. Stacks have a guard page below them, so overflowing one crashes with
+// SIGSEGV, except past the first vm.max_map_count/4 stacks of the process,
+// which go unguarded to not run out of mappings. Stacks of dead coroutines are
+// recycled.
+void coroutine_go_sized(void (*f)(void*), void *arg, size_t stack_size);
+
+// Same as coroutine_go() but the coroutine has no stack of its own. All the
+// coroutines created this way on a thread take turns running on a single shared
+// stack (COROUTINE_SHARED_STACK_SIZE). When one of them gets switched out for
+// another, the part of the stack it actually uses is copied to a right-sized
+// heap buffer and back. That makes a suspended coroutine cost about as much
+// memory as its live frames, which is what you want for huge numbers of
+// shallow coroutines, at the price of a copy on each such switch. Pointers to
+// its local variables are not valid for other coroutines while it is not
+// running. In M:N mode this is the same as coroutine_go().
+void coroutine_go_shared(void (*f)(void*), void *arg);
+
+// Run f(arg) as the first coroutine of an M:N runtime with `workers` threads
+// (0 means one per CPU). The calling thread becomes worker 0. Returns once all
+// the coroutines have finished. Must not be called on a thread that has
+// called coroutine_init().
+void coroutine_run(size_t workers, void (*f)(void*), void *arg);
+
+// Same as coroutine_go(), but the coroutine is queued on a particular worker of
+// the M:N runtime. It may still get stolen by another one later. Outside of
+// coroutine_run() the worker is ignored.
+void coroutine_go_on(size_t worker, void (*f)(void*), void *arg);
+
+// The index of the worker running the current coroutine and how many workers
+// there are. 0 and 1 outside of coroutine_run().
+size_t coroutine_worker(void);
+size_t coroutine_workers(void);
+
 // The id of the current coroutine.
 size_t coroutine_id(void);
 
 // How many coroutines are currently alive. Could be used by the main coroutine
 // to wait until all the "child" coroutines have died. It may also continue from
 // the call of coroutine_sleep_read() and coroutine_sleep_write() if the
-// corresponding coroutine was woken up.
+// corresponding coroutine was woken up. In M:N mode it counts all the
+// coroutines of the runtime, sleeping ones included.
 size_t coroutine_alive(void);
 
 // Put the current coroutine to sleep until the non-blocking socket `fd` has
@@ -72,11 +132,153 @@ void coroutine_sleep_read(int fd);
 void coroutine_sleep_write(int fd);
 
 // Wake up coroutine by id if it is currently sleeping due to
-// coroutine_sleep_read() or coroutine_sleep_write() calls.
+// coroutine_sleep_read(), coroutine_sleep_write() or coroutine_sleep_ms() calls
+// (or their timeout flavors). Does nothing otherwise, coroutines blocked on the
+// synchronization primitives below included. Takes constant time (plus
+// O(log n) to cancel the timeout if there is one) no matter how many
+// coroutines are asleep.
 void coroutine_wake_up(size_t id);
 
-// TODO: implement sleeping by timeout
-// TODO: add timeouts to coroutine_sleep_read() and coroutine_sleep_write()
+// Put the current coroutine to sleep for at least `ms` milliseconds. Other
+// coroutines keep running in the meantime. If all of them are asleep the
+// scheduler blocks in the kernel until the nearest deadline.
+void coroutine_sleep_ms(size_t ms);
+
+// Same as coroutine_sleep_read() and coroutine_sleep_write(), but give up
+// waiting after `ms` milliseconds. Return 0 if the coroutine was woken up by
+// the timeout, non-zero if it was woken up by the fd or by coroutine_wake_up().
+int coroutine_sleep_read_timeout(int fd, size_t ms);
+int coroutine_sleep_write_timeout(int fd, size_t ms);
+
+// # I/O
+//
+// Same as pread()/pwrite() (read()/write() if offset is -1), accept() and
+// openat(), but only the current coroutine waits for them. On Linux they go
+// through an io_uring per thread: the coroutine queues the operation up and is
+// parked until it completes, and everything queued up in between two scheduler
+// ticks is submitted with a single syscall. Unlike coroutine_sleep_read() that
+// works for regular files too.
+//
+// Without io_uring (other systems, -DCOROUTINE_USE_POLL,
+// -DCOROUTINE_NO_IO_URING, kernels older than 5.7 or where it is disabled), as
+// well as for coroutine_go_shared() coroutines, they fall back to calling the
+// syscall directly and to coroutine_sleep_read()/coroutine_sleep_write() on
+// EAGAIN. So sockets should be non-blocking, and regular files do block the
+// whole thread in that case.
+//
+// Return -1 and set errno on failure like the originals do.
+ssize_t coroutine_read(int fd, void *buf, size_t count, off_t offset);
+ssize_t coroutine_write(int fd, const void *buf, size_t count, off_t offset);
+int coroutine_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int coroutine_openat(int dirfd, const char *path, int flags, mode_t mode);
+
+// # Synchronization
+//
+// Channels, wait groups, mutexes and conds for coroutines. A coroutine that has
+// to wait on one of them is parked: it is taken off the run queue entirely until
+// another coroutine lets it go, so any amount of blocked coroutines costs
+// nothing per switch. If every coroutine of a coroutine_init() scheduler ends
+// up blocked, that is a deadlock and the scheduler aborts. The M:N runtime of
+// coroutine_run() does not detect it: the workers wait for events that never
+// come and the program hangs.
+//
+// They may be shared between the coroutines of one coroutine_init() scheduler,
+// or between all the coroutines of the M:N runtime, but not between independent
+// schedulers of different threads.
+
+typedef struct Coroutine_Channel Coroutine_Channel;
+typedef struct Coroutine_Wait_Group Coroutine_Wait_Group;
+typedef struct Coroutine_Mutex Coroutine_Mutex;
+typedef struct Coroutine_Cond Coroutine_Cond;
+
+#define COROUTINE_CHANNEL_UNBOUNDED ((size_t)-1)
+
+// A FIFO of items of `item_size` bytes each, copied in and out. A channel holds
+// at most `capacity` items, senders block once it is full. Pass
+// COROUTINE_CHANNEL_UNBOUNDED to never block senders. Capacity must not be 0.
+Coroutine_Channel *coroutine_channel_new(size_t item_size, size_t capacity);
+void coroutine_channel_free(Coroutine_Channel *ch);
+
+// Copy the item into the channel, waiting for space if it is full. Return 0
+// without sending if the channel is closed, non-zero otherwise.
+int coroutine_channel_send(Coroutine_Channel *ch, const void *item);
+
+// Copy the next item out of the channel, waiting for one if it is empty. Return
+// 0 once the channel is closed and drained, non-zero otherwise.
+int coroutine_channel_recv(Coroutine_Channel *ch, void *item);
+
+// No more sends. Wakes up everybody who waits on the channel. The items that
+// are already in it can still be received.
+void coroutine_channel_close(Coroutine_Channel *ch);
+
+// Waits for a number of tasks to finish: coroutine_wait_group_add() the amount
+// of them, have each one call coroutine_wait_group_done() and
+// coroutine_wait_group_wait() until all of them have.
+Coroutine_Wait_Group *coroutine_wait_group_new(void);
+void coroutine_wait_group_free(Coroutine_Wait_Group *wg);
+void coroutine_wait_group_add(Coroutine_Wait_Group *wg, size_t n);
+void coroutine_wait_group_done(Coroutine_Wait_Group *wg);
+void coroutine_wait_group_wait(Coroutine_Wait_Group *wg);
+
+// Mutual exclusion between coroutines that hold on to something across
+// coroutine_yield() and friends. Not recursive.
+Coroutine_Mutex *coroutine_mutex_new(void);
+void coroutine_mutex_free(Coroutine_Mutex *m);
+void coroutine_mutex_lock(Coroutine_Mutex *m);
+void coroutine_mutex_unlock(Coroutine_Mutex *m);
+
+// Same as the pthread ones. coroutine_cond_wait() unlocks m, waits for a signal
+// and locks m again. Like with pthreads, check the condition in a loop.
+Coroutine_Cond *coroutine_cond_new(void);
+void coroutine_cond_free(Coroutine_Cond *c);
+void coroutine_cond_wait(Coroutine_Cond *c, Coroutine_Mutex *m);
+void coroutine_cond_signal(Coroutine_Cond *c);
+void coroutine_cond_broadcast(Coroutine_Cond *c);
+
+// # Statistics
+//
+// When coroutine.c is compiled with -DCOROUTINE_STATS every coroutine keeps
+// track of how many times it was switched to and where its time went, and every
+// scheduler of how it polls and how long its run queue gets. That costs about
+// one clock_gettime() per switch (build/coroutine_switch_stats measures it).
+// Without it the functions below report zeros.
+
+#define COROUTINE_STATS_BUCKETS 24
+
+// Bucket 0 of the histograms counts the zeros, bucket i the values in
+// [2^(i-1), 2^i). The last one also counts everything above.
+typedef struct {
+    size_t switches;           // coroutines switched to
+    size_t poll_calls;         // epoll_wait() or poll() calls
+    size_t poll_infinite;      // of them without a timeout
+    size_t poll_timeout_histogram[COROUTINE_STATS_BUCKETS]; // the rest, by timeout in ms
+    size_t ready_histogram[COROUTINE_STATS_BUCKETS];        // runnable coroutines at each switch
+} Coroutine_Stats;
+
+typedef struct {
+    int alive;
+    size_t switches;           // times it was switched to
+    uint64_t run_ns;           // running
+    uint64_t sleep_ns;         // sleeping on an fd or a timer, or parked
+    uint64_t wait_ns;          // runnable, waiting for its turn
+} Coroutine_Context_Stats;
+
+// The counters of the scheduler of the calling thread (a worker of the M:N
+// runtime is a scheduler of its own).
+void coroutine_stats(Coroutine_Stats *stats);
+
+// The counters of the coroutine `id`, the current time slice included if it is
+// the one running. Ids of dead coroutines get reused.
+void coroutine_stats_of(size_t id, Coroutine_Context_Stats *stats);
+
+// Receives the JSON produced by coroutine_stats_dump_json() in chunks.
+typedef void (*Coroutine_Stats_Writer)(void *user, const char *data, size_t size);
+
+// Dump the counters of the scheduler of the calling thread and of every alive
+// coroutine as one JSON object. Meant to be called from the main coroutine (or
+// the first one of coroutine_run()) once in a while. In M:N mode the numbers of
+// the coroutines running on other workers at that moment are approximate.
+void coroutine_stats_dump_json(Coroutine_Stats_Writer write, void *user);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coroutine_mg.h"
+
+#ifndef COROUTINE_MG_SEND_MAX
+#define COROUTINE_MG_SEND_MAX (64*1024)
+#endif
+
+// How long a waiting coroutine sleeps at most before checking again. Events
+// wake it up right away, this only bounds the damage of a missed one.
+#ifndef COROUTINE_MG_WAIT_MS
+#define COROUTINE_MG_WAIT_MS 1000
+#endif
+
+#define NO_WAITER ((size_t)-1)
+
+typedef struct {
+    void (*serve)(Coroutine_Mg_Conn *conn);
+    void *arg;
+} Coroutine_Mg_Listener;
+
+// Sleep until the event handler of the connection wakes us up
+static void coroutine_mg__wait(Coroutine_Mg_Conn *conn)
+{
+    conn->waiter = coroutine_id();
+    coroutine_sleep_ms(COROUTINE_MG_WAIT_MS);
+    conn->waiter = NO_WAITER;
+}
+
+static void coroutine_mg__wake(Coroutine_Mg_Conn *conn)
+{
+    if (conn->waiter != NO_WAITER) coroutine_wake_up(conn->waiter);
+}
+
+static void coroutine_mg__conn_fn(struct mg_connection *c, int ev, void *ev_data)
+{
+    (void) ev_data;
+    Coroutine_Mg_Conn *conn = c->fn_data;
+    switch (ev) {
+    case MG_EV_READ:
+    case MG_EV_WRITE:
+        coroutine_mg__wake(conn);
+        break;
+    case MG_EV_CLOSE:
+        // c is freed right after this. Whoever of the two is the last one to
+        // let go of conn frees it.
+        conn->c = NULL;
+        if (conn->done) free(conn);
+        else coroutine_mg__wake(conn);
+        break;
+    default: break;
+    }
+}
+
+static void coroutine_mg__serve(void *arg)
+{
+    Coroutine_Mg_Conn *conn = arg;
+    conn->serve(conn);
+
+    conn->done = true;
+    if (conn->c == NULL) {
+        free(conn);
+    } else {
+        conn->c->is_draining = 1;
+    }
+}
+
+static void coroutine_mg__listener_fn(struct mg_connection *c, int ev, void *ev_data)
+{
+    (void) ev_data;
+    Coroutine_Mg_Listener *listener = c->fn_data;
+    if (ev == MG_EV_ACCEPT) {
+        // Accepted connections inherit the handler of the listener, take them
+        // over from here on. The listener may be closed and freed before the
+        // coroutine first runs (mg_mgr_free() in the same poll), so the
+        // connection gets its own copy of what it needs.
+        Coroutine_Mg_Conn *conn = calloc(1, sizeof(*conn));
+        assert(conn != NULL && "Buy more RAM lol");
+        conn->c = c;
+        conn->serve = listener->serve;
+        conn->arg = listener->arg;
+        conn->waiter = NO_WAITER;
+        c->fn = coroutine_mg__conn_fn;
+        c->fn_data = conn;
+        coroutine_go(coroutine_mg__serve, conn);
+    } else if (ev == MG_EV_CLOSE && !c->is_accepted) {
+        free(listener);
+    }
+}
+
+struct mg_connection *coroutine_mg_listen(struct mg_mgr *mgr, const char *url,
+                                          void (*serve)(Coroutine_Mg_Conn *conn), void *arg)
+{
+    Coroutine_Mg_Listener *listener = malloc(sizeof(*listener));
+    assert(listener != NULL && "Buy more RAM lol");
+    listener->serve = serve;
+    listener->arg = arg;
+    struct mg_connection *c = mg_listen(mgr, url, coroutine_mg__listener_fn, listener);
+    if (c == NULL) free(listener);
+    return c;
+}
+
+void coroutine_mg_poll(struct mg_mgr *mgr, int ms)
+{
+    mg_mgr_poll(mgr, 0);
+    // coroutine_alive() only counts the runnable ones, us included
+    if (coroutine_alive() > 1) {
+        coroutine_yield();
+        return;
+    }
+#if MG_ENABLE_EPOLL
+    coroutine_sleep_read_timeout(mgr->epoll_fd, ms);
+#else
+    mg_mgr_poll(mgr, ms);
+    coroutine_yield();
+#endif // MG_ENABLE_EPOLL
+}
+
+size_t coroutine_mg_read(Coroutine_Mg_Conn *conn, void *buf, size_t len)
+{
+    while (conn->c != NULL && conn->c->recv.len == 0) coroutine_mg__wait(conn);
+    if (conn->c == NULL) return 0;
+
+    struct mg_iobuf *recv = &conn->c->recv;
+    if (len > recv->len) len = recv->len;
+    memcpy(buf, recv->buf, len);
+    mg_iobuf_del(recv, 0, len);
+    return len;
+}
+
+bool coroutine_mg_write(Coroutine_Mg_Conn *conn, const void *buf, size_t len)
+{
+    while (conn->c != NULL && conn->c->send.len > COROUTINE_MG_SEND_MAX) coroutine_mg__wait(conn);
+    if (conn->c == NULL) return false;
+    return mg_send(conn->c, buf, len);
+}
+
+bool coroutine_mg_flush(Coroutine_Mg_Conn *conn)
+{
+    while (conn->c != NULL && conn->c->send.len > 0) coroutine_mg__wait(conn);
+    return conn->c != NULL;
+}
+
+bool coroutine_mg_http_next(Coroutine_Mg_Conn *conn, struct mg_http_message *hm)
+{
+    if (conn->c != NULL && conn->request_len > 0) {
+        mg_iobuf_del(&conn->c->recv, 0, conn->request_len);
+        conn->request_len = 0;
+    }
+
+    while (conn->c != NULL) {
+        struct mg_iobuf *recv = &conn->c->recv;
+        int head_len = mg_http_parse((char*)recv->buf, recv->len, hm);
+        if (head_len < 0) {
+            mg_error(conn->c, "bad HTTP request");
+            return false;
+        }
+        if (head_len > 0) {
+            // Requests without Content-Length have no body
+            if (hm->message.len == (size_t)-1) {
+                hm->body.len = 0;
+                hm->message.len = head_len;
+            }
+            if (recv->len >= hm->message.len) {
+                conn->request_len = hm->message.len;
+                return true;
+            }
+        }
+        coroutine_mg__wait(conn);
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+#ifndef COROUTINE_MG_H_
+#define COROUTINE_MG_H_
+
+// # Mongoose connections served by coroutines
+//
+// Instead of a callback state machine, every connection accepted by a
+// coroutine_mg_listen() listener gets a coroutine of its own that reads and
+// writes in a blocking style with coroutine_mg_read(), coroutine_mg_write() and
+// coroutine_mg_http_next(). Whenever one of those has to wait, the coroutine
+// sleeps and the others (the mongoose event loop included) keep going. A
+// handler that waits for something slow, like coroutine_sleep_ms(),
+// coroutine_read() of a file or another service, does not hold back the rest of
+// the connections. A handler that burns CPU still does, same as a callback.
+//
+// The event loop must be a coroutine as well: call coroutine_mg_poll() in a loop
+// instead of mg_mgr_poll(). Single-threaded scheduler only (coroutine_init()),
+// mongoose itself is not thread-safe.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "coroutine.h"
+#include "mongoose.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct Coroutine_Mg_Conn {
+    // The mongoose connection. Any mongoose API may be used on it from the
+    // serving coroutine, like mg_http_reply(). NULL once mongoose has closed
+    // the connection, the serving coroutine should return then.
+    struct mg_connection *c;
+    void *arg;              // the one passed to coroutine_mg_listen()
+
+    // Private
+    void (*serve)(struct Coroutine_Mg_Conn *conn); // the one passed to coroutine_mg_listen()
+    size_t waiter;          // the serving coroutine while it waits for an event
+    size_t request_len;     // the last coroutine_mg_http_next() request, consumed by the next call
+    bool done;              // the serving coroutine has returned
+} Coroutine_Mg_Conn;
+
+// Same as mg_listen(), but every accepted connection is served by
+// serve(conn) in a new coroutine. When serve() returns the connection is closed
+// once everything written to it has been sent.
+struct mg_connection *coroutine_mg_listen(struct mg_mgr *mgr, const char *url,
+                                          void (*serve)(Coroutine_Mg_Conn *conn), void *arg);
+
+// One iteration of the event loop. Runs mg_mgr_poll() without blocking and lets
+// the other coroutines run. If none of them can, waits for up to `ms`
+// milliseconds for the mongoose sockets together with whatever the sleeping
+// coroutines wait for (on Linux, where mongoose uses epoll, otherwise blocks
+// in mg_mgr_poll() for up to `ms`).
+void coroutine_mg_poll(struct mg_mgr *mgr, int ms);
+
+// Wait until there is received data, copy up to `len` bytes of it to buf and
+// return how many. Returns 0 once the connection is closed and nothing is left.
+size_t coroutine_mg_read(Coroutine_Mg_Conn *conn, void *buf, size_t len);
+
+// Queue the data up for sending. Waits while more than COROUTINE_MG_SEND_MAX
+// bytes are waiting to be sent already. Returns false if the connection is
+// closed.
+bool coroutine_mg_write(Coroutine_Mg_Conn *conn, const void *buf, size_t len);
+
+// Wait until everything written to the connection has been sent. Returns false
+// if the connection got closed first.
+bool coroutine_mg_flush(Coroutine_Mg_Conn *conn);
+
+// Wait for the next full HTTP request (headers and body) and parse it into hm.
+// hm points into the receive buffer and stays valid until the next call. The
+// previous request is dropped from the buffer. Returns false once the connection
+// is closed or the request is malformed, in which case the connection is
+// closed too.
+bool coroutine_mg_http_next(Coroutine_Mg_Conn *conn, struct mg_http_message *hm);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // COROUTINE_MG_H_
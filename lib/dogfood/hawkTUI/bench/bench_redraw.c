@@ -0,0 +1,232 @@
+// bench/bench_redraw.c - Headless benchmark of the POSIX backend. Draws a few
+// typical redraw patterns into a 200x60 context whose output goes to a file
+// instead of a terminal, and reports the bytes and escape sequences emitted
+// and the time spent per frame by tui_swap_buffers(), next to a full repaint
+// of every cell (what the Windows backend does) for comparison. The output of
+// the swaps is fed to the emulator of vt.h to count its sequences.
+//
+// Usage: ./build/bench_redraw [frames]
+#define HAWKTUI_IMPLEMENTATION
+#include "../src/hawkTUI.h"
+#define VT_IMPLEMENTATION
+#include "vt.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WIDTH 200
+#define HEIGHT 60
+#define OUT_MAX (1 << 20) // the most a frame is expected to write
+
+typedef void (*Pattern)(TUI_Context *context, int frame);
+
+static double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// some static text everywhere, like a dashboard
+static void draw_background(TUI_Context *context) {
+  tui_clear(context);
+  for (int y = 0; y < HEIGHT; y++) {
+    char line[WIDTH + 1];
+    snprintf(line, sizeof(line), "%3d | service-%02d  status: ok  latency:      "
+             "ms  requests:        total", y, y % 17);
+    tui_draw_string(context, 0, y, line, 7, 0);
+  }
+}
+
+static void pattern_idle(TUI_Context *context, int frame) {
+  (void)frame;
+  draw_background(context);
+}
+
+static void pattern_spinner(TUI_Context *context, int frame) {
+  draw_background(context);
+  static const char spinner[] = "|/-\\";
+  tui_draw_cell(context, WIDTH - 1, 0, (TUI_Cell){spinner[frame % 4], 14, 0});
+}
+
+static void pattern_status_line(TUI_Context *context, int frame) {
+  draw_background(context);
+  char status[WIDTH + 1];
+  snprintf(status, sizeof(status), " frame %8d | %-40s | uptime %6ds ",
+           frame, frame % 2 ? "syncing..." : "idle", frame / 60);
+  tui_draw_string(context, 0, HEIGHT - 1, status, 0, 7);
+}
+
+static void draw_numbers(TUI_Context *context, int frame) {
+  for (int y = 0; y < HEIGHT; y++) {
+    char n[16];
+    snprintf(n, sizeof(n), "%5d", (frame * 7 + y * 13) % 1000);
+    tui_draw_string(context, 41, y, n, 10, 0);
+    snprintf(n, sizeof(n), "%7d", frame * 31 + y);
+    tui_draw_string(context, 60, y, n, 11, 0);
+  }
+}
+
+// every row has two numbers that change every frame
+static void pattern_dashboard(TUI_Context *context, int frame) {
+  draw_background(context);
+  draw_numbers(context, frame);
+}
+
+// the same screens, drawn the way a long running dashboard would: the static
+// parts once, then only what changes
+static void pattern_static_idle(TUI_Context *context, int frame) {
+  if (frame == 0) {
+    draw_background(context);
+  }
+}
+
+static void pattern_static_spinner(TUI_Context *context, int frame) {
+  if (frame == 0) {
+    draw_background(context);
+  }
+  static const char spinner[] = "|/-\\";
+  tui_draw_cell(context, WIDTH - 1, 0, (TUI_Cell){spinner[frame % 4], 14, 0});
+}
+
+static void pattern_static_dashboard(TUI_Context *context, int frame) {
+  if (frame == 0) {
+    draw_background(context);
+  }
+  draw_numbers(context, frame);
+}
+
+// a log view that scrolls by a line every frame
+static void pattern_scroll(TUI_Context *context, int frame) {
+  tui_clear(context);
+  for (int y = 0; y < HEIGHT; y++) {
+    char line[WIDTH + 1];
+    int n = frame + y;
+    snprintf(line, sizeof(line), "[%06d] worker-%d handled request #%d in %d us",
+             n, n % 8, n * 3, (n * 37) % 997);
+    tui_draw_string(context, 0, y, line, n % 5 == 0 ? 12 : 7, 0);
+  }
+}
+
+static void pattern_full(TUI_Context *context, int frame) {
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      int v = x + y + frame;
+      tui_draw_cell(context, x, y,
+                    (TUI_Cell){(uint32_t)('a' + v % 26), (uint8_t)(v % 16),
+                               (uint8_t)((v / 16) % 8)});
+    }
+  }
+}
+
+// what a backend without a front buffer has to send: every cell, every frame.
+// Built with the same helpers as the real thing.
+static size_t full_repaint(TUI_Context *context) {
+  PosixTUIContext *posixContext = (PosixTUIContext *)context;
+  int attr = -1;
+  for (int y = 0; y < HEIGHT; y++) {
+    posix_out_csi(posixContext, y + 1, 1, 'H');
+    for (int x = 0; x < WIDTH; x++) {
+      int i = y * WIDTH + x;
+      if (context->attrs[i] != attr) {
+        attr = context->attrs[i];
+        posix_out_sgr(posixContext, context->attrs[i]);
+      }
+      posix_out_glyph(posixContext, context->glyphs[i]);
+    }
+  }
+  size_t len = posixContext->out_len;
+  posix_out_flush(posixContext);
+  return len;
+}
+
+static void run(const char *name, Pattern pattern, int frames, int fd) {
+  TUI_Context *context = NULL;
+  if (tui_init_fds(&context, (Clay_Dimensions){WIDTH, HEIGHT}, -1, fd) !=
+      TUI_SUCCESS) {
+    fprintf(stderr, "tui_init_fds failed\n");
+    exit(1);
+  }
+  Vt vt;
+  char *out = malloc(OUT_MAX);
+  if (!vt_init(&vt, WIDTH, HEIGHT) || !out) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  // the first frame draws everything anyway, leave it out
+  pattern(context, 0);
+  tui_swap_buffers(context);
+
+  double swap_time = 0, repaint_time = 0;
+  size_t swap_bytes = 0, repaint_bytes = 0;
+  for (int frame = 1; frame <= frames; frame++) {
+    pattern(context, frame);
+
+    lseek(fd, 0, SEEK_SET);
+    double start = now_secs();
+    tui_swap_buffers(context);
+    swap_time += now_secs() - start;
+    off_t bytes = lseek(fd, 0, SEEK_CUR);
+    swap_bytes += bytes;
+    if (bytes <= OUT_MAX && pread(fd, out, bytes, 0) == bytes) {
+      vt_feed(&vt, out, bytes);
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    start = now_secs();
+    repaint_bytes += full_repaint(context);
+    repaint_time += now_secs() - start;
+  }
+  tui_free(context);
+  free(out);
+
+  printf("%-12s diffed %8.0f B/frame %7.1f esc/frame %8.1f us/frame   full "
+         "repaint %8.0f B/frame %8.1f us/frame\n",
+         name, (double)swap_bytes / frames, (double)vt.stats.escapes / frames,
+         swap_time * 1e6 / frames, (double)repaint_bytes / frames,
+         repaint_time * 1e6 / frames);
+  vt_free(&vt);
+}
+
+// tui_clear() alone, which every pattern but idle pays per frame
+static void run_clear(int frames, int fd) {
+  TUI_Context *context = NULL;
+  if (tui_init_fds(&context, (Clay_Dimensions){WIDTH, HEIGHT}, -1, fd) !=
+      TUI_SUCCESS) {
+    fprintf(stderr, "tui_init_fds failed\n");
+    exit(1);
+  }
+  double start = now_secs();
+  for (int frame = 0; frame < frames; frame++) {
+    tui_clear(context);
+  }
+  double clear_time = now_secs() - start;
+  tui_free(context);
+  printf("%-12s %8.2f us/frame\n", "tui_clear", clear_time * 1e6 / frames);
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 1000;
+  char path[] = "/tmp/hawkTUI_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  unlink(path);
+
+  printf("%dx%d, %d frames\n", WIDTH, HEIGHT, frames);
+  run("idle", pattern_idle, frames, fd);
+  run("spinner", pattern_spinner, frames, fd);
+  run("status line", pattern_status_line, frames, fd);
+  run("dashboard", pattern_dashboard, frames, fd);
+  run("scroll", pattern_scroll, frames, fd);
+  run("full", pattern_full, frames, fd);
+  run("static idle", pattern_static_idle, frames, fd);
+  run("static spin", pattern_static_spinner, frames, fd);
+  run("static dash", pattern_static_dashboard, frames, fd);
+  run_clear(frames, fd);
+  close(fd);
+  return 0;
+}
@@ -12,17 +12,27 @@ typedef enum {
   TUI_SUCCESS,
   TUI_ERROR_INIT_FAILED,
   TUI_ERROR_OUT_OF_MEMORY,
+  TUI_ERROR_IO,
   // ... other error codes ...
 } TUI_Result;
 
 // --- Character Attributes ---
 
+// A cell as tui_draw_cell() takes it, the context stores them packed (see
+// struct TUI_Context)
 typedef struct {
-  char ch;    // Character to display
-  uint8_t fg; // Foreground color
-  uint8_t bg; // Background color
+  uint32_t ch; // Unicode codepoint to display, U+FFFD if it is not one column
+               // wide (CJK, emoji, combining marks, see tui_single_width())
+  uint8_t fg;  // Foreground color (console attribute bits, 0-15)
+  uint8_t bg;  // Background color (0-15)
 } TUI_Cell;
 
+// The colors of a cell packed into the one byte the back buffer keeps for
+// them, which is an index into the palette of the platform
+#define TUI_ATTR(fg, bg) ((uint8_t)(((fg) & 0xF) | ((bg) & 0xF) << 4))
+#define TUI_ATTR_FG(attr) ((attr) & 0xF)
+#define TUI_ATTR_BG(attr) ((attr) >> 4)
+
 // --- Key Codes (Simplified for Now) ---
 typedef struct {
   int code;
@@ -52,38 +62,217 @@ TUI_Result tui_swap_buffers(TUI_Context *context);
 TUI_Result tui_get_event(TUI_Context *context, TUI_Event *event);
 bool tui_running(TUI_Context *context);
 
+#if !defined(_WIN32)
+// Same as tui_init(), but reads keys from in_fd and writes the ANSI output to
+// out_fd instead of stdin/stdout. in_fd may be -1 for no input. The terminal
+// is only switched to the alternate screen if out_fd is a tty, so out_fd can
+// just as well be a file or a pipe (headless benchmarks and tests).
+TUI_Result tui_init_fds(TUI_Context **context, Clay_Dimensions dimensions,
+                        int in_fd, int out_fd);
+#endif
+
 // --- Implementation (Conditional Compilation) ---
 
 #ifdef HAWKTUI_IMPLEMENTATION
 
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Common part of every platform context (the platform ones embed it first).
+// The back buffer, drawn into by tui_draw_*, is kept as two arrays instead of
+// an array of TUI_Cell: the codepoint of every cell in glyphs, and its
+// TUI_ATTR() in attrs. Clearing is a fill of each, and a diff compares 4 + 1
+// bytes a cell with plain memcmp()s. The attr indexes the palette of the
+// platform: on Windows it is the console attribute itself, the POSIX backend
+// keeps the SGR sequence of each.
+//
+// The draws also record what they changed, so tui_swap_buffers() only looks
+// at those rows, and in them only at the columns [dirty_x0, dirty_x1). A row
+// that tui_clear() blanked is only marked in `cleared`: its cells get filled
+// when something is drawn into it, or at the swap.
+struct TUI_Context {
+  uint32_t *glyphs;
+  uint8_t *attrs;
+  uint64_t *dirty;   // a bit per row, changed since the last swap
+  uint64_t *cleared; // a bit per row, blank but not filled in yet
+  int *dirty_x0;
+  int *dirty_x1;
+  Arena *arena;
+  bool running;
+};
+
 // --- Platform-Agnostic Helpers ---
+static void tui_clear_rows(TUI_Context *context, int width, int height);
+
 TUI_Result allocate_cell_buffer(TUI_Context *context,
                                 Clay_Dimensions dimensions) {
-  context->buffer = (TUI_Cell *)arena_alloc(
-      context->arena,
-      sizeof(TUI_Cell) * (int)(dimensions.width * dimensions.height));
-  if (!context->buffer) {
+  int width = (int)dimensions.width, height = (int)dimensions.height;
+  int words = (height + 63) / 64;
+  context->glyphs = (uint32_t *)arena_alloc(context->arena,
+                                            sizeof(uint32_t) * width * height);
+  context->attrs = (uint8_t *)arena_alloc(context->arena, width * height);
+  context->dirty =
+      (uint64_t *)arena_alloc(context->arena, sizeof(uint64_t) * words);
+  context->cleared =
+      (uint64_t *)arena_alloc(context->arena, sizeof(uint64_t) * words);
+  context->dirty_x0 = (int *)arena_alloc(context->arena, sizeof(int) * height);
+  context->dirty_x1 = (int *)arena_alloc(context->arena, sizeof(int) * height);
+  if (!context->glyphs || !context->attrs || !context->dirty ||
+      !context->cleared || !context->dirty_x0 || !context->dirty_x1) {
     return TUI_ERROR_OUT_OF_MEMORY; // Or your preferred error code
   }
+  // starts out blank, and all of it has to be drawn once
+  tui_clear_rows(context, width, height);
   return TUI_SUCCESS;
 }
 
+static int tui_ctz64(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, v);
+  return (int)i;
+#else
+  return __builtin_ctzll(v);
+#endif
+}
+
+// set count glyphs to ch, 4 per store where there is SIMD
+static void tui_fill_glyphs(uint32_t *glyphs, uint32_t ch, int count) {
+  int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  __m128i v = _mm_set1_epi32((int)ch);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128((__m128i *)(glyphs + i), v);
+  }
+#elif defined(__ARM_NEON)
+  uint32x4_t v = vdupq_n_u32(ch);
+  for (; i + 4 <= count; i += 4) {
+    vst1q_u32(glyphs + i, v);
+  }
+#endif
+  for (; i < count; i++) {
+    glyphs[i] = ch;
+  }
+}
+
+// mark every row blank and changed, without touching a cell
+static void tui_clear_rows(TUI_Context *context, int width, int height) {
+  int words = (height + 63) / 64;
+  for (int word = 0; word < words; word++) {
+    int rows = height - word * 64;
+    uint64_t bits = rows >= 64 ? UINT64_MAX : ((uint64_t)1 << rows) - 1;
+    context->cleared[word] = bits;
+    context->dirty[word] = bits;
+  }
+  for (int y = 0; y < height; y++) {
+    context->dirty_x0[y] = 0;
+    context->dirty_x1[y] = width;
+  }
+}
+
+// fill in a row tui_clear() left blank, with empty cells
+static void tui_fill_row(TUI_Context *context, int width, int y) {
+  uint64_t bit = (uint64_t)1 << (y & 63);
+  if (context->cleared[y >> 6] & bit) {
+    context->cleared[y >> 6] &= ~bit;
+    tui_fill_glyphs(context->glyphs + y * width, ' ', width);
+    memset(context->attrs + y * width, TUI_ATTR(7, 0), width);
+  }
+}
+
+static void tui_mark_dirty(TUI_Context *context, int y, int x0, int x1) {
+  uint64_t bit = (uint64_t)1 << (y & 63);
+  if (!(context->dirty[y >> 6] & bit)) {
+    context->dirty[y >> 6] |= bit;
+    context->dirty_x0[y] = x0;
+    context->dirty_x1[y] = x1;
+    return;
+  }
+  if (x0 < context->dirty_x0[y]) {
+    context->dirty_x0[y] = x0;
+  }
+  if (x1 > context->dirty_x1[y]) {
+    context->dirty_x1[y] = x1;
+  }
+}
+
+// The first row at or after y that changed since the last swap, -1 if there
+// is none. The swap of a backend walks them with this, fills them in with
+// tui_fill_row() and calls tui_reset_dirty() when done.
+static int tui_next_dirty_row(TUI_Context *context, int height, int y) {
+  while (y < height) {
+    uint64_t bits = context->dirty[y >> 6] & (UINT64_MAX << (y & 63));
+    if (bits) {
+      y = (y & ~63) + tui_ctz64(bits);
+      return y < height ? y : -1;
+    }
+    y = (y & ~63) + 64;
+  }
+  return -1;
+}
+
+static void tui_reset_dirty(TUI_Context *context, int height) {
+  memset(context->dirty, 0, sizeof(uint64_t) * ((height + 63) / 64));
+}
+
 TUI_Result tui_clear(TUI_Context *context) {
 
-  if (!context || !context->buffer) {
+  if (!context || !context->glyphs) {
     return TUI_ERROR_INIT_FAILED;
   }
 
   Clay_Dimensions dimensions = tui_get_dimensions(context);
-  // fill with empty cells
-  for (int i = 0; i < dimensions.width * dimensions.height; i++) {
-    context->buffer[i] = (TUI_Cell){' ', 7, 0}; // default empty cell
-  }
+  // empty cells, filled in lazily
+  tui_clear_rows(context, (int)dimensions.width, (int)dimensions.height);
   return TUI_SUCCESS;
 }
 
+// The backends assume every glyph moves the cursor one column, like ASCII
+// does. Double width ones (CJK, most emoji) and zero width ones (combining
+// marks, joiners, variation selectors) would leave the terminal out of step
+// with the front buffer. These are the common ranges of both, after the
+// tables of Markus Kuhn's wcwidth(). What they miss counts as one column.
+static bool tui_single_width(uint32_t ch) {
+  if (ch < 0x300) {
+    return true; // ASCII and Latin-1, nearly everything
+  }
+  static const uint32_t other_width[][2] = {
+      {0x0300, 0x036F},   {0x0483, 0x0489},   {0x0591, 0x05BD},
+      {0x0610, 0x061A},   {0x064B, 0x065F},   {0x0670, 0x0670},
+      {0x06D6, 0x06DC},   {0x06DF, 0x06E4},   {0x0E31, 0x0E31},
+      {0x0E34, 0x0E3A},   {0x0E47, 0x0E4E},   {0x1100, 0x115F},
+      {0x1AB0, 0x1AFF},   {0x1DC0, 0x1DFF},   {0x200B, 0x200F},
+      {0x202A, 0x202E},   {0x2060, 0x2064},   {0x20D0, 0x20FF},
+      {0x2329, 0x232A},   {0x2E80, 0x303E},   {0x3040, 0xA4CF},
+      {0xAC00, 0xD7A3},   {0xF900, 0xFAFF},   {0xFE00, 0xFE0F},
+      {0xFE10, 0xFE19},   {0xFE20, 0xFE6F},   {0xFEFF, 0xFEFF},
+      {0xFF00, 0xFF60},   {0xFFE0, 0xFFE6},   {0x1F300, 0x1F64F},
+      {0x1F680, 0x1F6FF}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+      {0x20000, 0x3FFFD}, {0xE0000, 0xE01EF},
+  };
+  int lo = 0, hi = sizeof(other_width) / sizeof(other_width[0]);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ch < other_width[mid][0]) {
+      hi = mid;
+    } else if (ch > other_width[mid][1]) {
+      lo = mid + 1;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
 TUI_Result tui_draw_cell(TUI_Context *context, int x, int y, TUI_Cell cell) {
-  if (!context || !context->buffer) {
+  if (!context || !context->glyphs) {
     return TUI_ERROR_INIT_FAILED; // Or a more specific error
   }
 
@@ -92,10 +281,48 @@ TUI_Result tui_draw_cell(TUI_Context *context, int x, int y, TUI_Cell cell) {
     return TUI_ERROR_OUT_OF_MEMORY;
   }
 
+  if (!tui_single_width(cell.ch)) {
+    cell.ch = 0xFFFD;
+  }
+  tui_fill_row(context, (int)dimensions.width, y);
   int index = y * (int)dimensions.width + x;
-  context->buffer[index] = cell;
+  uint8_t attr = TUI_ATTR(cell.fg, cell.bg);
+  if (context->glyphs[index] == cell.ch && context->attrs[index] == attr) {
+    return TUI_SUCCESS; // redrawn the same, nothing for the swap to do
+  }
+  context->glyphs[index] = cell.ch;
+  context->attrs[index] = attr;
+  tui_mark_dirty(context, y, x, x + 1);
   return TUI_SUCCESS;
 }
+
+// decode the UTF-8 sequence at *str and step over it, invalid bytes are
+// U+FFFD
+static uint32_t tui_utf8_decode(const unsigned char **str) {
+  const unsigned char *p = *str;
+  uint32_t ch = p[0];
+  int len = ch < 0x80          ? 1
+            : (ch >> 5) == 0x6  ? 2
+            : (ch >> 4) == 0xE  ? 3
+            : (ch >> 3) == 0x1E ? 4
+                                : 0;
+  if (len == 0) {
+    *str = p + 1;
+    return 0xFFFD;
+  }
+  if (len > 1) {
+    ch &= 0x3F >> (len - 1);
+  }
+  for (int i = 1; i < len; i++) {
+    if ((p[i] & 0xC0) != 0x80) {
+      *str = p + i;
+      return 0xFFFD;
+    }
+    ch = ch << 6 | (p[i] & 0x3F);
+  }
+  *str = p + len;
+  return ch;
+}
 // --- Windows Implementation ---
 
 #ifdef _WIN32
@@ -129,6 +356,7 @@ TUI_Result windows_init(TUI_Context **context, Clay_Dimensions dimensions) {
     return TUI_ERROR_OUT_OF_MEMORY;
   }
   *winContext->arena = (Arena){0}; // zero out
+  winContext->base.arena = winContext->arena;
 
   // Initialize common part of context
   *context = (TUI_Context *)winContext; // IMPORTANT:  Set the OUT parameter.
@@ -205,20 +433,36 @@ Clay_Dimensions windows_get_dimensions(TUI_Context *context) {
 
 TUI_Result windows_swap_buffers(TUI_Context *context) {
   WindowsTUIContext *winContext = (WindowsTUIContext *)context;
-
-  // copy our buffer to the windows buffer
-  for (int i = 0;
-       i < winContext->dimensions.width * winContext->dimensions.height; i++) {
-    winContext->win_buffer[i].Char.AsciiChar = context->buffer[i].ch;
-    winContext->win_buffer[i].Attributes =
-        context->buffer[i].fg +
-        (context->buffer[i].bg << 4); // calculate attributes.
+  int width = (int)winContext->dimensions.width;
+  int height = (int)winContext->dimensions.height;
+
+  // copy the changed cells to the windows buffer, which keeps the rest from
+  // earlier swaps. A console cell holds one UTF-16 unit, and the attr already
+  // is the console attribute.
+  int top = -1, bottom = -1;
+  for (int y = tui_next_dirty_row(context, height, 0); y >= 0;
+       y = tui_next_dirty_row(context, height, y + 1)) {
+    tui_fill_row(context, width, y);
+    for (int x = context->dirty_x0[y]; x < context->dirty_x1[y]; x++) {
+      int i = y * width + x;
+      uint32_t ch = context->glyphs[i];
+      winContext->win_buffer[i].Char.UnicodeChar =
+          ch <= 0xFFFF ? (WCHAR)ch : (WCHAR)0xFFFD;
+      winContext->win_buffer[i].Attributes = context->attrs[i];
+    }
+    if (top < 0) {
+      top = y;
+    }
+    bottom = y;
   }
-
-  if (!WriteConsoleOutput(winContext->consoleOutput, winContext->win_buffer,
-                          (COORD){(short)winContext->dimensions.width,
-                                  (short)winContext->dimensions.height},
-                          (COORD){0, 0}, &winContext->drawRect)) {
+  tui_reset_dirty(context, height);
+
+  // one write of the rows from the first to the last that changed
+  SMALL_RECT rect = {0, (short)top, (short)(width - 1), (short)bottom};
+  if (top >= 0 &&
+      !WriteConsoleOutputW(winContext->consoleOutput, winContext->win_buffer,
+                           (COORD){(short)width, (short)height},
+                           (COORD){0, (short)top}, &rect)) {
     return TUI_ERROR_INIT_FAILED; // Replace with a proper error code
   }
 
@@ -258,83 +502,383 @@ bool windows_running(TUI_Context *context) {
   WindowsTUIContext *win_context = (WindowsTUIContext *)context;
   return win_context->running;
 }
-// --- Linux Implementation (Placeholder) ---
-
-#elif defined(__linux__)
+// --- POSIX Implementation (ANSI escape sequences + termios) ---
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Unchanged cells between two changed ones that are cheaper to rewrite than
+// to jump over with a cursor move (which costs 6+ bytes).
+#ifndef HAWKTUI_ANSI_MAX_GAP
+#define HAWKTUI_ANSI_MAX_GAP 4
+#endif
 
-// Linux-specific TUI context (you'll need to define this)
+// POSIX-specific TUI context. The terminal keeps showing the front buffer
+// until the next tui_swap_buffers(), which only sends the cells where the back
+// buffer (base.glyphs and base.attrs) differs from it.
 typedef struct {
-  TUI_Context base; // inherit base.
-  // ... ncurses or terminfo related members ...
+  TUI_Context base; // inherit base (MUST BE FIRST)
+  Clay_Dimensions dimensions;
+  uint32_t *front_glyphs; // what the terminal shows
+  uint8_t *front_attrs;
+  // the palette: SGR sequence of every attr, so a color change is a memcpy
+  char sgr[256][12];
+  uint8_t sgr_len[256];
+  int in_fd;
+  int out_fd;
+  bool tty;        // out_fd is a terminal we have set up
+  struct termios saved_termios;
+  bool raw;        // in_fd is in raw mode, saved_termios restores it
+  // ANSI output of the frame being built, sent with a single write()
+  char *out;
+  size_t out_len;
+  size_t out_cap;
   bool running;
   Arena *arena;
-} LinuxTUIContext;
+} PosixTUIContext;
+
+static void posix_out_reserve(PosixTUIContext *posixContext, size_t n) {
+  if (posixContext->out_len + n <= posixContext->out_cap) {
+    return;
+  }
+  size_t cap = posixContext->out_cap ? posixContext->out_cap : 4096;
+  while (cap < posixContext->out_len + n) {
+    cap *= 2;
+  }
+  posixContext->out = (char *)realloc(posixContext->out, cap);
+  assert(posixContext->out != NULL && "Buy more RAM lol");
+  posixContext->out_cap = cap;
+}
+
+static void posix_out_append(PosixTUIContext *posixContext, const char *data,
+                             size_t n) {
+  posix_out_reserve(posixContext, n);
+  memcpy(posixContext->out + posixContext->out_len, data, n);
+  posixContext->out_len += n;
+}
+
+// ESC [ n ; m <final>, without going through printf
+static void posix_out_csi(PosixTUIContext *posixContext, int n, int m,
+                          char final) {
+  posix_out_reserve(posixContext, 32);
+  char *out = posixContext->out + posixContext->out_len;
+  char *start = out;
+  *out++ = '\x1b';
+  *out++ = '[';
+  int args[2] = {n, m};
+  for (int i = 0; i < 2; i++) {
+    char digits[12];
+    int count = 0;
+    unsigned int v = (unsigned int)args[i];
+    do {
+      digits[count++] = (char)('0' + v % 10);
+      v /= 10;
+    } while (v > 0);
+    while (count > 0) {
+      *out++ = digits[--count];
+    }
+    *out++ = i == 0 ? ';' : final;
+  }
+  posixContext->out_len += (size_t)(out - start);
+}
+
+// write() the whole frame, retrying on partial writes
+static TUI_Result posix_out_flush(PosixTUIContext *posixContext) {
+  size_t sent = 0;
+  while (sent < posixContext->out_len) {
+    ssize_t n = write(posixContext->out_fd, posixContext->out + sent,
+                      posixContext->out_len - sent);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        struct pollfd pfd = {posixContext->out_fd, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      posixContext->out_len = 0;
+      return TUI_ERROR_IO;
+    }
+    sent += (size_t)n;
+  }
+  posixContext->out_len = 0;
+  return TUI_SUCCESS;
+}
+
+// The colors are Windows console attributes (bit 0 blue, bit 1 green, bit 2
+// red, bit 3 bright), ANSI has red and blue the other way around.
+static int posix_ansi_color(uint8_t color) {
+  return ((color & 1) << 2) | (color & 2) | ((color & 4) >> 2);
+}
+
+static void posix_build_palette(PosixTUIContext *posixContext) {
+  for (int attr = 0; attr < 256; attr++) {
+    int fg = TUI_ATTR_FG(attr), bg = TUI_ATTR_BG(attr);
+    int len = snprintf(posixContext->sgr[attr], sizeof(posixContext->sgr[0]),
+                       "\x1b[%d;%dm", (fg & 8 ? 90 : 30) + posix_ansi_color(fg),
+                       (bg & 8 ? 100 : 40) + posix_ansi_color(bg));
+    posixContext->sgr_len[attr] = (uint8_t)len;
+  }
+}
+
+static void posix_out_sgr(PosixTUIContext *posixContext, uint8_t attr) {
+  posix_out_reserve(posixContext, sizeof(posixContext->sgr[0]));
+  memcpy(posixContext->out + posixContext->out_len, posixContext->sgr[attr],
+         sizeof(posixContext->sgr[0])); // whole entry, a fixed size copy
+  posixContext->out_len += posixContext->sgr_len[attr];
+}
+
+// UTF-8 of a glyph. Control characters would mess up the cursor and are sent
+// as spaces, what is not a codepoint as U+FFFD.
+static void posix_out_glyph(PosixTUIContext *posixContext, uint32_t ch) {
+  posix_out_reserve(posixContext, 4);
+  char *out = posixContext->out + posixContext->out_len;
+  if (ch - ' ' < 0x7F - ' ') { // printable ASCII, nearly everything
+    out[0] = (char)ch;
+    posixContext->out_len += 1;
+    return;
+  }
+  if (ch < ' ' || (ch >= 0x7F && ch < 0xA0)) {
+    ch = ' ';
+  } else if (ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF)) {
+    ch = 0xFFFD;
+  }
+  if (ch < 0x80) {
+    out[0] = (char)ch;
+    posixContext->out_len += 1;
+  } else if (ch < 0x800) {
+    out[0] = (char)(0xC0 | ch >> 6);
+    out[1] = (char)(0x80 | (ch & 0x3F));
+    posixContext->out_len += 2;
+  } else if (ch < 0x10000) {
+    out[0] = (char)(0xE0 | ch >> 12);
+    out[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (ch & 0x3F));
+    posixContext->out_len += 3;
+  } else {
+    out[0] = (char)(0xF0 | ch >> 18);
+    out[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (ch & 0x3F));
+    posixContext->out_len += 4;
+  }
+}
 
-TUI_Result linux_init(TUI_Context **context, Clay_Dimensions dimensions) {
-  LinuxTUIContext *linuxContext =
-      (LinuxTUIContext *)malloc(sizeof(LinuxTUIContext));
-  if (!linuxContext) {
+TUI_Result tui_init_fds(TUI_Context **context, Clay_Dimensions dimensions,
+                        int in_fd, int out_fd) {
+  PosixTUIContext *posixContext =
+      (PosixTUIContext *)malloc(sizeof(PosixTUIContext));
+  if (!posixContext) {
     return TUI_ERROR_OUT_OF_MEMORY;
   }
+  *posixContext = (PosixTUIContext){0};
 
   // init arena.
-  linuxContext->arena = (Arena *)malloc(sizeof(Arena));
-  if (!linuxContext->arena) {
-    free(linuxContext);
+  posixContext->arena = (Arena *)malloc(sizeof(Arena));
+  if (!posixContext->arena) {
+    free(posixContext);
     return TUI_ERROR_OUT_OF_MEMORY;
   }
-  *linuxContext->arena = (Arena){0};
+  *posixContext->arena = (Arena){0};
+  posixContext->base.arena = posixContext->arena;
 
-  *context = (TUI_Context *)linuxContext;
+  *context = (TUI_Context *)posixContext;
   // set default to be running.
   (*context)->running = true;
-  if (allocate_cell_buffer(*context, dimensions) !=
-      TUI_SUCCESS) { // allocate cell buffer.
-    free(linuxContext->arena);
-    free(linuxContext);
+  posixContext->running = true;
+  posixContext->dimensions = dimensions;
+  posixContext->in_fd = in_fd;
+  posixContext->out_fd = out_fd;
+
+  int cells = (int)(dimensions.width * dimensions.height);
+  posixContext->front_glyphs = (uint32_t *)arena_alloc(
+      posixContext->arena, sizeof(uint32_t) * cells);
+  posixContext->front_attrs =
+      (uint8_t *)arena_alloc(posixContext->arena, cells);
+  if (!posixContext->front_glyphs || !posixContext->front_attrs ||
+      allocate_cell_buffer(*context, dimensions) != TUI_SUCCESS) {
+    arena_free(posixContext->arena);
+    free(posixContext->arena);
+    free(posixContext);
     return TUI_ERROR_OUT_OF_MEMORY;
   }
+  // no glyph matches an unknown front cell (not a codepoint), so the first
+  // frame draws everything
+  tui_fill_glyphs(posixContext->front_glyphs, UINT32_MAX, cells);
+  memset(posixContext->front_attrs, 0, cells);
+  posix_build_palette(posixContext);
+
+  if (in_fd >= 0 && isatty(in_fd) &&
+      tcgetattr(in_fd, &posixContext->saved_termios) == 0) {
+    struct termios raw = posixContext->saved_termios;
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN); // keep ISIG for Ctrl-C
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    posixContext->raw = tcsetattr(in_fd, TCSAFLUSH, &raw) == 0;
+  }
+
+  if (isatty(out_fd)) {
+    posixContext->tty = true;
+    // alternate screen, hide cursor, clear
+    static const char enter[] = "\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J";
+    posix_out_append(posixContext, enter, sizeof(enter) - 1);
+    posix_out_flush(posixContext);
+  }
 
-  // TODO: Initialize ncurses or terminfo here
-  fprintf(stderr, "linux_init not implemented yet!\n");
+  return TUI_SUCCESS;
+}
 
-  return TUI_SUCCESS; // Or an appropriate error code
+TUI_Result posix_init(TUI_Context **context, Clay_Dimensions dimensions) {
+  return tui_init_fds(context, dimensions, STDIN_FILENO, STDOUT_FILENO);
 }
 
-void linux_free(TUI_Context *context) {
+void posix_free(TUI_Context *context) {
   if (context) {
-    LinuxTUIContext *linux_context = (LinuxTUIContext *)context;
-    arena_free(linux_context->arena);
-    free(linux_context->arena); // free the arena
-    free(linux_context);        // free context
+    PosixTUIContext *posixContext = (PosixTUIContext *)context;
+    if (posixContext->tty) {
+      static const char leave[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+      posix_out_append(posixContext, leave, sizeof(leave) - 1);
+      posix_out_flush(posixContext);
+    }
+    if (posixContext->raw) {
+      tcsetattr(posixContext->in_fd, TCSAFLUSH, &posixContext->saved_termios);
+    }
+    free(posixContext->out);
+    arena_free(posixContext->arena);
+    free(posixContext->arena); // free the arena
+    free(posixContext);        // free context
   }
 }
-Clay_Dimensions linux_get_dimensions(TUI_Context *context) {
-  // TODO: Implement using ncurses or terminfo
-  LinuxTUIContext *linuxContext = (LinuxTUIContext *)context;
 
-  // For now, return a dummy value
-  fprintf(stderr, "linux_get_dimensions not implemented yet!\n");
+Clay_Dimensions posix_get_dimensions(TUI_Context *context) {
+  PosixTUIContext *posixContext = (PosixTUIContext *)context;
+  return posixContext->dimensions;
+}
 
-  // Clay_Dimensions dimensions = {80,24};
-  return (Clay_Dimensions){80, 24}; // Dummy dimensions
+// Send the cells that changed since the last swap, looking only where the
+// draws marked something: runs of changed cells per dirty row (small gaps of
+// unchanged ones included), each one preceded by a cursor move unless the
+// cursor is already there, with SGR sequences only where the colors change.
+// The whole frame goes out in one write().
+TUI_Result posix_swap_buffers(TUI_Context *context) {
+  PosixTUIContext *posixContext = (PosixTUIContext *)context;
+  int width = (int)posixContext->dimensions.width;
+  int height = (int)posixContext->dimensions.height;
+
+  int cursor_x = -1, cursor_y = -1; // unknown
+  int attr = -1;                    // unknown
+
+  for (int y = tui_next_dirty_row(context, height, 0); y >= 0;
+       y = tui_next_dirty_row(context, height, y + 1)) {
+    tui_fill_row(context, width, y);
+    uint32_t *back_glyphs = context->glyphs + y * width;
+    uint8_t *back_attrs = context->attrs + y * width;
+    uint32_t *front_glyphs = posixContext->front_glyphs + y * width;
+    uint8_t *front_attrs = posixContext->front_attrs + y * width;
+    int x = context->dirty_x0[y];
+    int row_end = context->dirty_x1[y];
+    if (memcmp(back_attrs + x, front_attrs + x, row_end - x) == 0 &&
+        memcmp(back_glyphs + x, front_glyphs + x,
+               sizeof(uint32_t) * (row_end - x)) == 0) {
+      continue; // drawn over with the same cells
+    }
+#define POSIX_CELL_EQ(i)                                                       \
+  (back_glyphs[i] == front_glyphs[i] && back_attrs[i] == front_attrs[i])
+    while (x < row_end) {
+      if (POSIX_CELL_EQ(x)) {
+        x++;
+        continue;
+      }
+
+      // extend the run over gaps that are cheaper to rewrite than to skip
+      int end = x + 1, gap = 0;
+      for (int i = end; i < row_end && gap <= HAWKTUI_ANSI_MAX_GAP; i++) {
+        if (POSIX_CELL_EQ(i)) {
+          gap++;
+        } else {
+          gap = 0;
+          end = i + 1;
+        }
+      }
+
+      if (cursor_x != x || cursor_y != y) {
+        posix_out_csi(posixContext, y + 1, x + 1, 'H');
+      }
+      for (int i = x; i < end; i++) {
+        if (back_attrs[i] != attr) {
+          attr = back_attrs[i];
+          posix_out_sgr(posixContext, back_attrs[i]);
+        }
+        posix_out_glyph(posixContext, back_glyphs[i]);
+      }
+      memcpy(front_glyphs + x, back_glyphs + x, sizeof(uint32_t) * (end - x));
+      memcpy(front_attrs + x, back_attrs + x, end - x);
+      cursor_x = end;
+      cursor_y = y;
+      x = end;
+    }
+#undef POSIX_CELL_EQ
+  }
+  tui_reset_dirty(context, height);
+
+  if (posixContext->out_len == 0) {
+    return TUI_SUCCESS; // nothing changed, not even a syscall
+  }
+  return posix_out_flush(posixContext);
 }
 
-TUI_Result linux_swap_buffers(TUI_Context *context) {
-  // TODO: Implement using ncurses or terminfo
-  // fprintf(stderr, "linux_swap_buffers not implemented yet!\n");
+// Keys are reported with Windows virtual key codes where they are plain
+// characters: letters upper case, Enter 13, Backspace 8, Escape 27, arrows
+// 0x25-0x28. Everything else is the byte itself.
+TUI_Result posix_get_event(TUI_Context *context, TUI_Event *event) {
+  PosixTUIContext *posixContext = (PosixTUIContext *)context;
+  event->pressed = false;
+  event->key.code = 0;
+  if (posixContext->in_fd < 0) {
+    return TUI_ERROR_INIT_FAILED;
+  }
+
+  struct pollfd pfd = {posixContext->in_fd, POLLIN, 0};
+  unsigned char buf[3];
+  if (poll(&pfd, 1, 0) <= 0 || read(posixContext->in_fd, buf, 1) != 1) {
+    return TUI_ERROR_INIT_FAILED; // no input available.
+  }
+
+  int code = buf[0];
+  if (code >= 'a' && code <= 'z') {
+    code -= 'a' - 'A';
+  } else if (code == '\n' || code == '\r') {
+    code = 13;
+  } else if (code == 0x7F) {
+    code = 8;
+  } else if (code == 27 && poll(&pfd, 1, 0) > 0 &&
+             read(posixContext->in_fd, buf + 1, 2) == 2 && buf[1] == '[') {
+    switch (buf[2]) {
+    case 'A': code = 0x26; break; // up
+    case 'B': code = 0x28; break; // down
+    case 'C': code = 0x27; break; // right
+    case 'D': code = 0x25; break; // left
+    default: break;
+    }
+  }
+  event->pressed = true;
+  event->key.code = code;
   return TUI_SUCCESS;
 }
-TUI_Result linux_get_event(TUI_Context *context, TUI_Event *event) {
-  // TODO: Implement using ncurses or terminfo
 
-  // fprintf(stderr, "linux_get_input not implemented.\n");
-  return TUI_ERROR_INIT_FAILED; // no input available.
-}
 // check if the tui is running
-bool linux_running(TUI_Context *context) {
-  LinuxTUIContext *linux_context = (LinuxTUIContext *)context;
-  return linux_context->running; // return if running or not
+bool posix_running(TUI_Context *context) {
+  PosixTUIContext *posix_context = (PosixTUIContext *)context;
+  return posix_context->running; // return if running or not
 }
 
 #else
@@ -347,8 +891,8 @@ bool linux_running(TUI_Context *context) {
 TUI_Result tui_init(TUI_Context **context, Clay_Dimensions dimensions) {
 #ifdef _WIN32
   return windows_init(context, dimensions);
-#elif defined(__linux__)
-  return linux_init(context, dimensions);
+#elif defined(__unix__) || defined(__APPLE__)
+  return posix_init(context, dimensions);
 #else
 #error "Unsupported platform"
 #endif
@@ -357,8 +901,8 @@ TUI_Result tui_init(TUI_Context **context, Clay_Dimensions dimensions) {
 void tui_free(TUI_Context *context) {
 #ifdef _WIN32
   windows_free(context);
-#elif defined(__linux__)
-  linux_free(context);
+#elif defined(__unix__) || defined(__APPLE__)
+  posix_free(context);
 #else
 #error "Unsupported platform"
 #endif
@@ -367,8 +911,8 @@ void tui_free(TUI_Context *context) {
 Clay_Dimensions tui_get_dimensions(TUI_Context *context) {
 #ifdef _WIN32
   return windows_get_dimensions(context);
-#elif defined(__linux__)
-  return linux_get_dimensions(context);
+#elif defined(__unix__) || defined(__APPLE__)
+  return posix_get_dimensions(context);
 #else
 #error "Unsupported platform"
 #endif
@@ -377,8 +921,8 @@ Clay_Dimensions tui_get_dimensions(TUI_Context *context) {
 TUI_Result tui_swap_buffers(TUI_Context *context) {
 #ifdef _WIN32
   return windows_swap_buffers(context);
-#elif defined(__linux__)
-  return linux_swap_buffers(context);
+#elif defined(__unix__) || defined(__APPLE__)
+  return posix_swap_buffers(context);
 #else
 #error "Unsupported platform"
 #endif
@@ -386,14 +930,14 @@ TUI_Result tui_swap_buffers(TUI_Context *context) {
 TUI_Result tui_get_event(TUI_Context *context, TUI_Event *event) {
 #ifdef _WIN32
   return windows_get_event(context, event);
-#elif defined(__linux__)
-  return linux_get_event(context, event);
+#elif defined(__unix__) || defined(__APPLE__)
+  return posix_get_event(context, event);
 #else
 #error "Unsupported Platform"
 #endif
 }
 
-// draw a string of cells.
+// draw a string of cells, one per UTF-8 encoded codepoint.
 TUI_Result tui_draw_string(TUI_Context *context, int x, int y, const char *str,
                            uint8_t fg, uint8_t bg) {
   if (!context || !str) {
@@ -401,14 +945,14 @@ TUI_Result tui_draw_string(TUI_Context *context, int x, int y, const char *str,
   }
 
   Clay_Dimensions dimensions = tui_get_dimensions(context);
-  int len = strlen(str);
+  const unsigned char *next = (const unsigned char *)str;
 
-  for (int i = 0; i < len; i++) {
+  for (int i = 0; *next; i++) {
     if (x + i >= dimensions.width) {
       break; // prevent drawing out of bounds.
     }
-    TUI_Result result =
-        tui_draw_cell(context, x + i, y, (TUI_Cell){str[i], fg, bg});
+    uint32_t ch = tui_utf8_decode(&next);
+    TUI_Result result = tui_draw_cell(context, x + i, y, (TUI_Cell){ch, fg, bg});
     if (result != TUI_SUCCESS) {
       return result; // Propagate the error
     }
@@ -418,8 +962,8 @@ TUI_Result tui_draw_string(TUI_Context *context, int x, int y, const char *str,
 bool tui_running(TUI_Context *context) {
 #ifdef _WIN32
   return windows_running(context);
-#elif defined(__linux__)
-  return linux_running(context);
+#elif defined(__unix__) || defined(__APPLE__)
+  return posix_running(context);
 #else
 #error "Unsupported Platform"
 #endif
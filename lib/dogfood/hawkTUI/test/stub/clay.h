@@ -0,0 +1,10 @@
+// test/stub/clay.h - The one Clay type hawkTUI.h uses, so the headless
+// targets build without a copy of clay.h. Use the real clay.h everywhere else.
+#ifndef CLAY_HEADER
+#define CLAY_HEADER
+
+typedef struct {
+  float width, height;
+} Clay_Dimensions;
+
+#endif
@@ -0,0 +1,138 @@
+// test/test_headless.c - Test the POSIX backend without a terminal: the ANSI
+// output of every frame goes to a file and is fed to the emulator of vt.h,
+// whose screen must then show exactly what was drawn. Also checks how many
+// bytes and escape sequences small updates cost.
+#define HAWKTUI_IMPLEMENTATION
+#include "../src/hawkTUI.h"
+#define VT_IMPLEMENTATION
+#include "vt.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// the vt.h color the palette of the backend gives a console color
+static int vt_color(int color) {
+  return (color & 8) + posix_ansi_color(color);
+}
+
+// swap, then feed the emulator what the swap wrote
+static void swap(TUI_Context *context, Vt *vt, int rfd) {
+  vt_stats_reset(vt);
+  assert(tui_swap_buffers(context) == TUI_SUCCESS);
+  assert(vt_feed_fd(vt, rfd));
+}
+
+static void check_screen(TUI_Context *context, Vt *vt) {
+  for (int y = 0; y < vt->height; y++) {
+    for (int x = 0; x < vt->width; x++) {
+      int i = y * vt->width + x;
+      Vt_Cell cell = vt_cell(vt, x, y);
+      if (cell.ch != context->glyphs[i] ||
+          cell.fg != vt_color(TUI_ATTR_FG(context->attrs[i])) ||
+          cell.bg != vt_color(TUI_ATTR_BG(context->attrs[i]))) {
+        fprintf(stderr,
+                "cell %d,%d: screen has U+%04X %d/%d, drew U+%04X %d/%d\n", x,
+                y, cell.ch, cell.fg, cell.bg, context->glyphs[i],
+                TUI_ATTR_FG(context->attrs[i]), TUI_ATTR_BG(context->attrs[i]));
+        exit(1);
+      }
+    }
+  }
+}
+
+int run_test(int width, int height) {
+  char path[] = "/tmp/hawkTUI_test_XXXXXX";
+  int wfd = mkstemp(path);
+  assert(wfd >= 0);
+  int rfd = open(path, O_RDONLY);
+  assert(rfd >= 0);
+  unlink(path);
+
+  TUI_Context *context = NULL;
+  assert(tui_init_fds(&context, (Clay_Dimensions){width, height}, -1, wfd) ==
+         TUI_SUCCESS);
+  Vt vt;
+  assert(vt_init(&vt, width, height));
+
+  // the first frame draws every cell
+  tui_clear(context);
+  tui_draw_string(context, 0, 0, "Hello, h\xc3\xa9\xe2\x82\xac!", 14, 1);
+  swap(context, &vt, rfd);
+  check_screen(context, &vt);
+  char row[256];
+  vt_row_text(&vt, 0, row, sizeof(row));
+  assert(strcmp(row, "Hello, h\xc3\xa9\xe2\x82\xac!") == 0);
+  assert(vt.stats.printed == (size_t)(width * height));
+  assert(vt.stats.unknown == 0);
+
+  // nothing drawn, nothing sent
+  swap(context, &vt, rfd);
+  assert(vt.stats.bytes == 0);
+
+  // redrawing the same is free too
+  tui_draw_string(context, 0, 0, "Hello", 14, 1);
+  swap(context, &vt, rfd);
+  assert(vt.stats.bytes == 0);
+
+  // one cell: a cursor move, its colors and the glyph
+  tui_draw_cell(context, width - 1, height - 1, (TUI_Cell){'#', 10, 0});
+  swap(context, &vt, rfd);
+  check_screen(context, &vt);
+  assert(vt.stats.printed == 1);
+  assert(vt.stats.cursor_moves == 1);
+  assert(vt.stats.sgrs == 1);
+  assert(vt.stats.escapes == 2);
+
+  // the same colors twice on a row: one run, one SGR
+  tui_draw_string(context, 2, 3, "ab", 7, 0);
+  tui_draw_string(context, 6, 3, "cd", 7, 0);
+  swap(context, &vt, rfd);
+  check_screen(context, &vt);
+  assert(vt.stats.cursor_moves == 1 && vt.stats.sgrs == 1);
+
+  // what is not one column wide would put the terminal out of step with the
+  // front buffer: drawn as U+FFFD, one column like the rest
+  tui_draw_string(context, 0, 2, "\xe4\xb8\xad|e\xcc\x81|\xf0\x9f\x98\x80|", 7, 0);
+  swap(context, &vt, rfd);
+  check_screen(context, &vt);
+  vt_row_text(&vt, 2, row, sizeof(row));
+  assert(strcmp(row, "\xef\xbf\xbd|e\xef\xbf\xbd|\xef\xbf\xbd|") == 0);
+
+  // random frames, some of them cleared first
+  srand(42);
+  for (int frame = 0; frame < 200; frame++) {
+    if (frame % 10 == 0) {
+      tui_clear(context);
+    }
+    int draws = rand() % (frame % 7 == 0 ? width * height : 64);
+    for (int n = 0; n < draws; n++) {
+      static const uint32_t glyphs[] = {'a',    'Z',    ' ',    '|',
+                                        0xE9,   0x2500, 0x4E2D, 0x0301,
+                                        0x1F600};
+      TUI_Cell cell = {glyphs[rand() % 9], (uint8_t)(rand() % 16),
+                       (uint8_t)(rand() % 16)};
+      tui_draw_cell(context, rand() % width, rand() % height, cell);
+    }
+    swap(context, &vt, rfd);
+    check_screen(context, &vt);
+    assert(vt.stats.unknown == 0);
+  }
+
+  vt_free(&vt);
+  tui_free(context);
+  close(rfd);
+  close(wfd);
+  return 0;
+}
+
+int main() {
+  int small_result = run_test(80, 24);
+  int large_result = run_test(300, 100);
+  if (small_result || large_result) {
+    return 1;
+  }
+  printf("All tests passed!\n");
+  return 0;
+}
@@ -24,35 +24,51 @@ int run_test(Clay_Dimensions dimensions) {
     fprintf(stderr, "tui_clear failed\n");
     return 1;
   }
-  assert(context->buffer[0].ch == ' '); // check to ensure that it is empty
+  // check to ensure that it is empty: the rows are only marked blank, and
+  // filled in by the first draw into them
+  assert(context->cleared[0] & 1);
+  tui_fill_row(context, (int)dimensions.width, 0);
+  assert(context->glyphs[0] == ' ');
+  assert(context->attrs[0] == TUI_ATTR(7, 0));
 
   // draw string test
   if (tui_draw_string(context, 0, 0, "Hello", 7, 0) != TUI_SUCCESS) {
     fprintf(stderr, "tui_draw_string test failed\n");
   }
-  assert(context->buffer[0].ch == 'H');
-  assert(context->buffer[1].ch == 'e');
-  assert(context->buffer[2].ch == 'l');
-  assert(context->buffer[3].ch == 'l');
-  assert(context->buffer[4].ch == 'o');
+  assert(context->glyphs[0] == 'H');
+  assert(context->glyphs[1] == 'e');
+  assert(context->glyphs[2] == 'l');
+  assert(context->glyphs[3] == 'l');
+  assert(context->glyphs[4] == 'o');
 
   // draw string out of bounds test
   if (tui_draw_string(context, dimensions.width - 2, 0, "Hello", 7, 0) ==
       TUI_SUCCESS) {
-    assert(context->buffer[(int)dimensions.width - 2].ch ==
+    assert(context->glyphs[(int)dimensions.width - 2] ==
            'H'); // assert first two chars exist
-    assert(context->buffer[(int)dimensions.width - 1].ch == 'e');
-    assert(context->buffer[(int)dimensions.width].ch !=
+    assert(context->glyphs[(int)dimensions.width - 1] == 'e');
+    assert(context->glyphs[(int)dimensions.width] !=
            'l'); // ensure that it does not write out of bounds
   }
 
   // draw string to second line
   if (tui_draw_string(context, 0, 1, "World", 7, 0) == TUI_SUCCESS) {
-    assert(context->buffer[(int)dimensions.width].ch == 'W');
-    assert(context->buffer[(int)dimensions.width + 1].ch == 'o');
-    assert(context->buffer[(int)dimensions.width + 2].ch == 'r');
-    assert(context->buffer[(int)dimensions.width + 3].ch == 'l');
-    assert(context->buffer[(int)dimensions.width + 4].ch == 'd');
+    assert(context->glyphs[(int)dimensions.width] == 'W');
+    assert(context->glyphs[(int)dimensions.width + 1] == 'o');
+    assert(context->glyphs[(int)dimensions.width + 2] == 'r');
+    assert(context->glyphs[(int)dimensions.width + 3] == 'l');
+    assert(context->glyphs[(int)dimensions.width + 4] == 'd');
+  }
+
+  // UTF-8 strings take a cell per codepoint
+  int row = 2 * (int)dimensions.width;
+  if (tui_draw_string(context, 0, 2, "h\xc3\xa9\xe2\x82\xac!", 12, 1) ==
+      TUI_SUCCESS) {
+    assert(context->glyphs[row] == 'h');
+    assert(context->glyphs[row + 1] == 0xE9);   // e acute
+    assert(context->glyphs[row + 2] == 0x20AC); // euro sign
+    assert(context->glyphs[row + 3] == '!');
+    assert(context->attrs[row + 3] == TUI_ATTR(12, 1));
   }
 
   // draw single char test.
@@ -60,11 +76,30 @@ int run_test(Clay_Dimensions dimensions) {
     fprintf(stderr, "tui_draw_cell test failed.\n");
     return 1;
   }
-  assert(context->buffer[5 * (int)dimensions.width].ch == '!');
+  assert(context->glyphs[5 * (int)dimensions.width] == '!');
+
+  // after a swap only what gets drawn is dirty, and redrawing the same is not
+  int height = (int)dimensions.height;
+  tui_swap_buffers(context);
+  assert(tui_next_dirty_row(context, height, 0) == -1);
+  tui_draw_cell(context, 5, 7, (TUI_Cell){'#', 7, 0});
+  tui_draw_cell(context, 3, 7, (TUI_Cell){'#', 7, 0});
+  tui_draw_cell(context, 0, 0, (TUI_Cell){'H', 7, 0});
+  assert(tui_next_dirty_row(context, height, 0) == 7);
+  assert(tui_next_dirty_row(context, height, 8) == -1);
+  assert(context->dirty_x0[7] == 3 && context->dirty_x1[7] == 6);
+
+  // tui_clear() leaves the cells alone until they are needed
+  tui_swap_buffers(context);
+  tui_clear(context);
+  assert(context->glyphs[0] == 'H');
+  assert(tui_next_dirty_row(context, height, 0) == 0);
+  assert(tui_next_dirty_row(context, height, height - 1) == height - 1);
+  tui_draw_cell(context, 1, 0, (TUI_Cell){'i', 7, 0});
+  assert(context->glyphs[0] == ' ' && context->glyphs[1] == 'i');
 
   // Test tui_free
   tui_free(context);
-  printf("All tests passed!\n");
   return 0;
 }
 
@@ -73,5 +108,9 @@ int main() {
   // test small window
   int small_result = run_test((Clay_Dimensions){80, 24});
   int large_result = run_test((Clay_Dimensions){500, 500});
-  return small_result || large_result;
+  if (small_result || large_result) {
+    return 1;
+  }
+  printf("All tests passed!\n");
+  return 0;
 }
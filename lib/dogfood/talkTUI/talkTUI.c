@@ -1,6 +1,8 @@
 // YOUR ONLY CONCERN RIGHT NOW IS RENDERING SHAPES IN THE TERMINAL ON A WINDOWS
 // DEVICE FOR THE LOVE OF GOD STOP SCOPE CREEPING
 
+#include <stdint.h>
+
 typedef void (*func)();
 
 typedef struct {
@@ -39,17 +41,29 @@ typedef struct {
 
 // color temporarily set to
 typedef struct {
-  int id;       // used to keep track of str order
-  char Glyph;   // utf-8 character
   RGB_Color FG; // character color
   RGB_Color BG; // window color
-} Cell;
+} Cell_Colors;
+
+// every color pair in use, cells refer to one by its index
+typedef struct {
+  int Count;
+  Cell_Colors Colors[256];
+} Palette;
+
+// The cells of a rectangle, one array per field: 5 bytes a cell instead of
+// an id and two RGB_Colors (40 bytes), so clearing is a fill and diffing a
+// memcmp. The index of a cell keeps track of str order.
+typedef struct {
+  uint32_t *Glyphs; // unicode codepoints
+  uint8_t *Colors;  // index into the Palette
+} Cells;
 
 typedef struct {
   int id;    // unique id of a rectangle container
   Dim Start; // starting point of a rectangle relative to the origin
   Dim Size;  // size of a rectangle relative to its origin
-  Cell *Contents[];
+  Cells Contents;
 } Rect;
 
 /* Additional Properties
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <threads.h>
 
 #include <sys/mman.h>
@@ -15,7 +16,18 @@
 
 #define da_last(da) (NOB_ASSERT((da)->count > 0), (da)->items[(da)->count-1])
 
-#define GENERATOR_STACK_CAPACITY (1024*getpagesize())
+#ifndef GENERATOR_STACK_SIZE
+#define GENERATOR_STACK_SIZE (1024*getpagesize())
+#endif
+
+// Destroyed generators kept per size class and thread for reuse. The ones
+// beyond that are unmapped right away.
+#ifndef GENERATOR_POOL_HOT
+#define GENERATOR_POOL_HOT 16
+#endif
+
+// Stack sizes are rounded up to page_size << class
+#define GENERATOR_STACK_CLASSES 32
 
 typedef struct {
     Generator **items;
@@ -24,6 +36,7 @@ typedef struct {
 } Generator_Stack;
 
 thread_local Generator_Stack generator_stack = {0};
+thread_local Generator_Stack generator_pools[GENERATOR_STACK_CLASSES] = {0};
 
 void generator_init(void)
 {
@@ -33,9 +46,20 @@ void generator_init(void)
     da_append(&generator_stack, g);
 }
 
+// The context switching primitives, all the @arch places are here
+void generator_restore_context(void *rsp);
+void generator_restore_context_with_return(void *rsp, void *arg);
+void generator_switch_context(Generator *g, void *arg, void *rsp);
+void generator_return(void *arg, void *rsp);
+void generator__finish_current(void);
+
+#if defined(__x86_64__)
 // Linux x86_64 call convention
 // %rdi, %rsi, %rdx, %rcx, %r8, and %r9
 
+// The first argument of a fresh generator, counting from the top of its stack
+#define GENERATOR_ARG_SLOT 3
+
 void* __attribute__((naked)) generator_next(Generator *g, void *arg)
 {
     UNUSED(g);
@@ -88,23 +112,6 @@ void __attribute__((naked)) generator_restore_context_with_return(void *rsp, voi
     "    ret\n");
 }
 
-void generator_switch_context(Generator *g, void *arg, void *rsp)
-{
-    da_last(&generator_stack)->rsp = rsp;
-    da_append(&generator_stack, g);
-    if (g->fresh) {
-        g->fresh = false;
-        // ******************************
-        // ^                          ^rsp
-        // stack_base
-        void **rsp = (void**)((char*)g->stack_base + GENERATOR_STACK_CAPACITY);
-        *(rsp-3) = arg;
-        generator_restore_context(g->rsp);
-    } else {
-        generator_restore_context_with_return(g->rsp, arg);
-    }
-}
-
 void *__attribute__((naked)) generator_yield(void *arg)
 {
     UNUSED(arg);
@@ -121,6 +128,132 @@ void *__attribute__((naked)) generator_yield(void *arg)
     "    jmp generator_return\n");
 }
 
+// The frame generator_restore_context() starts f from, right below top
+static void *generator__frame(void *top, void (*f)(void*))
+{
+    void **rsp = top;
+    *(--rsp) = generator__finish_current;
+    *(--rsp) = f;
+    *(--rsp) = 0;   // push rdi
+    *(--rsp) = 0;   // push rbx
+    *(--rsp) = 0;   // push rbp
+    *(--rsp) = 0;   // push r12
+    *(--rsp) = 0;   // push r13
+    *(--rsp) = 0;   // push r14
+    *(--rsp) = 0;   // push r15
+    return rsp;
+}
+#elif defined(__aarch64__)
+// Same frame layout as the aarch64 one in coroutine.c: x19-x30, d8-d15 and x0
+// in 176 bytes. gcc does not support naked functions on aarch64, so these are
+// plain asm.
+#define GENERATOR__SAVE                 \
+    "    sub sp, sp, #176\n"            \
+    "    stp x19, x20, [sp, #0]\n"      \
+    "    stp x21, x22, [sp, #16]\n"     \
+    "    stp x23, x24, [sp, #32]\n"     \
+    "    stp x25, x26, [sp, #48]\n"     \
+    "    stp x27, x28, [sp, #64]\n"     \
+    "    stp x29, x30, [sp, #80]\n"     \
+    "    stp d8, d9, [sp, #96]\n"       \
+    "    stp d10, d11, [sp, #112]\n"    \
+    "    stp d12, d13, [sp, #128]\n"    \
+    "    stp d14, d15, [sp, #144]\n"    \
+    "    str x0, [sp, #160]\n"
+
+#define GENERATOR__RESTORE              \
+    "    mov sp, x0\n"                  \
+    "    ldp x19, x20, [sp, #0]\n"      \
+    "    ldp x21, x22, [sp, #16]\n"     \
+    "    ldp x23, x24, [sp, #32]\n"     \
+    "    ldp x25, x26, [sp, #48]\n"     \
+    "    ldp x27, x28, [sp, #64]\n"     \
+    "    ldp x29, x30, [sp, #80]\n"     \
+    "    ldp d8, d9, [sp, #96]\n"       \
+    "    ldp d10, d11, [sp, #112]\n"    \
+    "    ldp d12, d13, [sp, #128]\n"    \
+    "    ldp d14, d15, [sp, #144]\n"
+
+#define GENERATOR__FUNCTION(name)     \
+    "    .global " name "\n"          \
+    "    .type " name ", %function\n" \
+    "    .p2align 4\n"                \
+    name ":\n"
+
+// generator_next() checks g->dead before switching
+static_assert(offsetof(Generator, dead) == 16, "update the ldrb in generator_next");
+
+// The first argument of a fresh generator, counting from the top of its stack
+#define GENERATOR_ARG_SLOT 2
+
+asm(
+"    .pushsection .text\n"
+GENERATOR__FUNCTION("generator_next")
+"    ldrb w9, [x0, #16]\n"       // g->dead
+"    cbz w9, 1f\n"
+"    mov x0, #0\n"
+"    ret\n"
+"1:\n"
+GENERATOR__SAVE
+"    mov x2, sp\n"               // rsp
+"    b generator_switch_context\n"
+
+GENERATOR__FUNCTION("generator_restore_context")
+GENERATOR__RESTORE
+"    ldr x0, [sp, #160]\n"
+"    add sp, sp, #176\n"
+"    ret\n"
+
+GENERATOR__FUNCTION("generator_restore_context_with_return")
+GENERATOR__RESTORE
+"    mov x0, x1\n"
+"    add sp, sp, #176\n"
+"    ret\n"
+
+GENERATOR__FUNCTION("generator_yield")
+GENERATOR__SAVE
+"    mov x1, sp\n"               // rsp
+"    b generator_return\n"
+
+// A fresh frame returns here with f in x19 and the argument in x0
+GENERATOR__FUNCTION("generator__start")
+"    blr x19\n"
+"    b generator__finish_current\n"
+"    .popsection\n"
+);
+
+void generator__start(void);
+
+// The frame generator_restore_context() starts f from, right below top
+static void *generator__frame(void *top, void (*f)(void*))
+{
+    void **rsp = (void**)((char*)top - 176);
+    memset(rsp, 0, 176);
+    rsp[0] = f;                 // x19
+    rsp[11] = generator__start; // x30
+    return rsp;
+}
+#else
+#error "generator.c only supports x86_64 and aarch64"
+#endif // __x86_64__
+
+void generator_switch_context(Generator *g, void *arg, void *rsp)
+{
+    da_last(&generator_stack)->rsp = rsp;
+    da_append(&generator_stack, g);
+    if (g->fresh) {
+        g->fresh = false;
+        // ******************************
+        // ^                          ^rsp
+        // stack_base
+        void **rsp = (void**)((char*)g->stack_base + g->stack_size);
+        *(rsp-GENERATOR_ARG_SLOT) = arg;
+        generator_restore_context(g->rsp);
+    } else {
+        generator_restore_context_with_return(g->rsp, arg);
+    }
+}
+
 void generator_return(void *arg, void *rsp)
 {
     da_last(&generator_stack)->rsp = rsp;
@@ -128,38 +261,116 @@ void generator_return(void *arg, void *rsp)
     generator_restore_context_with_return(da_last(&generator_stack)->rsp, arg);
 }
 
+// Entered by ret from the generator function, on x86_64 with the stack off by 8
+// bytes
+#ifdef __x86_64__
+__attribute__((force_align_arg_pointer))
+#endif // __x86_64__
 void generator__finish_current(void)
 {
+    // Hand over what is left of the batch before dying, so foreach can stop
+    // as soon as the generator is dead
+    if (da_last(&generator_stack)->batch_count > 0) generator_yield(NULL);
     da_last(&generator_stack)->dead = true;
     generator_stack.count -= 1;
     generator_restore_context_with_return(da_last(&generator_stack)->rsp, NULL);
 }
 
+static size_t generator__stack_class(size_t size)
+{
+    size_t page_size = getpagesize();
+    size_t class = 0;
+    while ((page_size << class) < size) class += 1;
+    assert(class < GENERATOR_STACK_CLASSES && "Generator stack is too big");
+    return class;
+}
+
 Generator *generator_create(void (*f)(void*))
 {
+    return generator_create_sized(f, GENERATOR_STACK_SIZE);
+}
+
+Generator *generator_create_sized(void (*f)(void*), size_t stack_size)
+{
+    Generator_Stack *pool = &generator_pools[generator__stack_class(stack_size)];
+    if (pool->count > 0) {
+        Generator *g = pool->items[--pool->count];
+        generator_batch(g, NULL, 0);
+        generator_reset(g, f);
+        return g;
+    }
+
     Generator *g = malloc(sizeof(Generator));
     assert(g != NULL && "Buy more RAM lol");
     memset(g, 0, sizeof(*g));
 
-    g->stack_base = mmap(NULL, GENERATOR_STACK_CAPACITY, PROT_WRITE|PROT_READ, MAP_PRIVATE|MAP_STACK|MAP_ANONYMOUS|MAP_GROWSDOWN, -1, 0);
-    assert(g->stack_base != MAP_FAILED);
-    void **rsp = (void**)((char*)g->stack_base + GENERATOR_STACK_CAPACITY);
-    *(--rsp) = generator__finish_current;
-    *(--rsp) = f;
-    *(--rsp) = 0;   // push rdi
-    *(--rsp) = 0;   // push rbx
-    *(--rsp) = 0;   // push rbp
-    *(--rsp) = 0;   // push r12
-    *(--rsp) = 0;   // push r13
-    *(--rsp) = 0;   // push r14
-    *(--rsp) = 0;   // push r15
-    g->rsp = rsp;
-    g->fresh = true;
+    size_t page_size = getpagesize();
+    g->stack_size = page_size << generator__stack_class(stack_size);
+    char *mapping = mmap(NULL, page_size + g->stack_size, PROT_WRITE|PROT_READ, MAP_PRIVATE|MAP_STACK|MAP_ANONYMOUS, -1, 0);
+    assert(mapping != MAP_FAILED);
+    // Overflowing the stack hits the guard page instead of somebody else's memory
+    int result = mprotect(mapping, page_size, PROT_NONE);
+    assert(result == 0);
+    UNUSED(result);
+    g->stack_base = mapping + page_size;
+    generator_reset(g, f);
     return g;
 }
 
-void generator_destroy(Generator *g)
+void generator_reset(Generator *g, void (*f)(void*))
+{
+    if (f != NULL) g->f = f;
+    g->rsp = generator__frame((char*)g->stack_base + g->stack_size, g->f);
+    g->dead = false;
+    g->fresh = true;
+    g->batch_count = 0;
+    g->batch_index = 0;
+}
+
+void generator_batch(Generator *g, void **items, size_t capacity)
+{
+    assert((items == NULL) == (capacity == 0));
+    g->batch = items;
+    g->batch_capacity = capacity;
+    g->batch_count = 0;
+    g->batch_index = 0;
+}
+
+void generator_yield_batched(void *item)
+{
+    Generator *g = da_last(&generator_stack);
+    if (g->batch == NULL) {
+        generator_yield(item);
+        return;
+    }
+    g->batch[g->batch_count++] = item;
+    if (g->batch_count == g->batch_capacity) generator_yield(NULL);
+}
+
+static void generator__unmap(Generator *g)
 {
-    munmap(g->stack_base, GENERATOR_STACK_CAPACITY);
+    size_t page_size = getpagesize();
+    munmap((char*)g->stack_base - page_size, page_size + g->stack_size);
     free(g);
 }
+
+void generator_destroy(Generator *g)
+{
+    Generator_Stack *pool = &generator_pools[generator__stack_class(g->stack_size)];
+    static const size_t pool_hot = GENERATOR_POOL_HOT; // may be 0
+    if (pool->count < pool_hot) {
+        da_append(pool, g);
+    } else {
+        generator__unmap(g);
+    }
+}
+
+void generator_pool_trim(void)
+{
+    for (size_t i = 0; i < GENERATOR_STACK_CLASSES; ++i) {
+        Generator_Stack *pool = &generator_pools[i];
+        for (size_t j = 0; j < pool->count; ++j) generator__unmap(pool->items[j]);
+        free(pool->items);
+        *pool = (Generator_Stack){0};
+    }
+}
@@ -2,20 +2,68 @@
 #define GENERATOR_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct {
     void *rsp;
     void *stack_base;
     bool dead;
     bool fresh;
+    size_t stack_size;
+    void (*f)(void*);
+    // See generator_batch()
+    void **batch;
+    size_t batch_capacity;
+    size_t batch_count;
+    size_t batch_index;
 } Generator;
 
 void generator_init(void);
 void* generator_next(Generator *g, void *arg);
 void* generator_yield(void *arg);
+// The stack is GENERATOR_STACK_SIZE (1024 pages unless defined otherwise when
+// compiling generator.c) with a guard page below it.
 Generator *generator_create(void (*f)(void*));
+// Same with a stack of at least `stack_size` bytes, rounded up to a power of
+// two pages.
+Generator *generator_create_sized(void (*f)(void*), size_t stack_size);
+// Re-arm the generator to start over with f (or with the function it was
+// created with if f is NULL) on the next generator_next(). Works on finished
+// and suspended generators alike, but not from inside of the generator itself.
+// Does not allocate anything.
+void generator_reset(Generator *g, void (*f)(void*));
+// The generator and its stack go to a pool of the calling thread and are
+// reused by the next generator_create*() of the same size on that thread.
 void generator_destroy(Generator *g);
+// Give the memory of the pooled generators of the calling thread back to the OS.
+void generator_pool_trim(void);
 
-#define foreach(it, g, arg) for (void *it = generator_next(g, arg); !(g)->dead; it = generator_next(g, arg))
+// Have generator_yield_batched() collect up to `capacity` items in `items`
+// and only switch back once the buffer is full or the generator has finished,
+// instead of once per item. NULL goes back to a switch per item, dropping the
+// items of the current batch that were not handed out yet. foreach iterates
+// over the batches item by item either way.
+void generator_batch(Generator *g, void **items, size_t capacity);
+// Hand out an item from inside of the generator. Same as generator_yield()
+// unless generator_batch() gave the generator a buffer, in which case it
+// usually does not switch at all. Items can not receive an argument back.
+void generator_yield_batched(void *item);
+
+// The next item for foreach: straight from generator_next(), or from the
+// current batch, resuming the generator for the next one when it runs out.
+static inline void *generator__each(Generator *g, void *arg)
+{
+    if (g->batch == NULL) return generator_next(g, arg);
+    if (g->batch_index >= g->batch_count) {
+        g->batch_index = 0;
+        g->batch_count = 0;
+        // A generator never finishes with items left in its batch
+        generator_next(g, arg);
+        if (g->batch_count == 0) return NULL;
+    }
+    return g->batch[g->batch_index++];
+}
+
+#define foreach(it, g, arg) for (void *it = generator__each(g, arg); !(g)->dead; it = generator__each(g, arg))
 
 #endif // GENERATOR_H_
@@ -0,0 +1,509 @@
+// test/arena_test.c - Test region reuse of arena_alloc() together with
+// arena_snapshot(), arena_rewind(), arena_reset() and arena_trim(), and when
+// arena_realloc() grows in place or copies. Hammer a
+// Region_Pool from several threads, directly and through arena_thread(). With
+// -DARENA_STATS check the counters, the fill histogram and the JSON dump.
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t count_regions(Arena *a)
+{
+    size_t n = 0;
+    for (Region *r = a->begin; r != NULL; r = r->next) n += 1;
+    return n;
+}
+
+// Check the invariants of the region list and the free-region index
+static void check_arena(Arena *a)
+{
+    size_t indexed = 0;
+    bool after_end = false;
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        if (r->next != NULL) assert(r->seq < r->next->seq);
+        if (r->next == NULL) assert(a->last == r);
+        if (after_end) assert(r->count == 0);
+        if (r == a->end) {
+            assert(r->free_bucket == ARENA__NOT_INDEXED);
+            after_end = true;
+        } else if (r->count < r->capacity) {
+            assert(r->free_bucket == arena__bucket(r->capacity - r->count));
+            indexed += 1;
+        } else {
+            assert(r->free_bucket == ARENA__NOT_INDEXED);
+        }
+    }
+    assert(a->end == NULL || after_end);
+
+    size_t listed = 0;
+    for (size_t b = 0; b < ARENA_FREE_BUCKETS; ++b) {
+        for (Region *r = a->free[b]; r != NULL; r = r->free_next) {
+            assert(r->free_bucket == b);
+            if (r->free_next) assert(r->free_next->free_prev == r);
+            listed += 1;
+        }
+    }
+    assert(listed == indexed);
+}
+
+static void test_rewind_reuses_regions(void)
+{
+    Arena a = {0};
+    arena_alloc(&a, 16);
+    Arena_Mark m = arena_snapshot(&a);
+    void *first = arena_alloc(&a, 100);
+    for (int i = 0; i < 1000; ++i) arena_alloc(&a, 1000);
+    size_t regions = count_regions(&a);
+    check_arena(&a);
+
+    arena_rewind(&a, m);
+    check_arena(&a);
+    assert(a.end == m.region && a.end->count == m.count);
+    assert(arena_alloc(&a, 100) == first);
+
+    // Big allocations after the rewind are served from the emptied regions
+    // without asking for new ones
+    for (int i = 0; i < 1000; ++i) arena_alloc(&a, 1000);
+    assert(count_regions(&a) == regions);
+    check_arena(&a);
+    arena_free(&a);
+}
+
+static void test_partial_region_is_reused(void)
+{
+    Arena a = {0};
+    // Leave 100 words free in the first region, whatever size the backend
+    // made it, then force a new one
+    arena_alloc(&a, sizeof(uintptr_t));
+    Region *first = a.end;
+    arena_alloc(&a, (first->capacity - first->count - 100)*sizeof(uintptr_t));
+    arena_alloc(&a, 200*sizeof(uintptr_t));
+    assert(a.end != first);
+    check_arena(&a);
+
+    // Fill the current region, the next small allocation fits into the tail
+    // of the first region
+    Region *second = a.end;
+    arena_alloc(&a, (second->capacity - second->count)*sizeof(uintptr_t));
+    uintptr_t *p = (uintptr_t*)arena_alloc(&a, 50*sizeof(uintptr_t));
+    assert(p == &first->data[first->capacity - 100]);
+    assert(a.end == second);
+    check_arena(&a);
+    arena_free(&a);
+}
+
+static void test_rewind_keeps_indexed_allocations(void)
+{
+    Arena a = {0};
+    arena_alloc(&a, sizeof(uintptr_t));
+    Region *first = a.end;
+    arena_alloc(&a, (first->capacity - first->count - 100)*sizeof(uintptr_t));
+    arena_alloc(&a, 200*sizeof(uintptr_t));
+    Region *second = a.end;
+    arena_alloc(&a, (second->capacity - second->count)*sizeof(uintptr_t));
+
+    // An allocation after the mark that lands in the tail of the first region
+    // survives the rewind, only what was bumped from `end` on is reclaimed
+    Arena_Mark m = arena_snapshot(&a);
+    uintptr_t *p = (uintptr_t*)arena_alloc(&a, 50*sizeof(uintptr_t));
+    assert(p == &first->data[first->capacity - 100]);
+    arena_alloc(&a, 60*sizeof(uintptr_t));
+    Region *third = a.end;
+    assert(third != second && third->count == 60);
+
+    arena_rewind(&a, m);
+    check_arena(&a);
+    assert(a.end == second && second->count == second->capacity);
+    assert(third->count == 0);
+    assert(first->count == first->capacity - 50);
+
+    // arena_reset() takes everything back
+    arena_reset(&a);
+    check_arena(&a);
+    assert(first->count == 0);
+    arena_free(&a);
+}
+
+static void test_trim_drops_indexed_regions(void)
+{
+    Arena a = {0};
+    Arena_Mark m = arena_snapshot(&a);
+    arena_alloc(&a, 8);
+    Arena_Mark m2 = arena_snapshot(&a);
+    for (int i = 0; i < 100; ++i) arena_alloc(&a, 10000);
+    arena_rewind(&a, m2);
+    arena_trim(&a);
+    check_arena(&a);
+    assert(count_regions(&a) == 1);
+    for (size_t b = 0; b < ARENA_FREE_BUCKETS; ++b) assert(a.free[b] == NULL);
+
+    for (int i = 0; i < 100; ++i) arena_alloc(&a, 10000);
+    check_arena(&a);
+    arena_rewind(&a, m);
+    check_arena(&a);
+    assert(a.end == a.begin && a.end->count == 0);
+    arena_free(&a);
+}
+
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+    unsigned char tag;
+} Block;
+
+// Random allocations, nested snapshots, rewinds, trims and resets. All the
+// blocks that are still alive must keep their contents.
+static void test_random_operations(void)
+{
+    enum { BLOCKS_CAP = 1024, MARKS_CAP = 64 };
+    static Block blocks[BLOCKS_CAP];
+    size_t blocks_count = 0;
+    Arena_Mark marks[MARKS_CAP];
+    size_t marks_blocks[MARKS_CAP];
+    size_t marks_count = 0;
+
+    Arena a = {0};
+    srand(420);
+    for (int step = 0; step < 20000; ++step) {
+        int op = rand()%100;
+        if (op < 80 && blocks_count < BLOCKS_CAP) {
+            size_t size = rand()%16 == 0 ? 1 + rand()%(80*1024) : 1 + rand()%256;
+            Block b = {(unsigned char*)arena_alloc(&a, size), size, (unsigned char)step};
+            memset(b.ptr, b.tag, b.size);
+            blocks[blocks_count++] = b;
+        } else if (op < 88 && marks_count < MARKS_CAP) {
+            marks_blocks[marks_count] = blocks_count;
+            marks[marks_count++] = arena_snapshot(&a);
+        } else if (op < 96 && marks_count > 0) {
+            marks_count -= 1;
+            arena_rewind(&a, marks[marks_count]);
+            blocks_count = marks_blocks[marks_count];
+        } else if (op < 98 && a.end != NULL) {
+            arena_trim(&a);
+        } else if (op < 99) {
+            arena_reset(&a);
+            blocks_count = 0;
+            marks_count = 0;
+        }
+
+        check_arena(&a);
+        if (step%64 != 0) continue;
+        for (size_t i = 0; i < blocks_count; ++i) {
+            for (size_t j = 0; j < blocks[i].size; ++j) {
+                assert(blocks[i].ptr[j] == blocks[i].tag);
+            }
+        }
+    }
+    arena_free(&a);
+}
+
+static void fill(void *p, size_t size, int seed)
+{
+    for (size_t i = 0; i < size; ++i) ((unsigned char*)p)[i] = (unsigned char)(seed + i);
+}
+
+static bool filled(const void *p, size_t size, int seed)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (((const unsigned char*)p)[i] != (unsigned char)(seed + i)) return false;
+    }
+    return true;
+}
+
+static void test_realloc(void)
+{
+    Arena a = {0};
+
+    // The last allocation of `end` grows in place as long as the region has
+    // room, shrinking never moves
+    char *p = (char*)arena_alloc(&a, 100);
+    fill(p, 100, 1);
+    Region *r = a.end;
+    assert(arena_realloc(&a, p, 100, 1000) == p);
+    assert(a.end == r && &r->data[r->count] == (uintptr_t*)(p + 1000));
+    assert(filled(p, 100, 1));
+    assert(arena_realloc(&a, p, 1000, 10) == p);
+    check_arena(&a);
+
+    // Anything else is copied
+    char *q = (char*)arena_alloc(&a, 50);
+    fill(q, 50, 2);
+    fill(p, 1000, 3);
+    char *moved = (char*)arena_realloc(&a, p, 1000, 2000);
+    assert(moved != p && filled(moved, 1000, 3) && filled(q, 50, 2));
+    assert(a.end == r && &r->data[r->count] == (uintptr_t*)(moved + 2000));
+
+    // The tail of a region that is no longer `end` is copied too, even though
+    // the words after it are free
+    size_t rest = (r->capacity - r->count)*sizeof(uintptr_t);
+    char *tail = (char*)arena_alloc(&a, rest - 8*sizeof(uintptr_t));
+    fill(tail, 16, 4);
+    arena_alloc(&a, 2*r->capacity*sizeof(uintptr_t));
+    assert(a.end != r && r->count < r->capacity);
+    size_t count = r->count;
+    moved = (char*)arena_realloc(&a, tail, 16, 32);
+    assert(moved != tail && filled(moved, 16, 4));
+    assert(r->count == count || (uintptr_t*)moved == &r->data[count]);
+    check_arena(&a);
+
+    // So is the tail of `end` that does not fit anymore
+    r = a.end;
+    rest = (r->capacity - r->count)*sizeof(uintptr_t);
+    p = (char*)arena_alloc(&a, rest);
+    fill(p, rest, 5);
+    moved = (char*)arena_realloc(&a, p, rest, rest + 1);
+    assert(moved != p && filled(moved, rest, 5));
+    check_arena(&a);
+    arena_free(&a);
+}
+
+static void test_string_builder(void)
+{
+    Arena a = {0};
+    arena_alloc(&a, 8);
+
+    Arena_String_Builder sb = {&a, NULL, 0, 0};
+    arena_sb_append_cstr(&sb, "GET ");
+    arena_sb_append_sv(&sb, arena_sv_from_parts("/index.html?x", 11));
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_int(&sb, -42);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_int(&sb, -9223372036854775807LL - 1);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_uint(&sb, 18446744073709551615ULL);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_double(&sb, 3.14159, 2);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_double(&sb, -0.999, 2);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_double(&sb, 2.5, 0);
+    arena_sb_append_char(&sb, ' ');
+    arena_sb_append_double(&sb, 1.5e20, 1);
+    arena_sb_appendf(&sb, " %s=%d", "status", 200);
+    char *before = sb.items;
+    Arena_String_View sv = arena_sb_to_sv(&sb);
+    const char *expected = "GET /index.html -42 -9223372036854775808 18446744073709551615 3.14 -1.00 3 1.5e+20 status=200";
+    assert(sv.data == before);
+    assert(arena_sv_eq(sv, arena_sv_from_cstr(expected)));
+    assert(sv.data[sv.count] == '\0');
+
+    // The unused capacity went back to the arena
+    size_t words = (sv.count + 1 + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+    assert((uintptr_t*)sv.data + words == &a.end->data[a.end->count]);
+
+    // Growing far past the initial capacity still yields one contiguous
+    // string without any copies as long as nothing else is allocated
+    arena_sb_append_cstr(&sb, "0123456789");
+    char *first = sb.items;
+    for (int i = 1; i < 2500; ++i) arena_sb_append_cstr(&sb, "0123456789");
+    Arena_String_View big = arena_sb_to_sv(&sb);
+    assert(big.count == 25000 && big.data == first);
+
+    Arena_String_View dup = arena_sv_dup(&a, arena_sv_from_parts("hello, world", 5));
+    assert(arena_sv_eq(dup, arena_sv_from_cstr("hello")) && dup.data[5] == '\0');
+
+    char *s = arena_sprintf(&a, "%d-%s", 69, "nice");
+    assert(strcmp(s, "69-nice") == 0);
+    arena_free(&a);
+}
+
+#define POOL_THREADS 4
+#define POOL_ROUNDS 1000
+
+// Every region handed out must be owned by nobody else until it is put back:
+// fill it with a tag, yield a bit, check nobody wrote over the tag
+static void *region_pool_hammer(void *arg)
+{
+    Region_Pool *pool = (Region_Pool*)arg;
+    uintptr_t tag = (uintptr_t)pthread_self();
+    for (size_t i = 0; i < POOL_ROUNDS; ++i) {
+        Region *r = region_pool_get(pool, 16 + i%4*16);
+        assert(r->capacity >= 16 + i%4*16 && r->count == 0 && r->next == NULL);
+        for (size_t j = 0; j < r->capacity; ++j) r->data[j] = tag ^ j;
+        if (i%3 == 0) {
+            // The second one cannot be the first one
+            Region *r2 = region_pool_get(pool, 16);
+            assert(r2 != r);
+            region_pool_put(pool, r2, r2);
+        }
+        for (size_t j = 0; j < r->capacity; ++j) assert(r->data[j] == (tag ^ j));
+        region_pool_put(pool, r, r);
+
+        // The thread arena takes its regions from the pool too and gives all
+        // of them back on arena_free()
+        Arena *a = arena_thread(pool);
+        char *s = (char*)arena_alloc(a, 100);
+        memset(s, 'x', 100);
+        arena_alloc(a, (i%5 + 1)*REGION_DEFAULT_CAPACITY*sizeof(uintptr_t)/2);
+        assert(s[99] == 'x');
+        arena_free(a);
+        assert(a->begin == NULL);
+    }
+    return NULL;
+}
+
+static void test_region_pool(void)
+{
+    Region_Pool pool = {0};
+
+    // arena_free() and arena_trim() give the regions of a pooled arena back
+    // instead of freeing them, and new regions come from the pool first
+    Arena *a = arena_thread(&pool);
+    arena_alloc(a, sizeof(uintptr_t));
+    arena_alloc(a, REGION_DEFAULT_CAPACITY*sizeof(uintptr_t));
+    Region *first = a->begin, *second = a->begin->next;
+    assert(second != NULL && second->next == NULL);
+    arena_reset(a);
+    assert(a->begin == first && pool.free == NULL);
+    arena_free(a);
+    assert(a->begin == NULL);
+    assert(pool.free == first && first->next == second && second->next == NULL);
+    arena_alloc(a, sizeof(uintptr_t));
+    assert(a->begin == first && pool.free == second);
+    arena_free(a);
+
+    pthread_t threads[POOL_THREADS];
+    for (size_t i = 0; i < POOL_THREADS; ++i) {
+        int result = pthread_create(&threads[i], NULL, region_pool_hammer, &pool);
+        assert(result == 0);
+        (void)result;
+    }
+    for (size_t i = 0; i < POOL_THREADS; ++i) pthread_join(threads[i], NULL);
+
+    // Nothing got lost or linked twice: every region is in the pool once. Each
+    // thread held a few regions at a time, so the pool stayed small.
+    size_t pooled = 0;
+    for (Region *r = pool.free; r != NULL; r = r->next) {
+        for (Region *q = r->next; q != NULL; q = q->next) assert(q != r);
+        pooled += 1;
+    }
+    assert(pooled >= 2 && pooled < POOL_THREADS*POOL_ROUNDS/10);
+    region_pool_free(&pool);
+    assert(pool.free == NULL);
+}
+
+static void test_object_pool(void)
+{
+    typedef struct { char bytes[64]; } Object;
+    enum { COUNT = 2000 };
+    static Object *objects[COUNT];
+
+    Object_Pool pool;
+    object_pool_init_for(&pool, Object);
+    assert(pool.objects_per_slab < COUNT/2);
+    for (size_t i = 0; i < COUNT; ++i) {
+        objects[i] = object_pool_new(&pool, Object);
+        memset(objects[i], (int)i, sizeof(Object));
+    }
+    assert(pool.full != NULL);
+
+    // Freed objects are handed out again before any new slab is touched
+    Object *freed = objects[COUNT/2];
+    object_pool_free(&pool, freed);
+    objects[COUNT/2] = object_pool_new(&pool, Object);
+    assert(objects[COUNT/2] == freed);
+    memset(freed, COUNT/2, sizeof(Object));
+
+    for (size_t i = 0; i < COUNT; i += 2) object_pool_free(&pool, objects[i]);
+    for (size_t i = 1; i < COUNT; i += 2) {
+        for (size_t j = 0; j < sizeof(Object); ++j) {
+            assert(objects[i]->bytes[j] == (char)i);
+        }
+    }
+
+    // Completely free slabs are reclaimed except for a single spare
+    for (size_t i = 1; i < COUNT; i += 2) object_pool_free(&pool, objects[i]);
+    assert(pool.partial == NULL && pool.full == NULL && pool.spare != NULL);
+
+    Object_Pool_Cache cache = {0};
+    cache.pool = &pool;
+    for (size_t i = 0; i < COUNT; ++i) objects[i] = (Object*)object_pool_cache_alloc(&cache);
+    for (size_t i = 0; i < COUNT; ++i) object_pool_cache_free(&cache, objects[i]);
+    object_pool_cache_flush(&cache);
+    assert(pool.partial == NULL && pool.full == NULL);
+    object_pool_destroy(&pool);
+}
+
+#ifdef ARENA_STATS
+static char stats_json[1024];
+static size_t stats_json_size = 0;
+
+static void stats_write(void *user, const char *data, size_t size)
+{
+    (void)user;
+    assert(stats_json_size + size < sizeof(stats_json));
+    memcpy(stats_json + stats_json_size, data, size);
+    stats_json_size += size;
+    stats_json[stats_json_size] = '\0';
+}
+
+static void test_stats(void)
+{
+    Arena a = {0};
+    // Half of the first region, then more than what is left of it
+    arena_alloc(&a, REGION_DEFAULT_CAPACITY/2*sizeof(uintptr_t));
+    arena_alloc(&a, (REGION_DEFAULT_CAPACITY - 100)*sizeof(uintptr_t));
+    Region *first = a.begin, *second = a.begin->next;
+    assert(second != NULL && second->next == NULL);
+    assert(a.stats.alloc_calls == 2);
+    assert(a.stats.new_region_calls == 2);
+    assert(a.stats.region_skips == 1);
+    assert(a.stats.oversize_allocs == 0);
+    assert(a.stats.words_used == REGION_DEFAULT_CAPACITY/2 + REGION_DEFAULT_CAPACITY - 100);
+    assert(a.stats.high_water == a.stats.words_used);
+
+    size_t histogram[ARENA_STATS_FILL_BUCKETS];
+    arena_stats_fill_histogram(&a, histogram);
+    size_t first_bucket = first->count*ARENA_STATS_FILL_BUCKETS/first->capacity;
+    size_t second_bucket = second->count*ARENA_STATS_FILL_BUCKETS/second->capacity;
+    for (size_t i = 0; i < ARENA_STATS_FILL_BUCKETS; ++i) {
+        assert(histogram[i] == (size_t)((i == first_bucket) + (i == second_bucket)));
+    }
+
+    char expected[1024];
+    char buckets[64] = "";
+    for (size_t i = 0; i < ARENA_STATS_FILL_BUCKETS; ++i) {
+        char n[8];
+        snprintf(n, sizeof(n), i > 0 ? ",%zu" : "%zu", histogram[i]);
+        strcat(buckets, n);
+    }
+    snprintf(expected, sizeof(expected),
+             "{\"alloc_calls\":2,\"bytes_requested\":%zu,\"new_region_calls\":2,"
+             "\"region_skips\":1,\"oversize_allocs\":0,\"words_used\":%zu,"
+             "\"high_water\":%zu,\"word_size\":%zu,\"fill_histogram\":[%s],"
+             "\"regions\":[{\"capacity\":%zu,\"count\":%zu},{\"capacity\":%zu,\"count\":%zu}]}",
+             a.stats.bytes_requested, a.stats.words_used, a.stats.high_water,
+             sizeof(uintptr_t), buckets, first->capacity, first->count,
+             second->capacity, second->count);
+    arena_stats_dump_json(&a, stats_write, NULL);
+    assert(strcmp(stats_json, expected) == 0);
+
+    // Resetting gives the words back, the high water mark stays
+    arena_reset(&a);
+    assert(a.stats.words_used == 0);
+    assert(a.stats.high_water == REGION_DEFAULT_CAPACITY/2 + REGION_DEFAULT_CAPACITY - 100);
+    arena_free(&a);
+}
+#endif // ARENA_STATS
+
+int main(void)
+{
+    test_rewind_reuses_regions();
+    test_partial_region_is_reused();
+    test_rewind_keeps_indexed_allocations();
+    test_trim_drops_indexed_regions();
+    test_random_operations();
+    test_realloc();
+    test_string_builder();
+    test_region_pool();
+    test_object_pool();
+#ifdef ARENA_STATS
+    test_stats();
+#endif // ARENA_STATS
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+// test/coroutine_mg_test.c - Serve loopback connections with coroutine_mg.h:
+// an echo server whose coroutines read and write in a blocking style while the
+// client coroutines talk to it over plain sockets, and connections that are
+// accepted by the same poll that closes their listener.
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coroutine.h"
+#include "coroutine_mg.h"
+#include "mongoose.h"
+
+#define CLIENTS 8
+#define ROUNDS 20
+
+static size_t served = 0;
+static size_t clients_done = 0;
+
+// Echoes everything back until the client closes the connection
+static void echo(Coroutine_Mg_Conn *conn)
+{
+    assert(conn->arg == &served);
+    char buf[64];
+    size_t n;
+    while ((n = coroutine_mg_read(conn, buf, sizeof(buf))) > 0) {
+        bool ok = coroutine_mg_write(conn, buf, n);
+        assert(ok);
+        (void) ok;
+    }
+    assert(conn->c == NULL);
+    served += 1;
+}
+
+static int connect_to(uint16_t port)
+{
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = port;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    int result = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    assert(result == 0);
+    (void) result;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static void client(void *arg)
+{
+    int fd = connect_to((uint16_t)(size_t)arg);
+    for (size_t i = 0; i < ROUNDS; ++i) {
+        char msg[32], reply[32] = {0};
+        int len = snprintf(msg, sizeof(msg), "ping %zu from %d", i, fd);
+        ssize_t n = coroutine_write(fd, msg, len, -1);
+        assert(n == len);
+        // The reply may come back in pieces
+        for (ssize_t got = 0; got < len; got += n) {
+            n = coroutine_read(fd, reply + got, len - got, -1);
+            assert(n > 0);
+        }
+        assert(memcmp(msg, reply, len) == 0);
+    }
+    close(fd);
+    clients_done += 1;
+}
+
+static void test_echo(void)
+{
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+    struct mg_connection *listener = coroutine_mg_listen(&mgr, "tcp://127.0.0.1:0", echo, &served);
+    assert(listener != NULL);
+    for (size_t i = 0; i < CLIENTS; ++i) coroutine_go(client, (void*)(size_t)listener->loc.port);
+
+    // The echo coroutines return once mongoose has seen the clients close
+    while (clients_done < CLIENTS || served < CLIENTS) coroutine_mg_poll(&mgr, 10);
+    mg_mgr_free(&mgr);
+}
+
+static size_t connections(struct mg_mgr *mgr)
+{
+    size_t n = 0;
+    for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) n += 1;
+    return n;
+}
+
+static void test_listener_closed_before_serving(void)
+{
+    served = 0;
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+    struct mg_connection *listener = coroutine_mg_listen(&mgr, "tcp://127.0.0.1:0", echo, &served);
+    assert(listener != NULL);
+    int fd = connect_to(listener->loc.port);
+
+    // Accept with plain mg_mgr_poll(), which does not let the coroutine of
+    // the connection run, then free the listener and the connection. The
+    // coroutine still gets to run and finds the connection closed.
+    while (connections(&mgr) < 2) mg_mgr_poll(&mgr, 10);
+    mg_mgr_free(&mgr);
+    while (coroutine_alive() > 1) coroutine_yield();
+    assert(served == 1);
+    close(fd);
+}
+
+int main(void)
+{
+    mg_log_set(MG_LL_NONE);
+    coroutine_init();
+    test_echo();
+    test_listener_closed_before_serving();
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,736 @@
+// test/coroutine_test.c - Stress coroutine_wake_up() by waking random sleepers
+// at a high rate while other coroutines come and go through fds and timers.
+// Check that coroutine stacks are guarded and recycled, and that coroutines on
+// the shared stack keep their frames intact across switches. Run channels, wait
+// groups, mutexes and conds in both the single-threaded and the M:N modes, and
+// timeouts and wake ups across M:N workers. Do file and socket I/O through
+// coroutine_read() and friends. With -DCOROUTINE_STATS check that the counters
+// add up.
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "coroutine.h"
+
+#define FD_SLEEPERS 500
+#define TIMER_SLEEPERS 500
+#define CHURNERS 100
+#define SLEEPERS (FD_SLEEPERS + TIMER_SLEEPERS)
+#define WAKES 200000
+
+typedef struct {
+    size_t id;
+    int fds[2];
+    bool asleep;   // set right before going to sleep, cleared by whoever wakes it
+    size_t woken;  // times it actually woke up
+} Sleeper;
+
+static Sleeper sleepers[SLEEPERS];
+static size_t expected_wakes = 0;
+static bool stop = false;
+static size_t finished = 0;
+
+static void fd_sleeper(void *arg)
+{
+    Sleeper *s = arg;
+    s->id = coroutine_id();
+    while (!stop) {
+        s->asleep = true;
+        coroutine_sleep_read(s->fds[0]);
+        assert(!s->asleep && "Woken up without anybody waking it");
+        s->woken += 1;
+        // Drain whatever the waker might have written
+        char buf[64];
+        while (recv(s->fds[0], buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    }
+    finished += 1;
+}
+
+static void timer_sleeper(void *arg)
+{
+    Sleeper *s = arg;
+    s->id = coroutine_id();
+    while (!stop) {
+        s->asleep = true;
+        // Long enough to never fire during the test, so only wake ups end it
+        coroutine_sleep_ms(60*1000);
+        assert(!s->asleep && "Woken up without anybody waking it");
+        s->woken += 1;
+    }
+    finished += 1;
+}
+
+// Keeps the timers heap and the fd sleepers moving under the wake ups
+static void churner(void *arg)
+{
+    int fd = (int)(long)arg;
+    while (!stop) {
+        int ready = coroutine_sleep_read_timeout(fd, 1 + rand()%3);
+        assert(!ready && "Nobody writes to the churner sockets");
+        (void) ready;
+    }
+    finished += 1;
+}
+
+static void wake(Sleeper *s)
+{
+    if (!s->asleep) {
+        // Must be a no-op for a coroutine that is not sleeping
+        coroutine_wake_up(s->id);
+        return;
+    }
+
+    s->asleep = false;
+    expected_wakes += 1;
+    if (s < &sleepers[FD_SLEEPERS] && rand()%4 == 0) {
+        ssize_t n = write(s->fds[1], "x", 1);
+        assert(n == 1);
+        (void) n;
+    } else {
+        coroutine_wake_up(s->id);
+    }
+}
+
+static void test_random_wake_ups(void)
+{
+    coroutine_init();
+
+    for (size_t i = 0; i < SLEEPERS; ++i) {
+        if (i < FD_SLEEPERS) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sleepers[i].fds) < 0) {
+                perror("socketpair");
+                exit(1);
+            }
+            coroutine_go(fd_sleeper, &sleepers[i]);
+        } else {
+            coroutine_go(timer_sleeper, &sleepers[i]);
+        }
+    }
+    int churn_fds[CHURNERS][2];
+    for (size_t i = 0; i < CHURNERS; ++i) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, churn_fds[i]) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        coroutine_go(churner, (void*)(long)churn_fds[i][0]);
+    }
+    coroutine_yield();
+
+    for (size_t i = 0; i < WAKES; ++i) {
+        wake(&sleepers[rand()%SLEEPERS]);
+        // Sometimes several wake ups land in between two switches
+        if (rand()%8 == 0) wake(&sleepers[rand()%SLEEPERS]);
+        if (rand()%16 == 0) coroutine_yield();
+    }
+
+    // The ones that are awake see the flag on their own
+    stop = true;
+    for (size_t i = 0; i < SLEEPERS; ++i) wake(&sleepers[i]);
+    while (finished < SLEEPERS + CHURNERS) coroutine_yield();
+
+    size_t woken = 0;
+    for (size_t i = 0; i < SLEEPERS; ++i) woken += sleepers[i].woken;
+    assert(woken == expected_wakes);
+
+    // Ids that were never handed out are ignored like ones that are awake
+    coroutine_wake_up(SLEEPERS + CHURNERS + 1000);
+    coroutine_wake_up(1024*1024);
+    coroutine_wake_up((size_t)-1);
+
+    for (size_t i = 0; i < FD_SLEEPERS; ++i) {
+        close(sleepers[i].fds[0]);
+        close(sleepers[i].fds[1]);
+    }
+    for (size_t i = 0; i < CHURNERS; ++i) {
+        close(churn_fds[i][0]);
+        close(churn_fds[i][1]);
+    }
+}
+
+static void *overflow_stack_top = NULL;
+
+static void segv_handler(int sig, siginfo_t *info, void *ucontext)
+{
+    (void) sig;
+    (void) ucontext;
+    // The fault must be right below the stack, inside of the guard page
+    char *addr = info->si_addr;
+    char *bottom = (char*)overflow_stack_top - 16*1024;
+    _exit(addr < bottom && addr >= bottom - getpagesize() ? 42 : 1);
+}
+
+static size_t recurse(volatile char *prev, size_t depth)
+{
+    volatile char frame[512];
+    frame[0] = prev ? prev[0] + 1 : 0;
+    // Never true for a 16KB stack, just keeps the compiler from complaining
+    if (depth > 1024*1024) return frame[0];
+    return recurse(frame, depth + 1) + frame[1];
+}
+
+static void overflow(void *arg)
+{
+    (void) arg;
+    char here;
+    // Barely anything is on the stack yet, the top is the next page boundary
+    size_t page = getpagesize();
+    overflow_stack_top = (void*)(((size_t)&here + page - 1) & ~(page - 1));
+    recurse(NULL, 0);
+}
+
+static void test_guard_page(void)
+{
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // The handler needs a stack of its own, the coroutine one is exhausted
+        static char altstack[64*1024];
+        stack_t ss = {.ss_sp = altstack, .ss_size = sizeof(altstack)};
+        sigaltstack(&ss, NULL);
+        struct sigaction sa = {0};
+        sa.sa_sigaction = segv_handler;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigaction(SIGSEGV, &sa, NULL);
+
+        coroutine_init();
+        coroutine_go_sized(overflow, NULL, 16*1024);
+        while (coroutine_alive() > 1) coroutine_yield();
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 42);
+}
+
+static void touch_stack(void *arg)
+{
+    volatile char buf[8*1024];
+    memset((char*)buf, 1, sizeof(buf));
+    size_t *started = arg;
+    *started += 1;
+    coroutine_yield();
+}
+
+static void test_stacks_are_recycled(void)
+{
+    // Runs after the stress test, so the pool has a couple of free stacks
+    size_t started = 0;
+    for (size_t round = 0; round < 100; ++round) {
+        for (size_t i = 0; i < 100; ++i) coroutine_go_sized(touch_stack, &started, 64*1024);
+        while (coroutine_alive() > 1) coroutine_yield();
+    }
+    assert(started == 100*100);
+}
+
+#define SHARED_COROUTINES 1000
+#define SHARED_ROUNDS 20
+
+static size_t shared_done = 0;
+
+// Deeper for some coroutines than for others, so the saved stacks differ in
+// size. Every frame checks its locals after the switches.
+static size_t shared_frames(size_t n, size_t depth)
+{
+    volatile size_t frame[64];
+    for (size_t i = 0; i < 64; ++i) frame[i] = n*1000 + depth*64 + i;
+    size_t sum = 0;
+    if (depth > 0) {
+        sum = shared_frames(n, depth - 1);
+    } else {
+        for (size_t round = 0; round < SHARED_ROUNDS; ++round) {
+            if (round%5 == 4) coroutine_sleep_ms(1); else coroutine_yield();
+        }
+    }
+    for (size_t i = 0; i < 64; ++i) assert(frame[i] == n*1000 + depth*64 + i);
+    return sum + frame[0];
+}
+
+static void shared_worker(void *arg)
+{
+    size_t n = (size_t)arg;
+    size_t depth = n%8;
+    size_t expected = 0;
+    for (size_t d = 0; d <= depth; ++d) expected += n*1000 + d*64;
+    assert(shared_frames(n, depth) == expected);
+    shared_done += 1;
+}
+
+static void test_shared_stacks(void)
+{
+    // Mixed with coroutines on dedicated stacks, which have to be left alone
+    size_t started = 0;
+    for (size_t i = 0; i < SHARED_COROUTINES; ++i) {
+        coroutine_go_shared(shared_worker, (void*)i);
+        if (i%10 == 0) coroutine_go_sized(touch_stack, &started, 16*1024);
+    }
+    // coroutine_alive() does not count the ones sleeping on a timer
+    while (shared_done < SHARED_COROUTINES || coroutine_alive() > 1) coroutine_yield();
+    assert(started == SHARED_COROUTINES/10);
+}
+
+#define PRODUCERS 10
+#define CONSUMERS 3
+#define MESSAGES 1000
+
+typedef struct {
+    Coroutine_Channel *ch;
+    Coroutine_Wait_Group *producers;
+    Coroutine_Wait_Group *consumers;
+    Coroutine_Mutex *mutex;
+    size_t sum;      // guarded by mutex
+    size_t received; // guarded by mutex
+} Fan_In;
+
+static void fan_in_producer(void *arg)
+{
+    Fan_In *f = arg;
+    for (size_t i = 1; i <= MESSAGES; ++i) {
+        int ok = coroutine_channel_send(f->ch, &i);
+        assert(ok);
+        (void) ok;
+        if (i%7 == 0) coroutine_yield();
+    }
+    coroutine_wait_group_done(f->producers);
+}
+
+static void fan_in_consumer(void *arg)
+{
+    Fan_In *f = arg;
+    size_t item;
+    while (coroutine_channel_recv(f->ch, &item)) {
+        coroutine_mutex_lock(f->mutex);
+        size_t sum = f->sum;
+        // Make the others pile up on the mutex
+        coroutine_yield();
+        f->sum = sum + item;
+        f->received += 1;
+        coroutine_mutex_unlock(f->mutex);
+    }
+    coroutine_wait_group_done(f->consumers);
+}
+
+// Many producers into a small channel, a few consumers out of it, the main
+// coroutine waits for all of them without spinning
+static void fan_in(void *arg)
+{
+    (void) arg;
+    Fan_In f = {
+        .ch = coroutine_channel_new(sizeof(size_t), 4),
+        .producers = coroutine_wait_group_new(),
+        .consumers = coroutine_wait_group_new(),
+        .mutex = coroutine_mutex_new(),
+    };
+    coroutine_wait_group_add(f.producers, PRODUCERS);
+    coroutine_wait_group_add(f.consumers, CONSUMERS);
+    for (size_t i = 0; i < CONSUMERS; ++i) coroutine_go(fan_in_consumer, &f);
+    for (size_t i = 0; i < PRODUCERS; ++i) coroutine_go(fan_in_producer, &f);
+
+    coroutine_wait_group_wait(f.producers);
+    coroutine_channel_close(f.ch);
+    size_t dropped = 1;
+    assert(!coroutine_channel_send(f.ch, &dropped) && "Sent into a closed channel");
+    coroutine_wait_group_wait(f.consumers);
+
+    assert(f.received == PRODUCERS*MESSAGES);
+    assert(f.sum == PRODUCERS*(MESSAGES*(MESSAGES + 1)/2));
+    coroutine_channel_free(f.ch);
+    coroutine_wait_group_free(f.producers);
+    coroutine_wait_group_free(f.consumers);
+    coroutine_mutex_free(f.mutex);
+}
+
+typedef struct {
+    Coroutine_Mutex *mutex;
+    Coroutine_Cond *cond;
+    size_t turn;
+    size_t players;
+    size_t rounds;
+} Turns;
+
+static Turns turns = {0};
+
+// Every player waits for its turn on the same cond, so each broadcast wakes up
+// all of them and only one gets to go
+static void take_turns(void *arg)
+{
+    size_t me = (size_t)arg;
+    for (size_t round = 0; round < turns.rounds; ++round) {
+        coroutine_mutex_lock(turns.mutex);
+        while (turns.turn%turns.players != me) coroutine_cond_wait(turns.cond, turns.mutex);
+        turns.turn += 1;
+        coroutine_cond_broadcast(turns.cond);
+        coroutine_mutex_unlock(turns.mutex);
+    }
+}
+
+static void test_sync(void)
+{
+    fan_in(NULL);
+
+    turns = (Turns){
+        .mutex = coroutine_mutex_new(),
+        .cond = coroutine_cond_new(),
+        .players = 5,
+        .rounds = 100,
+    };
+    for (size_t i = 0; i < turns.players; ++i) coroutine_go(take_turns, (void*)i);
+    while (coroutine_alive() > 1) coroutine_yield();
+    assert(turns.turn == turns.players*turns.rounds);
+    coroutine_mutex_free(turns.mutex);
+    coroutine_cond_free(turns.cond);
+
+    // Unbounded channels never block the sender
+    Coroutine_Channel *ch = coroutine_channel_new(sizeof(int), COROUTINE_CHANNEL_UNBOUNDED);
+    for (int i = 0; i < 10000; ++i) coroutine_channel_send(ch, &i);
+    coroutine_channel_close(ch);
+    int item, expected = 0;
+    while (coroutine_channel_recv(ch, &item)) assert(item == expected++);
+    assert(expected == 10000);
+    coroutine_channel_free(ch);
+}
+
+#define IO_READERS 8
+#define IO_CHUNK 4096
+
+typedef struct {
+    int fd;
+    size_t index;
+    Coroutine_Wait_Group *wg;
+} Io_Reader;
+
+static void io_reader(void *arg)
+{
+    Io_Reader *r = arg;
+    char buf[IO_CHUNK];
+    ssize_t n = coroutine_read(r->fd, buf, sizeof(buf), r->index*IO_CHUNK);
+    assert(n == IO_CHUNK);
+    for (size_t i = 0; i < IO_CHUNK; ++i) assert(buf[i] == (char)('a' + r->index));
+    coroutine_wait_group_done(r->wg);
+}
+
+static void io_echo(void *arg)
+{
+    int fd = (int)(long)arg;
+    char buf[64];
+    ssize_t n;
+    while ((n = coroutine_read(fd, buf, sizeof(buf), -1)) > 0) {
+        ssize_t m = coroutine_write(fd, buf, n, -1);
+        assert(m == n);
+        (void) m;
+    }
+    close(fd);
+}
+
+static void io_server(void *arg)
+{
+    int listener = (int)(long)arg;
+    int client = coroutine_accept(listener, NULL, NULL);
+    assert(client >= 0);
+    int flags = fcntl(client, F_GETFL);
+    fcntl(client, F_SETFL, flags | O_NONBLOCK);
+    io_echo((void*)(long)client);
+}
+
+static void test_io(void)
+{
+    int result;
+    // Files: written by one coroutine, read back by several at once
+    char path[] = "/tmp/coroutine_test_XXXXXX";
+    int tmp = mkstemp(path);
+    assert(tmp >= 0);
+    close(tmp);
+    int fd = coroutine_openat(AT_FDCWD, path, O_RDWR|O_TRUNC, 0600);
+    assert(fd >= 0);
+    for (size_t i = 0; i < IO_READERS; ++i) {
+        char chunk[IO_CHUNK];
+        memset(chunk, 'a' + i, sizeof(chunk));
+        ssize_t n = coroutine_write(fd, chunk, sizeof(chunk), -1);
+        assert(n == IO_CHUNK);
+        (void) n;
+    }
+    Io_Reader readers[IO_READERS];
+    Coroutine_Wait_Group *wg = coroutine_wait_group_new();
+    coroutine_wait_group_add(wg, IO_READERS);
+    for (size_t i = 0; i < IO_READERS; ++i) {
+        readers[i] = (Io_Reader){.fd = fd, .index = i, .wg = wg};
+        coroutine_go(io_reader, &readers[i]);
+    }
+    coroutine_wait_group_wait(wg);
+    coroutine_wait_group_free(wg);
+    char byte;
+    ssize_t n = coroutine_read(fd, &byte, 1, IO_READERS*IO_CHUNK);
+    assert(n == 0 && "Expected EOF");
+
+    // A regular file is always ready (epoll refuses to watch it)
+    coroutine_sleep_read(fd);
+    coroutine_sleep_write(fd);
+    result = coroutine_sleep_read_timeout(fd, 1000);
+    assert(result == 1);
+    close(fd);
+    unlink(path);
+    fd = coroutine_openat(AT_FDCWD, path, O_RDONLY, 0);
+    assert(fd < 0 && errno == ENOENT);
+    n = coroutine_read(-1, &byte, 1, -1);
+    assert(n < 0 && errno == EBADF);
+
+    // Sockets: the reader blocks until the other end writes
+    int pair[2];
+    result = socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, pair);
+    assert(result == 0);
+    coroutine_go(io_echo, (void*)(long)pair[1]);
+    char reply[6] = {0};
+    for (size_t i = 0; i < 100; ++i) {
+        n = coroutine_write(pair[0], "hello", 5, -1);
+        assert(n == 5);
+        size_t got = 0;
+        while (got < 5) {
+            n = coroutine_read(pair[0], reply + got, 5 - got, -1);
+            assert(n > 0);
+            got += n;
+        }
+        assert(strcmp(reply, "hello") == 0);
+    }
+    close(pair[0]);
+
+    // Accepting
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.sock", path);
+    int listener = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0);
+    assert(listener >= 0);
+    result = bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+    assert(result == 0);
+    result = listen(listener, 16);
+    assert(result == 0);
+    coroutine_go(io_server, (void*)(long)listener);
+    coroutine_yield();
+    int client = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0);
+    result = connect(client, (struct sockaddr*)&addr, sizeof(addr));
+    assert(result == 0);
+    (void) result;
+    n = coroutine_write(client, "ping", 4, -1);
+    assert(n == 4);
+    memset(reply, 0, sizeof(reply));
+    n = coroutine_read(client, reply, 4, -1);
+    assert(n == 4 && strcmp(reply, "ping") == 0);
+    (void) n;
+    close(client);
+    while (coroutine_alive() > 1) coroutine_yield();
+    close(listener);
+    unlink(addr.sun_path);
+}
+
+#ifndef COROUTINE_USE_POLL
+// The M:N runtime needs epoll. coroutine_run() also needs a thread that never
+// called coroutine_init().
+static void *sync_mn(void *arg)
+{
+    (void) arg;
+    coroutine_run(4, fan_in, NULL);
+    return NULL;
+}
+
+static void file_sleeper(void *arg)
+{
+    int fd = (int)(long)arg;
+    coroutine_sleep_read(fd);
+    coroutine_sleep_write(fd);
+}
+
+static void *file_sleep_mn(void *arg)
+{
+    coroutine_run(2, file_sleeper, arg);
+    return NULL;
+}
+
+#define TIMEOUT_ROUNDS 20
+#define TIMEOUT_SLEEPERS 64
+
+static size_t timeout_wakee = (size_t)-1;
+
+// Sleeps on the read end of a pipe nothing is written into
+static int timeout_sleep(size_t ms)
+{
+    int fds[2];
+    int result = pipe(fds);
+    assert(result == 0);
+    (void) result;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    int ready = coroutine_sleep_read_timeout(fds[0], ms);
+    close(fds[0]);
+    close(fds[1]);
+    return ready;
+}
+
+static void timeout_sleeper(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < TIMEOUT_ROUNDS; ++i) {
+        int ready = timeout_sleep(1);
+        assert(ready == 0 && "Timed out sleep reported as ready");
+        (void) ready;
+        coroutine_sleep_ms(i%3);
+    }
+}
+
+// Only coroutine_wake_up() from another worker gets it out before the timeout
+static void timeout_wakee_fn(void *arg)
+{
+    (void) arg;
+    __atomic_store_n(&timeout_wakee, coroutine_id(), __ATOMIC_RELEASE);
+    int ready = timeout_sleep(60*1000);
+    assert(ready == 1 && "Woken up sleep reported as timed out");
+    (void) ready;
+    __atomic_store_n(&timeout_wakee, (size_t)-1, __ATOMIC_RELEASE);
+}
+
+static void timeouts_mn(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < TIMEOUT_SLEEPERS; ++i) {
+        coroutine_go_on(i%coroutine_workers(), timeout_sleeper, NULL);
+    }
+
+    coroutine_go_on(coroutine_workers() - 1, timeout_wakee_fn, NULL);
+    size_t id;
+    while ((id = __atomic_load_n(&timeout_wakee, __ATOMIC_ACQUIRE)) == (size_t)-1) coroutine_yield();
+    // Does nothing until it is asleep
+    while (__atomic_load_n(&timeout_wakee, __ATOMIC_ACQUIRE) == id) {
+        coroutine_wake_up(id);
+        coroutine_sleep_ms(1);
+    }
+
+    while (coroutine_alive() > 1) coroutine_sleep_ms(1);
+}
+
+static void *timeouts_mn_thread(void *arg)
+{
+    (void) arg;
+    coroutine_run(4, timeouts_mn, NULL);
+    return NULL;
+}
+
+static void test_sync_mn(void)
+{
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, sync_mn, NULL);
+    assert(result == 0);
+    (void) result;
+    pthread_join(thread, NULL);
+
+    // Sleeping on a regular file does not hang a worker either
+    char path[] = "/tmp/coroutine_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    result = pthread_create(&thread, NULL, file_sleep_mn, (void*)(long)fd);
+    assert(result == 0);
+    pthread_join(thread, NULL);
+    close(fd);
+
+    // Timeouts and wake ups across workers
+    result = pthread_create(&thread, NULL, timeouts_mn_thread, NULL);
+    assert(result == 0);
+    pthread_join(thread, NULL);
+}
+#endif // COROUTINE_USE_POLL
+
+#ifdef COROUTINE_STATS
+static size_t stats_sleeper_id, stats_spinner_id;
+static size_t stats_done = 0;
+
+static void stats_sleeper(void *arg)
+{
+    (void) arg;
+    stats_sleeper_id = coroutine_id();
+    for (int i = 0; i < 3; ++i) coroutine_sleep_ms(10);
+    stats_done += 1;
+}
+
+static void stats_spinner(void *arg)
+{
+    (void) arg;
+    stats_spinner_id = coroutine_id();
+    for (int i = 0; i < 100; ++i) coroutine_yield();
+    stats_done += 1;
+}
+
+typedef struct {
+    char items[64*1024];
+    size_t count;
+} Json;
+
+static void json_write(void *user, const char *data, size_t size)
+{
+    Json *json = user;
+    assert(json->count + size < sizeof(json->items));
+    memcpy(json->items + json->count, data, size);
+    json->count += size;
+}
+
+static void test_stats(void)
+{
+    coroutine_go(stats_sleeper, NULL);
+    coroutine_go(stats_spinner, NULL);
+    while (stats_done < 2) coroutine_yield();
+
+    // Dead ones keep their counters until the id gets reused
+    Coroutine_Context_Stats cs;
+    coroutine_stats_of(stats_sleeper_id, &cs);
+    assert(!cs.alive);
+    assert(cs.switches == 4);
+    assert(cs.sleep_ns >= 20*1000000); // the deadline is set a bit before the sleep starts
+    coroutine_stats_of(stats_spinner_id, &cs);
+    assert(!cs.alive);
+    assert(cs.switches == 101);
+    assert(cs.run_ns > 0);
+    coroutine_stats_of(coroutine_id(), &cs);
+    assert(cs.alive);
+    assert(cs.run_ns > 0);
+
+    Coroutine_Stats s;
+    coroutine_stats(&s);
+    size_t polls = s.poll_infinite, switches = 0;
+    for (size_t i = 0; i < COROUTINE_STATS_BUCKETS; ++i) {
+        polls += s.poll_timeout_histogram[i];
+        switches += s.ready_histogram[i];
+    }
+    assert(s.poll_calls > 0 && polls == s.poll_calls);
+    assert(switches == s.switches);
+
+    static Json json = {0};
+    coroutine_stats_dump_json(json_write, &json);
+    json.items[json.count] = '\0';
+    assert(json.items[0] == '{' && json.items[json.count - 1] == '}');
+    assert(strstr(json.items, "\"coroutines\":[{\"id\":0,") != NULL);
+}
+#endif // COROUTINE_STATS
+
+int main(void)
+{
+    srand(69);
+    test_guard_page();
+    test_random_wake_ups();
+    test_stacks_are_recycled();
+    test_shared_stacks();
+    test_sync();
+    test_io();
+#ifndef COROUTINE_USE_POLL
+    test_sync_mn();
+#endif // COROUTINE_USE_POLL
+#ifdef COROUTINE_STATS
+    test_stats();
+#endif // COROUTINE_STATS
+    printf("All tests passed!\n");
+    return 0;
+}
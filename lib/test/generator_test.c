@@ -0,0 +1,182 @@
+// test/generator_test.c - Test generator_reset() on suspended and finished
+// generators and the reuse of pooled generators across stack sizes. Built
+// with -DGENERATOR_POOL_HOT=0 as well, where nothing is pooled. Check that
+// foreach sees every item whether the generator batches them or not.
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "generator.h"
+
+#ifndef GENERATOR_POOL_HOT
+#define GENERATOR_POOL_HOT 16
+#endif
+
+// Yields 0, 1, 2, ... up to the limit it was started with
+static void count(void *arg)
+{
+    size_t limit = (size_t)(uintptr_t)arg;
+    for (size_t i = 0; i < limit; ++i) generator_yield((void*)(uintptr_t)i);
+}
+
+static void count_down(void *arg)
+{
+    size_t from = (size_t)(uintptr_t)arg;
+    for (size_t i = from; i > 0; --i) generator_yield((void*)(uintptr_t)i);
+}
+
+static size_t next(Generator *g, size_t arg)
+{
+    return (size_t)(uintptr_t)generator_next(g, (void*)(uintptr_t)arg);
+}
+
+static void test_reset(void)
+{
+    Generator *g = generator_create(count);
+
+    // Suspended in the middle: starts over, with the new argument
+    assert(next(g, 10) == 0);
+    assert(next(g, 0) == 1);
+    assert(next(g, 0) == 2);
+    generator_reset(g, NULL);
+    assert(!g->dead);
+    assert(next(g, 2) == 0);
+    assert(next(g, 0) == 1);
+    next(g, 0);
+    assert(g->dead);
+
+    // Finished: same thing
+    generator_reset(g, NULL);
+    assert(!g->dead);
+    assert(next(g, 3) == 0);
+
+    // Suspended, with another function
+    generator_reset(g, count_down);
+    assert(next(g, 3) == 3);
+    assert(next(g, 0) == 2);
+
+    // NULL keeps the last function, not the one it was created with
+    generator_reset(g, NULL);
+    assert(next(g, 5) == 5);
+    generator_destroy(g);
+}
+
+static void test_pool(void)
+{
+    size_t small_size = 16*getpagesize();
+    size_t big_size = 64*getpagesize();
+
+    Generator *small = generator_create_sized(count, small_size);
+    assert(small->stack_size == small_size);
+    assert(next(small, 3) == 0);
+    generator_destroy(small);
+
+    // A bigger size class never gets the small pooled one
+    Generator *big = generator_create_sized(count, big_size);
+    assert(big->stack_size == big_size);
+    assert(next(big, 3) == 0);
+    assert(next(big, 0) == 1);
+
+    // The same size class does, as a fresh generator with the new function
+    Generator *again = generator_create_sized(count_down, small_size - 1);
+    assert(again->stack_size == small_size);
+    if (GENERATOR_POOL_HOT > 0) assert(again == small);
+    assert(!again->dead && again->batch == NULL);
+    assert(next(again, 2) == 2);
+    assert(next(again, 0) == 1);
+    next(again, 0);
+    assert(again->dead);
+
+    generator_destroy(again);
+    generator_destroy(big);
+    generator_pool_trim();
+
+    // Trimmed, or never pooled: whatever comes next works all the same
+    Generator *fresh = generator_create_sized(count, small_size);
+    assert(fresh->stack_size == small_size);
+    assert(next(fresh, 1) == 0);
+    next(fresh, 0);
+    assert(fresh->dead);
+    generator_destroy(fresh);
+    generator_pool_trim();
+}
+
+// Same as count, but batched
+static void count_batched(void *arg)
+{
+    size_t limit = (size_t)(uintptr_t)arg;
+    for (size_t i = 0; i < limit; ++i) generator_yield_batched((void*)(uintptr_t)i);
+}
+
+// The items foreach sees from count_batched(limit) with batches of `capacity`
+// (0 for none)
+static size_t collect(Generator *g, size_t limit, size_t capacity)
+{
+    void *items[16];
+    generator_reset(g, count_batched);
+    generator_batch(g, capacity > 0 ? items : NULL, capacity);
+    size_t n = 0;
+    foreach (it, g, (void*)(uintptr_t)limit) {
+        assert((size_t)(uintptr_t)it == n);
+        n += 1;
+    }
+    assert(g->dead);
+    return n;
+}
+
+static void test_batch(void)
+{
+    Generator *g = generator_create(count_batched);
+    assert(collect(g, 10, 0) == 10);
+    assert(collect(g, 10, 4) == 10);  // the last batch is partial
+    assert(collect(g, 12, 4) == 12);  // the last batch is exactly full
+    assert(collect(g, 0, 4) == 0);    // nothing at all
+    assert(collect(g, 0, 0) == 0);
+    assert(collect(g, 1, 16) == 1);
+    assert(collect(g, 5, 1) == 5);
+
+    // Back to a switch per item in the middle of the iteration, once the
+    // items of the current batch are all handed out
+    void *items[4];
+    generator_reset(g, count_batched);
+    generator_batch(g, items, 4);
+    size_t n = 0;
+    foreach (it, g, (void*)(uintptr_t)10) {
+        assert((size_t)(uintptr_t)it == n);
+        n += 1;
+        if (n == 4) {
+            generator_batch(g, NULL, 0);
+            assert(g->batch_count == 0);
+        }
+    }
+    assert(n == 10);
+
+    // Or in the middle of a batch, which drops what is left of it
+    generator_reset(g, count_batched);
+    generator_batch(g, items, 4);
+    n = 0;
+    size_t expected = 0;
+    foreach (it, g, (void*)(uintptr_t)10) {
+        assert((size_t)(uintptr_t)it == expected);
+        n += 1;
+        expected += 1;
+        if (n == 2) {
+            generator_batch(g, NULL, 0);
+            expected = 4;
+        }
+    }
+    assert(n == 2 + 6);
+    generator_destroy(g);
+}
+
+int main(void)
+{
+    generator_init();
+    test_reset();
+    test_pool();
+    test_batch();
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,276 @@
+// test/vt_test.c - Test the terminal emulator of vt.h on hand written
+// sequences, then on what the POSIX backend of winbox.h sends for random
+// frames, whose screen must show exactly the cells that were set. Also into a
+// non-blocking pipe that is drained late, which wb_present() must wait for
+// without spinning.
+#define VT_IMPLEMENTATION
+#include "vt.h"
+#define WB_IMPL
+#include "c/termbox/lib/winbox.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void feed(Vt *vt, const char *s)
+{
+    vt_feed(vt, s, strlen(s));
+}
+
+static const char *row(Vt *vt, int y)
+{
+    static char text[256];
+    vt_row_text(vt, y, text, sizeof(text));
+    return text;
+}
+
+static void test_text(void)
+{
+    Vt vt;
+    assert(vt_init(&vt, 10, 3));
+
+    feed(&vt, "hello\r\nw\xc3\xb6rld \xe2\x82\xac");
+    assert(strcmp(row(&vt, 0), "hello") == 0);
+    assert(strcmp(row(&vt, 1), "w\xc3\xb6rld \xe2\x82\xac") == 0);
+    assert(vt_cell(&vt, 1, 1).ch == 0xF6);
+    assert(vt.cursor_x == 7 && vt.cursor_y == 1);
+    assert(vt.stats.printed == 12 && vt.stats.escapes == 0);
+
+    // the last column does not wrap until something is printed after it
+    feed(&vt, "\x1b[3;8Habc");
+    assert(vt.cursor_x == 10 && vt.cursor_y == 2);
+    feed(&vt, "d");
+    assert(strcmp(row(&vt, 2), "d") == 0); // scrolled up a line
+    assert(strcmp(row(&vt, 1), "       abc") == 0);
+    assert(strcmp(row(&vt, 0), "w\xc3\xb6rld \xe2\x82\xac") == 0);
+
+    // a cut short UTF-8 sequence is a replacement character
+    feed(&vt, "\r\xe2\x82x");
+    assert(vt_cell(&vt, 0, 2).ch == 0xFFFD && vt_cell(&vt, 1, 2).ch == 'x');
+
+    vt_free(&vt);
+}
+
+static void test_sequences(void)
+{
+    Vt vt;
+    assert(vt_init(&vt, 10, 4));
+
+    feed(&vt, "\x1b[2;3HX\x1b[4GY\x1b[AZ\x1b[2DW");
+    assert(strcmp(row(&vt, 1), "  XY") == 0);
+    assert(strcmp(row(&vt, 0), "   WZ") == 0);
+    assert(vt.stats.escapes == 4 && vt.stats.cursor_moves == 4);
+
+    // moves stop at the edges
+    feed(&vt, "\x1b[99;99H");
+    assert(vt.cursor_x == 9 && vt.cursor_y == 3);
+    feed(&vt, "\x1b[H");
+    assert(vt.cursor_x == 0 && vt.cursor_y == 0);
+
+    feed(&vt, "\x1b[1;31;44mR\x1b[0;92;103mG\x1b[38;5;200;48;2;1;2;3mT\x1b[mD");
+    Vt_Cell r = vt_cell(&vt, 0, 0), g = vt_cell(&vt, 1, 0);
+    Vt_Cell t = vt_cell(&vt, 2, 0), d = vt_cell(&vt, 3, 0);
+    assert(r.ch == 'R' && r.fg == 1 && r.bg == 4 && r.attrs == VT_BOLD);
+    assert(g.fg == 10 && g.bg == 11 && g.attrs == 0);
+    assert(t.fg == 200 && t.bg == VT_RGB(1, 2, 3));
+    assert(d.fg == VT_COLOR_DEFAULT && d.bg == VT_COLOR_DEFAULT);
+    assert(vt.stats.sgrs == 4);
+
+    // erases fill with the current background
+    feed(&vt, "\x1b[2;1H0123456789\x1b[2;5H\x1b[41m\x1b[K");
+    assert(strcmp(row(&vt, 1), "0123") == 0);
+    assert(vt_cell(&vt, 9, 1).bg == 1);
+    feed(&vt, "\x1b[1K");
+    assert(strcmp(row(&vt, 1), "") == 0);
+    feed(&vt, "\x1b[0m\x1b[2J");
+    for (int y = 0; y < vt.height; ++y) assert(strcmp(row(&vt, y), "") == 0);
+
+    // the alternate screen comes and goes, the main one stays
+    feed(&vt, "\x1b[Hmain\x1b[?1049h\x1b[?25l");
+    assert(vt.alt_screen && !vt.cursor_visible);
+    assert(strcmp(row(&vt, 0), "") == 0);
+    feed(&vt, "alt\x1b[?1049l\x1b[?25h");
+    assert(!vt.alt_screen && vt.cursor_visible);
+    assert(strcmp(row(&vt, 0), "main") == 0);
+
+    // titles, charsets and what is not emulated do not show up
+    vt_stats_reset(&vt);
+    feed(&vt, "\x1b[H\x1b]0;title\x07\x1b]2;t\x1b\\\x1b(B\x1b[5S\x1b[?12h!");
+    assert(strcmp(row(&vt, 0), "!ain") == 0);
+    assert(vt.stats.escapes == 6 && vt.stats.unknown == 2);
+    assert(vt.stats.bytes == strlen("\x1b[H\x1b]0;title\x07\x1b]2;t\x1b\\\x1b(B\x1b[5S\x1b[?12h!"));
+
+    // sequences split anywhere
+    const char *split = "\x1b[3;2H\x1b[32mok\xe2\x82\xac";
+    for (size_t i = 0; split[i] != '\0'; ++i) vt_feed(&vt, split + i, 1);
+    assert(strcmp(row(&vt, 2), " ok\xe2\x82\xac") == 0);
+    assert(vt_cell(&vt, 1, 2).fg == 2);
+
+    // an ESC aborts the sequence it interrupts and starts a new one
+    vt_stats_reset(&vt);
+    feed(&vt, "\x1b[0m\x1b[2J\x1b[2;\x1b[4;3HE\x1b]0;t\x1b[1;2HO");
+    assert(strcmp(row(&vt, 3), "  E") == 0);
+    assert(strcmp(row(&vt, 0), " O") == 0);
+    assert(vt.stats.escapes == 4);
+
+    // parameters past VT_MAX_PARAMS are dropped, not glued to the last one
+    feed(&vt, "\x1b[0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;31;1;4mX");
+    Vt_Cell x = vt_cell(&vt, 2, 0);
+    assert(x.ch == 'X' && x.fg == 1 && x.attrs == 0);
+
+    vt_free(&vt);
+}
+
+// The vt.h color of a winbox one, WB_DEFAULT (0) is the terminal's
+static int wb_vt_color(uintattr_t c, int bright)
+{
+    if ((c & 7) == 0) return VT_COLOR_DEFAULT;
+    return wb_ansi_color(c) + (bright && (c & WB_BOLD) ? 8 : 0);
+}
+
+static void test_winbox(int width, int height)
+{
+    char path[] = "/tmp/vt_test_XXXXXX";
+    int wfd = mkstemp(path);
+    assert(wfd >= 0);
+    int rfd = open(path, O_RDONLY);
+    assert(rfd >= 0);
+    unlink(path);
+
+    char size[16];
+    snprintf(size, sizeof(size), "%d", width);
+    setenv("COLUMNS", size, 1);
+    snprintf(size, sizeof(size), "%d", height);
+    setenv("LINES", size, 1);
+    assert(wb_init_rwfd(-1, wfd) == WB_OK);
+    assert(wb_width() == width && wb_height() == height);
+
+    Vt vt;
+    assert(vt_init(&vt, width, height));
+    struct wb_cell *cells = calloc(width*height, sizeof(*cells));
+    for (int i = 0; i < width*height; ++i) cells[i] = (struct wb_cell){' ', 0, 0};
+
+    srand(69);
+    for (int frame = 0; frame < 100; ++frame) {
+        static const uint32_t glyphs[] = {'a', 'Z', ' ', '#', 0xE9, 0x2502};
+        static const uintattr_t fgs[] = {WB_DEFAULT, WB_RED, WB_GREEN | WB_BOLD, WB_BLUE | WB_UNDERLINE, WB_WHITE | WB_REVERSE};
+        static const uintattr_t bgs[] = {WB_DEFAULT, WB_CYAN, WB_YELLOW | WB_BOLD};
+        int draws = rand()%(frame%10 == 0 ? width*height : 40);
+        for (int n = 0; n < draws; ++n) {
+            int x = rand()%width, y = rand()%height;
+            struct wb_cell c = {glyphs[rand()%6], fgs[rand()%5], bgs[rand()%3]};
+            wb_set_cell(x, y, c.ch, c.fg, c.bg);
+            cells[y*width + x] = c;
+        }
+        vt_stats_reset(&vt);
+        assert(wb_present() == WB_OK);
+        assert(vt_feed_fd(&vt, rfd));
+        assert(vt.stats.unknown == 0);
+        if (draws == 0) assert(vt.stats.bytes == 0);
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                struct wb_cell c = cells[y*width + x];
+                Vt_Cell v = vt_cell(&vt, x, y);
+                uint8_t attrs = (c.fg & WB_BOLD ? VT_BOLD : 0) |
+                                (c.fg & WB_UNDERLINE ? VT_UNDERLINE : 0) |
+                                (c.fg & WB_REVERSE ? VT_REVERSE : 0);
+                assert(v.ch == c.ch);
+                assert(v.fg == wb_vt_color(c.fg, 0));
+                assert(v.bg == wb_vt_color(c.bg, 1));
+                assert(v.attrs == attrs);
+            }
+        }
+    }
+
+    // the cursor is placed after the cells
+    wb_set_cell(0, 0, 'q', WB_DEFAULT, WB_DEFAULT);
+    wb_set_cursor(3, 1);
+    vt_stats_reset(&vt);
+    assert(wb_present() == WB_OK);
+    assert(vt_feed_fd(&vt, rfd));
+    assert(vt.cursor_x == 3 && vt.cursor_y == 1 && vt.cursor_visible);
+    assert(vt.stats.printed == 1 && vt.stats.cursor_moves == 2);
+
+    free(cells);
+    vt_free(&vt);
+    wb_shutdown();
+    close(rfd);
+    close(wfd);
+}
+
+typedef struct {
+    Vt vt;
+    int rfd;
+} Late_Reader;
+
+static void *late_reader(void *arg)
+{
+    Late_Reader *r = arg;
+    usleep(300*1000);
+    assert(vt_feed_fd(&r->vt, r->rfd));
+    return NULL;
+}
+
+static double thread_cpu_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void test_winbox_nonblocking(void)
+{
+    int width = 300, height = 100;
+    int fds[2];
+    int result = pipe(fds);
+    assert(result == 0);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    setenv("COLUMNS", "300", 1);
+    setenv("LINES", "100", 1);
+    assert(wb_init_rwfd(-1, fds[1]) == WB_OK);
+
+    // Far more than the pipe holds: a color change on every cell
+    Late_Reader r = {.rfd = fds[0]};
+    assert(vt_init(&r.vt, width, height));
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) wb_set_cell(x, y, 'a' + (x + y)%26, 1 + (x + y)%7, WB_DEFAULT);
+    }
+    pthread_t thread;
+    result = pthread_create(&thread, NULL, late_reader, &r);
+    assert(result == 0);
+    (void) result;
+    double cpu = thread_cpu_secs();
+    assert(wb_present() == WB_OK);
+    cpu = thread_cpu_secs() - cpu;
+    assert(cpu < 0.15 && "wb_present() spun while the pipe was full");
+    wb_shutdown();
+    close(fds[1]);
+    pthread_join(thread, NULL);
+
+    assert(r.vt.stats.bytes > 64*1024 && r.vt.stats.unknown == 0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            Vt_Cell v = vt_cell(&r.vt, x, y);
+            assert(v.ch == (uint32_t)('a' + (x + y)%26));
+            assert(v.fg == wb_vt_color(1 + (x + y)%7, 0));
+        }
+    }
+    vt_free(&r.vt);
+    close(fds[0]);
+}
+
+int main(void)
+{
+    test_text();
+    test_sequences();
+    test_winbox(80, 24);
+    test_winbox(257, 70);
+    test_winbox_nonblocking();
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,560 @@
+// vt.h -- headless terminal emulator for tests and benchmarks
+//
+//   Parses what a TUI writes to the terminal (UTF-8 text, C0 controls and
+//   the common CSI/ESC/OSC sequences of xterm) into an in-memory grid of
+//   cells, so tests can assert on what the screen shows without a terminal,
+//   and counts the bytes and escape sequences it was fed, for benchmarks.
+//
+//   Vt vt;
+//   vt_init(&vt, 80, 24);
+//   vt_feed(&vt, output, output_size);
+//   assert(vt_cell(&vt, 0, 0).ch == 'H');
+//   printf("%zu bytes, %zu escapes\n", vt.stats.bytes, vt.stats.escapes);
+//   vt_free(&vt);
+//
+//   Not emulated: scroll regions, insert/delete of lines and characters,
+//   double width characters and charsets other than UTF-8. Sequences it does
+//   not know are counted in stats.unknown and otherwise ignored.
+#ifndef VT_H_
+#define VT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Colors of a cell: -1 is the default color of the terminal, 0-255 the
+// indexed ones (8-15 the bright variants of 0-7) and VT_RGB() true color.
+#define VT_COLOR_DEFAULT -1
+#define VT_RGB(r, g, b) (0x1000000 | (r) << 16 | (g) << 8 | (b))
+
+#define VT_BOLD      (1 << 0)
+#define VT_UNDERLINE (1 << 1)
+#define VT_REVERSE   (1 << 2)
+
+#ifndef VT_MAX_PARAMS
+#define VT_MAX_PARAMS 16
+#endif // VT_MAX_PARAMS
+
+typedef struct {
+    uint32_t ch;
+    int32_t fg;
+    int32_t bg;
+    uint8_t attrs;
+} Vt_Cell;
+
+// Everything is counted since vt_init() or the last vt_stats_reset()
+typedef struct {
+    size_t bytes;
+    size_t escapes;      // ESC sequences of any kind, CSI and OSC included
+    size_t cursor_moves; // CSI sequences that only move the cursor
+    size_t sgrs;         // CSI ... m
+    size_t printed;      // characters written into cells
+    size_t unknown;      // sequences that were ignored
+} Vt_Stats;
+
+typedef struct {
+    int width;
+    int height;
+    Vt_Cell *cells;       // width*height, row by row
+    Vt_Cell *saved_cells; // the main screen while the alternate one is up
+    int cursor_x;         // width after the last column: wraps on next print
+    int cursor_y;
+    int saved_x;
+    int saved_y;
+    bool cursor_visible;
+    bool alt_screen;
+    Vt_Cell pen;          // colors and attributes of what gets printed
+
+    // parser
+    int state;
+    int params[VT_MAX_PARAMS];
+    int param_count;
+    bool params_full;     // a separator past VT_MAX_PARAMS, drop what follows
+    char marker;          // '?' or '>' of private CSI sequences, 0 if none
+    uint32_t utf8;
+    int utf8_left;
+
+    Vt_Stats stats;
+} Vt;
+
+bool vt_init(Vt *vt, int width, int height);
+void vt_free(Vt *vt);
+void vt_feed(Vt *vt, const char *data, size_t size);
+// Reads from fd until it has nothing more (end of file or EAGAIN), false on
+// errors. Handy with a file the code under test writes into through another
+// descriptor.
+bool vt_feed_fd(Vt *vt, int fd);
+Vt_Cell vt_cell(const Vt *vt, int x, int y);
+// Row y as UTF-8 without its trailing spaces, NUL terminated. Returns the
+// length, which is cut short at out_size-1.
+size_t vt_row_text(const Vt *vt, int y, char *out, size_t out_size);
+void vt_stats_reset(Vt *vt);
+
+#endif // VT_H_
+
+//////////////////////////////
+
+#ifdef VT_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+enum {
+    VT_GROUND,
+    VT_ESCAPE,
+    VT_CHARSET, // ESC ( X and friends, X is skipped
+    VT_CSI,
+    VT_OSC,
+    VT_OSC_ESC, // ESC inside OSC, ST if followed by a backslash
+};
+
+static Vt_Cell vt__blank(const Vt *vt)
+{
+    Vt_Cell cell = {' ', vt->pen.fg, vt->pen.bg, 0};
+    return cell;
+}
+
+static void vt__fill(Vt *vt, int from, int to)
+{
+    Vt_Cell blank = vt__blank(vt);
+    for (int i = from; i < to; ++i) vt->cells[i] = blank;
+}
+
+static void vt__reset(Vt *vt)
+{
+    vt->pen = (Vt_Cell){' ', VT_COLOR_DEFAULT, VT_COLOR_DEFAULT, 0};
+    vt__fill(vt, 0, vt->width*vt->height);
+    vt->cursor_x = 0;
+    vt->cursor_y = 0;
+    vt->saved_x = 0;
+    vt->saved_y = 0;
+    vt->cursor_visible = true;
+    vt->state = VT_GROUND;
+}
+
+bool vt_init(Vt *vt, int width, int height)
+{
+    memset(vt, 0, sizeof(*vt));
+    vt->width = width;
+    vt->height = height;
+    vt->cells = malloc(sizeof(Vt_Cell)*width*height);
+    vt->saved_cells = malloc(sizeof(Vt_Cell)*width*height);
+    if (vt->cells == NULL || vt->saved_cells == NULL) {
+        vt_free(vt);
+        return false;
+    }
+    vt__reset(vt);
+    return true;
+}
+
+void vt_free(Vt *vt)
+{
+    free(vt->cells);
+    free(vt->saved_cells);
+    memset(vt, 0, sizeof(*vt));
+}
+
+Vt_Cell vt_cell(const Vt *vt, int x, int y)
+{
+    if (x < 0 || x >= vt->width || y < 0 || y >= vt->height) {
+        return (Vt_Cell){0, VT_COLOR_DEFAULT, VT_COLOR_DEFAULT, 0};
+    }
+    return vt->cells[y*vt->width + x];
+}
+
+size_t vt_row_text(const Vt *vt, int y, char *out, size_t out_size)
+{
+    size_t len = 0;
+    if (out_size == 0) return 0;
+    if (y >= 0 && y < vt->height) {
+        int end = vt->width;
+        while (end > 0 && vt->cells[y*vt->width + end - 1].ch == ' ') end--;
+        for (int x = 0; x < end; ++x) {
+            uint32_t ch = vt->cells[y*vt->width + x].ch;
+            char buf[4];
+            size_t n;
+            if (ch < 0x80) {
+                buf[0] = (char)ch;
+                n = 1;
+            } else if (ch < 0x800) {
+                buf[0] = (char)(0xC0 | ch >> 6);
+                buf[1] = (char)(0x80 | (ch & 0x3F));
+                n = 2;
+            } else if (ch < 0x10000) {
+                buf[0] = (char)(0xE0 | ch >> 12);
+                buf[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
+                buf[2] = (char)(0x80 | (ch & 0x3F));
+                n = 3;
+            } else {
+                buf[0] = (char)(0xF0 | ch >> 18);
+                buf[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
+                buf[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
+                buf[3] = (char)(0x80 | (ch & 0x3F));
+                n = 4;
+            }
+            if (len + n > out_size - 1) break;
+            memcpy(out + len, buf, n);
+            len += n;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+void vt_stats_reset(Vt *vt)
+{
+    memset(&vt->stats, 0, sizeof(vt->stats));
+}
+
+static void vt__scroll_up(Vt *vt)
+{
+    memmove(vt->cells, vt->cells + vt->width, sizeof(Vt_Cell)*vt->width*(vt->height - 1));
+    vt__fill(vt, vt->width*(vt->height - 1), vt->width*vt->height);
+}
+
+static void vt__line_feed(Vt *vt)
+{
+    if (vt->cursor_y == vt->height - 1) {
+        vt__scroll_up(vt);
+    } else {
+        vt->cursor_y++;
+    }
+}
+
+static int vt__clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void vt__move(Vt *vt, int x, int y)
+{
+    vt->cursor_x = vt__clamp(x, 0, vt->width - 1);
+    vt->cursor_y = vt__clamp(y, 0, vt->height - 1);
+}
+
+static void vt__print(Vt *vt, uint32_t ch)
+{
+    if (vt->cursor_x >= vt->width) {
+        vt->cursor_x = 0;
+        vt__line_feed(vt);
+    }
+    Vt_Cell cell = vt->pen;
+    cell.ch = ch;
+    vt->cells[vt->cursor_y*vt->width + vt->cursor_x] = cell;
+    vt->cursor_x++;
+    vt->stats.printed++;
+}
+
+static void vt__control(Vt *vt, unsigned char c)
+{
+    switch (c) {
+    case '\r': vt->cursor_x = 0; break;
+    case '\n': case '\v': case '\f':
+        if (vt->cursor_x >= vt->width) vt->cursor_x = vt->width - 1;
+        vt__line_feed(vt);
+        break;
+    case '\b': if (vt->cursor_x > 0) vt->cursor_x = (vt->cursor_x >= vt->width ? vt->width : vt->cursor_x) - 1; break;
+    case '\t': vt->cursor_x = vt__clamp((vt->cursor_x/8 + 1)*8, 0, vt->width - 1); break;
+    default: break; // BEL and the rest do nothing to the screen
+    }
+}
+
+// Parameter i, or def if it is missing or 0
+static int vt__param(const Vt *vt, int i, int def)
+{
+    return i < vt->param_count && vt->params[i] > 0 ? vt->params[i] : def;
+}
+
+static void vt__sgr(Vt *vt)
+{
+    vt->stats.sgrs++;
+    if (vt->param_count == 0) {
+        vt->pen = (Vt_Cell){' ', VT_COLOR_DEFAULT, VT_COLOR_DEFAULT, 0};
+        return;
+    }
+    for (int i = 0; i < vt->param_count; ++i) {
+        int p = vt->params[i];
+        if (p == 0) {
+            vt->pen = (Vt_Cell){' ', VT_COLOR_DEFAULT, VT_COLOR_DEFAULT, 0};
+        } else if (p == 1) {
+            vt->pen.attrs |= VT_BOLD;
+        } else if (p == 4) {
+            vt->pen.attrs |= VT_UNDERLINE;
+        } else if (p == 7) {
+            vt->pen.attrs |= VT_REVERSE;
+        } else if (p == 22) {
+            vt->pen.attrs &= ~VT_BOLD;
+        } else if (p == 24) {
+            vt->pen.attrs &= ~VT_UNDERLINE;
+        } else if (p == 27) {
+            vt->pen.attrs &= ~VT_REVERSE;
+        } else if (p >= 30 && p <= 37) {
+            vt->pen.fg = p - 30;
+        } else if (p == 39) {
+            vt->pen.fg = VT_COLOR_DEFAULT;
+        } else if (p >= 40 && p <= 47) {
+            vt->pen.bg = p - 40;
+        } else if (p == 49) {
+            vt->pen.bg = VT_COLOR_DEFAULT;
+        } else if (p >= 90 && p <= 97) {
+            vt->pen.fg = p - 90 + 8;
+        } else if (p >= 100 && p <= 107) {
+            vt->pen.bg = p - 100 + 8;
+        } else if ((p == 38 || p == 48) && i + 1 < vt->param_count) {
+            int32_t color;
+            if (vt->params[i + 1] == 5 && i + 2 < vt->param_count) {
+                color = vt->params[i + 2] & 0xFF;
+                i += 2;
+            } else if (vt->params[i + 1] == 2 && i + 4 < vt->param_count) {
+                color = VT_RGB(vt->params[i + 2] & 0xFF, vt->params[i + 3] & 0xFF, vt->params[i + 4] & 0xFF);
+                i += 4;
+            } else {
+                vt->stats.unknown++;
+                return;
+            }
+            if (p == 38) vt->pen.fg = color; else vt->pen.bg = color;
+        } else {
+            vt->stats.unknown++;
+        }
+    }
+}
+
+static void vt__private_mode(Vt *vt, bool set)
+{
+    for (int i = 0; i < vt->param_count; ++i) {
+        switch (vt->params[i]) {
+        case 25:
+            vt->cursor_visible = set;
+            break;
+        case 47: case 1047: case 1049:
+            if (set == vt->alt_screen) break;
+            if (set) {
+                memcpy(vt->saved_cells, vt->cells, sizeof(Vt_Cell)*vt->width*vt->height);
+                vt__fill(vt, 0, vt->width*vt->height);
+            } else {
+                memcpy(vt->cells, vt->saved_cells, sizeof(Vt_Cell)*vt->width*vt->height);
+            }
+            vt->alt_screen = set;
+            break;
+        case 1000: case 1002: case 1003: case 1006: case 1015: case 2004:
+            break; // mouse reporting and bracketed paste, nothing to show
+        default:
+            vt->stats.unknown++;
+            break;
+        }
+    }
+}
+
+static void vt__csi(Vt *vt, char final)
+{
+    int x = vt->cursor_x >= vt->width ? vt->width - 1 : vt->cursor_x;
+    int y = vt->cursor_y;
+    int row = y*vt->width;
+
+    if (vt->marker == '?') {
+        if (final == 'h' || final == 'l') vt__private_mode(vt, final == 'h');
+        else vt->stats.unknown++;
+        return;
+    }
+    if (vt->marker != 0) {
+        vt->stats.unknown++;
+        return;
+    }
+
+    switch (final) {
+    case 'H': case 'f':
+        vt__move(vt, vt__param(vt, 1, 1) - 1, vt__param(vt, 0, 1) - 1);
+        vt->stats.cursor_moves++;
+        break;
+    case 'A': vt__move(vt, x, y - vt__param(vt, 0, 1)); vt->stats.cursor_moves++; break;
+    case 'B': vt__move(vt, x, y + vt__param(vt, 0, 1)); vt->stats.cursor_moves++; break;
+    case 'C': vt__move(vt, x + vt__param(vt, 0, 1), y); vt->stats.cursor_moves++; break;
+    case 'D': vt__move(vt, x - vt__param(vt, 0, 1), y); vt->stats.cursor_moves++; break;
+    case 'G': vt__move(vt, vt__param(vt, 0, 1) - 1, y); vt->stats.cursor_moves++; break;
+    case 'd': vt__move(vt, x, vt__param(vt, 0, 1) - 1); vt->stats.cursor_moves++; break;
+    case 'J':
+        switch (vt->param_count > 0 ? vt->params[0] : 0) {
+        case 0: vt__fill(vt, row + x, vt->width*vt->height); break;
+        case 1: vt__fill(vt, 0, row + x + 1); break;
+        case 2: case 3: vt__fill(vt, 0, vt->width*vt->height); break;
+        default: vt->stats.unknown++; break;
+        }
+        break;
+    case 'K':
+        switch (vt->param_count > 0 ? vt->params[0] : 0) {
+        case 0: vt__fill(vt, row + x, row + vt->width); break;
+        case 1: vt__fill(vt, row, row + x + 1); break;
+        case 2: vt__fill(vt, row, row + vt->width); break;
+        default: vt->stats.unknown++; break;
+        }
+        break;
+    case 'X':
+        vt__fill(vt, row + x, row + vt__clamp(x + vt__param(vt, 0, 1), 0, vt->width));
+        break;
+    case 'm':
+        vt__sgr(vt);
+        break;
+    case 's':
+        vt->saved_x = x;
+        vt->saved_y = y;
+        break;
+    case 'u':
+        vt__move(vt, vt->saved_x, vt->saved_y);
+        break;
+    default:
+        vt->stats.unknown++;
+        break;
+    }
+}
+
+static void vt__escape(Vt *vt, unsigned char c)
+{
+    vt->state = VT_GROUND;
+    switch (c) {
+    case '[':
+        vt->state = VT_CSI;
+        vt->param_count = 0;
+        vt->params_full = false;
+        vt->marker = 0;
+        return; // counted when it ends
+    case ']':
+        vt->state = VT_OSC;
+        return;
+    case '(': case ')': case '*': case '+':
+        vt->state = VT_CHARSET;
+        return;
+    case '7':
+        vt->saved_x = vt->cursor_x >= vt->width ? vt->width - 1 : vt->cursor_x;
+        vt->saved_y = vt->cursor_y;
+        break;
+    case '8':
+        vt__move(vt, vt->saved_x, vt->saved_y);
+        break;
+    case 'c':
+        vt__reset(vt);
+        break;
+    case 'D':
+        vt__line_feed(vt);
+        break;
+    case 'E':
+        vt->cursor_x = 0;
+        vt__line_feed(vt);
+        break;
+    case '=': case '>':
+        break; // keypad modes
+    default:
+        vt->stats.unknown++;
+        break;
+    }
+    vt->stats.escapes++;
+}
+
+void vt_feed(Vt *vt, const char *data, size_t size)
+{
+    vt->stats.bytes += size;
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = (unsigned char)data[i];
+        switch (vt->state) {
+        case VT_GROUND:
+            if (vt->utf8_left > 0) {
+                if ((c & 0xC0) == 0x80) {
+                    vt->utf8 = vt->utf8 << 6 | (c & 0x3F);
+                    if (--vt->utf8_left == 0) vt__print(vt, vt->utf8);
+                    break;
+                }
+                vt->utf8_left = 0;
+                vt__print(vt, 0xFFFD);
+            }
+            if (c == 0x1B) {
+                vt->state = VT_ESCAPE;
+            } else if (c < 0x20 || c == 0x7F) {
+                vt__control(vt, c);
+            } else if (c < 0x80) {
+                vt__print(vt, c);
+            } else if ((c & 0xE0) == 0xC0) {
+                vt->utf8 = c & 0x1F;
+                vt->utf8_left = 1;
+            } else if ((c & 0xF0) == 0xE0) {
+                vt->utf8 = c & 0x0F;
+                vt->utf8_left = 2;
+            } else if ((c & 0xF8) == 0xF0) {
+                vt->utf8 = c & 0x07;
+                vt->utf8_left = 3;
+            } else {
+                vt__print(vt, 0xFFFD);
+            }
+            break;
+        case VT_ESCAPE:
+            vt__escape(vt, c);
+            break;
+        case VT_CHARSET:
+            vt->state = VT_GROUND;
+            vt->stats.escapes++;
+            break;
+        case VT_CSI:
+            if (c >= '0' && c <= '9') {
+                if (vt->params_full) break;
+                if (vt->param_count == 0) vt->params[vt->param_count++] = 0;
+                int *p = &vt->params[vt->param_count - 1];
+                if (*p < 100000) *p = *p*10 + (c - '0');
+            } else if (c == ';' || c == ':') {
+                if (vt->param_count == 0) vt->params[vt->param_count++] = 0;
+                if (vt->param_count < VT_MAX_PARAMS) vt->params[vt->param_count++] = 0;
+                else vt->params_full = true;
+            } else if (c == '?' || c == '>' || c == '<' || c == '=') {
+                vt->marker = (char)c;
+            } else if (c >= 0x40 && c <= 0x7E) {
+                vt->state = VT_GROUND;
+                vt->stats.escapes++;
+                vt__csi(vt, (char)c);
+            } else if (c == 0x1B) {
+                vt->state = VT_ESCAPE; // aborts the sequence, starts a new one
+            } else if (c < 0x20) {
+                vt__control(vt, c); // C0 controls act even inside sequences
+            }
+            break;
+        case VT_OSC:
+            if (c == 0x07) {
+                vt->state = VT_GROUND;
+                vt->stats.escapes++;
+            } else if (c == 0x1B) {
+                vt->state = VT_OSC_ESC;
+            }
+            break;
+        case VT_OSC_ESC:
+            // Anything but ST aborts the OSC, only the new escape is counted
+            if (c == '\\') {
+                vt->state = VT_GROUND;
+                vt->stats.escapes++;
+            } else {
+                vt__escape(vt, c);
+            }
+            break;
+        }
+    }
+}
+
+#ifndef _WIN32
+bool vt_feed_fd(Vt *vt, int fd)
+{
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            vt_feed(vt, buf, (size_t)n);
+        } else if (n == 0) {
+            return true;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+}
+#endif // _WIN32
+
+#endif // VT_IMPLEMENTATION